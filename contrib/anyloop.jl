@@ -12,6 +12,9 @@ export AYLP_MAGIC, AYLP_SCHEMA_VERSION,
     AYLP_T_MATRIX,
     AYLP_T_BLOCK_UCHAR,
     AYLP_T_MATRIX_UCHAR,
+    AYLP_T_MATRIX_USHORT,
+    AYLP_T_VECTOR_FLOAT,
+    AYLP_T_MATRIX_FLOAT,
     AYLP_T_ANY,
     AYLPUnits,
     AYLP_U_NONE,
@@ -47,7 +50,7 @@ end
 =#
 
 AYLP_MAGIC::UInt32 = 0x504C5941
-AYLP_SCHEMA_VERSION::UInt8 = 0
+AYLP_SCHEMA_VERSION::UInt8 = 1
 
 @enum AYLPStatus begin
     AYLP_DONE = 1 << 0
@@ -60,7 +63,10 @@ end
     AYLP_T_MATRIX = 1 << 3
     AYLP_T_BLOCK_UCHAR = 1 << 4
     AYLP_T_MATRIX_UCHAR = 1 << 5
-    AYLP_T_ANY = 0xFF
+    AYLP_T_MATRIX_USHORT = 1 << 6
+    AYLP_T_VECTOR_FLOAT = 1 << 7
+    AYLP_T_MATRIX_FLOAT = 1 << 8
+    AYLP_T_ANY = 0xFFFF
 end
 
 @enum AYLPUnits begin
@@ -78,12 +84,14 @@ mutable struct AYLPHeader
     magic::UInt32
     aylp_version::UInt8
     aylp_status::UInt8
-    aylp_type::UInt8
+    aylp_type::UInt16
     aylp_units::UInt8
     log_dim_y::UInt64
     log_dim_x::UInt64
     pitch_y::Float64
     pitch_x::Float64
+    frame::UInt64
+    timestamp::UInt64
 end
 
 mutable struct AYLPChunk
@@ -91,6 +99,8 @@ mutable struct AYLPChunk
     data::Union{
         Matrix{Float64},    # for gsl_block, gsl_vector, or gsl_matrix
         Matrix{UInt8},      # for gsl_block_uchar or gsl_matrix_uchar
+        Matrix{UInt16},     # for gsl_matrix_ushort
+        Matrix{Float32},    # for gsl_vector_float or gsl_matrix_float
     }
 end
 
@@ -101,16 +111,24 @@ function Base.read(io::IO, ::Type{AYLPHeader})
     magic = read(io, UInt32)
     @assert magic == AYLP_MAGIC
     aylp_version = read(io, UInt8)
+    if aylp_version != AYLP_SCHEMA_VERSION
+        # the rest of the header would be at the wrong offsets
+        throw(ArgumentError("AYLP schema version is $(aylp_version), but "
+            * "this reader only knows $(AYLP_SCHEMA_VERSION)"))
+    end
     aylp_status = read(io, UInt8)
+    aylp_type = read(io, UInt16)
     aylp_units = read(io, UInt8)
-    aylp_type = read(io, UInt8)
+    skip(io, 7)     # reserved
     log_dim_y = read(io, UInt64)
     log_dim_x = read(io, UInt64)
     pitch_y = read(io, Float64)
     pitch_x = read(io, Float64)
+    frame = read(io, UInt64)
+    timestamp = read(io, UInt64)
     return AYLPHeader(
-        magic, aylp_version, aylp_status, aylp_units, aylp_type,
-        log_dim_y, log_dim_x, pitch_y, pitch_x
+        magic, aylp_version, aylp_status, aylp_type, aylp_units,
+        log_dim_y, log_dim_x, pitch_y, pitch_x, frame, timestamp
     )
 end
 
@@ -136,6 +154,24 @@ function Base.read(io::IO, ::Type{AYLPChunk})
             # same deal with column-major
             Matrix{UInt8}(reshape(data, (head.log_dim_x, head.log_dim_y))')
         )
+    elseif AYLPType(head.aylp_type) == AYLP_T_MATRIX_USHORT
+        data = Vector{UInt16}(undef, size)
+        for i in 1:size
+            data[i] = read(io, UInt16)
+        end
+        return AYLPChunk(head,
+            # same deal with column-major
+            Matrix{UInt16}(reshape(data, (head.log_dim_x, head.log_dim_y))')
+        )
+    elseif AYLPType(head.aylp_type) in [AYLP_T_VECTOR_FLOAT, AYLP_T_MATRIX_FLOAT]
+        data = Vector{Float32}(undef, size)
+        for i in 1:size
+            data[i] = read(io, Float32)
+        end
+        return AYLPChunk(head,
+            # same deal with column-major
+            Matrix{Float32}(reshape(data, (head.log_dim_x, head.log_dim_y))')
+        )
     else
         throw(ArgumentError("unknown type $(head.aylp_type)"))
     end
@@ -148,10 +184,13 @@ function Base.write(io::IO, x::AYLPHeader)
     n += write(io, x.aylp_status)
     n += write(io, x.aylp_type)
     n += write(io, x.aylp_units)
+    n += write(io, zeros(UInt8, 7))     # reserved
     n += write(io, x.log_dim_y)
     n += write(io, x.log_dim_x)
     n += write(io, x.pitch_y)
     n += write(io, x.pitch_x)
+    n += write(io, x.frame)
+    n += write(io, x.timestamp)
     @assert n == sizeof(AYLPHeader)
     return n
 end
@@ -179,6 +218,22 @@ function Base.write(io::IO, x::AYLPChunk)
         end
         @assert n == sizeof(AYLPHeader) + size
         return n
+    elseif AYLPType(x.head.aylp_type) == AYLP_T_MATRIX_USHORT
+        @assert x.data isa Matrix{UInt16}
+        for r in eachrow(x.data)
+            n += write(io, r)
+        end
+        @assert n == sizeof(AYLPHeader) + 2 * size
+        return n
+    elseif AYLPType(x.head.aylp_type) in [
+        AYLP_T_VECTOR_FLOAT, AYLP_T_MATRIX_FLOAT
+    ]
+        @assert x.data isa Matrix{Float32}
+        for r in eachrow(x.data)
+            n += write(io, r)
+        end
+        @assert n == sizeof(AYLPHeader) + 4 * size
+        return n
     else
         throw(ArgumentError("unknown type $(x.head.aylp_type)"))
     end
@@ -0,0 +1,142 @@
+// Measures the PID update on 2k, 10k, and 100k elements, comparing the
+// per-element pid_step loop over strided gsl vectors (which anyloop:pid still
+// uses for non-contiguous input) against the contiguous kernel, run on one
+// thread and split between threads with aylp_parallel_for.
+// Build with `meson compile -C build bench_pid`, then run
+// `./build/bench_pid [threads] [iterations]`.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <gsl/gsl_vector.h>
+
+#include "logging.h"
+#include "pid.h"
+#include "pid_kernels.h"
+#include "thread_pool.h"
+
+
+static const size_t sizes[] = {2000, 10000, 100000};
+
+struct bench_ctx {
+	pid_kernel kernel;
+	struct pid_coeffs k;
+	const double *s;
+	double *a, *p, *r;
+};
+
+
+static double now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1E9 + ts.tv_nsec;
+}
+
+
+static double bench_step(size_t n, size_t n_iter, const struct pid_coeffs *k)
+{
+	gsl_vector *s = gsl_vector_alloc(n);
+	gsl_vector *a = gsl_vector_calloc(n);
+	gsl_vector *p = gsl_vector_calloc(n);
+	gsl_vector *r = gsl_vector_alloc(n);
+	for (size_t j = 0; j < n; j++) s->data[j] = (j % 17) / 17.0 - 0.5;
+	double d = k->d_dt * k->dt;
+
+	double start = now_ns();
+	for (size_t it = 0; it < n_iter; it++) {
+		for (size_t j = 0; j < s->size; j++) {
+			r->data[j*r->stride] = pid_step(
+				k->p, k->i, d, k->clamp, k->dt,
+				s->data[j*s->stride], &a->data[j*a->stride],
+				&p->data[j*p->stride]
+			);
+		}
+	}
+	double elapsed = now_ns() - start;
+
+	gsl_vector_free(s); gsl_vector_free(a);
+	gsl_vector_free(p); gsl_vector_free(r);
+	return elapsed / n_iter;
+}
+
+
+static void kernel_range(void *ctx, size_t start, size_t end)
+{
+	struct bench_ctx *c = ctx;
+	c->kernel(&c->k, end - start, c->s + start,
+		c->a + start, c->p + start, c->r + start
+	);
+}
+
+
+static double bench_kernel(size_t n, size_t n_iter, const struct pid_coeffs *k,
+	struct aylp_pool *pool
+){
+	double *s = malloc(n * sizeof(double));
+	struct bench_ctx c = {
+		.kernel = pid_kernel_select(0),
+		.k = *k,
+		.s = s,
+		.a = calloc(n, sizeof(double)),
+		.p = calloc(n, sizeof(double)),
+		.r = malloc(n * sizeof(double)),
+	};
+	for (size_t j = 0; j < n; j++) s[j] = (j % 17) / 17.0 - 0.5;
+	// as in pid.c
+	size_t n_tasks = pool ? 2 * (pool->n_threads + 1) : 1;
+	size_t chunk = (n + n_tasks - 1) / n_tasks;
+	chunk = (chunk + 63) / 64 * 64;
+
+	double start = now_ns();
+	for (size_t it = 0; it < n_iter; it++) {
+		if (pool) aylp_parallel_for(pool, n, chunk, kernel_range, &c);
+		else kernel_range(&c, 0, n);
+	}
+	double elapsed = now_ns() - start;
+
+	free(s); free(c.a); free(c.p); free(c.r);
+	return elapsed / n_iter;
+}
+
+
+int main(int argc, char **argv)
+{
+	log_init(LOG_WARN);
+	size_t n_threads = argc > 1 ? strtoul(argv[1], 0, 0) : 4;
+	size_t n_iter = argc > 2 ? strtoul(argv[2], 0, 0) : 2000;
+	if (!n_threads || !n_iter) {
+		fprintf(stderr, "usage: %s [threads] [iterations]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	const char *kernel_name;
+	pid_kernel_select(&kernel_name);
+	struct pid_coeffs k = {
+		.p = 0.5, .i = 20.0, .clamp = 0.8,
+		.dt = 5E-4, .d_dt = 1E-3 / 5E-4,
+	};
+	struct aylp_pool *pool = calloc(1, sizeof(struct aylp_pool));
+	// the calling thread counts as one of the threads here
+	pool_start(pool, n_threads - 1, 0, 0);
+
+	printf("%s kernel, %zu threads, %zu iterations\n",
+		kernel_name, n_threads, n_iter
+	);
+	printf("%10s %14s %14s %14s\n",
+		"elements", "pid_step", "kernel", "kernel (mt)"
+	);
+	for (size_t i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++) {
+		size_t n = sizes[i];
+		printf("%10zu %11.2f us %11.2f us %11.2f us\n", n,
+			bench_step(n, n_iter, &k) / 1E3,
+			bench_kernel(n, n_iter, &k, 0) / 1E3,
+			bench_kernel(n, n_iter, &k, pool) / 1E3
+		);
+	}
+
+	pool_stop(pool);
+	free(pool);
+	return EXIT_SUCCESS;
+}
+
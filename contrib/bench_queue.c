@@ -0,0 +1,215 @@
+// Measures how long it takes to hand tasks to a thread pool, comparing the
+// lock-free aylp_queue against the mutex/condvar linked-list queue it replaced,
+// and against handing out the same indices with aylp_parallel_for. The tasks
+// themselves do next to nothing, so this is all dispatch overhead.
+// Build with `meson compile -C build bench_queue`, then run
+// `./build/bench_queue [threads] [tasks_per_batch] [batches]`.
+
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "logging.h"
+#include "thread_pool.h"
+
+
+/** The old queue, kept here for comparison. */
+struct mutex_task {
+	void (*func)(void *src, void *dst);
+	void *src;
+	void *dst;
+	struct mutex_task *next_task;
+};
+
+struct mutex_queue {
+	pthread_mutex_t mutex;
+	pthread_cond_t ready;
+	struct mutex_task *oldest_task;
+	struct mutex_task *newest_task;
+	bool exit;
+	atomic_size_t tasks_processing;
+};
+
+static void mutex_enqueue(struct mutex_queue *queue, struct mutex_task *task)
+{
+	// (unlike the original, count the task here so waiting on
+	// tasks_processing can't return early)
+	queue->tasks_processing += 1;
+	pthread_mutex_lock(&queue->mutex);
+	if (!queue->oldest_task) queue->oldest_task = task;
+	if (queue->newest_task && queue->newest_task != task)
+		queue->newest_task->next_task = task;
+	queue->newest_task = task;
+	pthread_mutex_unlock(&queue->mutex);
+	pthread_cond_signal(&queue->ready);
+}
+
+static struct mutex_task *mutex_dequeue(struct mutex_queue *queue)
+{
+	struct mutex_task *ret;
+	pthread_mutex_lock(&queue->mutex);
+	while (!queue->oldest_task) {
+		pthread_cond_wait(&queue->ready, &queue->mutex);
+		if (queue->exit) {
+			pthread_mutex_unlock(&queue->mutex);
+			return 0;
+		}
+	}
+	ret = queue->oldest_task;
+	queue->oldest_task = ret->next_task;
+	pthread_mutex_unlock(&queue->mutex);
+	return ret;
+}
+
+static void *mutex_runner(void *queue)
+{
+	struct mutex_queue *q = queue;
+	while (1) {
+		struct mutex_task *task = mutex_dequeue(q);
+		if (q->exit) return 0;
+		task->func(task->src, task->dst);
+		q->tasks_processing -= 1;
+	}
+	return 0;
+}
+
+
+static void noop_task(void *src, void *dst)
+{
+	*(size_t *)dst = (size_t)src;
+}
+
+
+static double now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1E9 + ts.tv_nsec;
+}
+
+
+static double bench_mutex(size_t n_threads, size_t n_tasks, size_t n_batches)
+{
+	struct mutex_queue q = {
+		.mutex = PTHREAD_MUTEX_INITIALIZER,
+		.ready = PTHREAD_COND_INITIALIZER,
+	};
+	pthread_t *threads = calloc(n_threads, sizeof(pthread_t));
+	struct mutex_task *tasks = calloc(n_tasks, sizeof(struct mutex_task));
+	size_t *out = calloc(n_tasks, sizeof(size_t));
+	for (size_t t = 0; t < n_threads; t++)
+		pthread_create(&threads[t], 0, mutex_runner, &q);
+
+	double start = now_ns();
+	for (size_t b = 0; b < n_batches; b++) {
+		for (size_t i = 0; i < n_tasks; i++) {
+			tasks[i] = (struct mutex_task){
+				.func = noop_task,
+				.src = (void *)i,
+				.dst = &out[i],
+			};
+			mutex_enqueue(&q, &tasks[i]);
+		}
+		while (q.tasks_processing) sched_yield();
+	}
+	double elapsed = now_ns() - start;
+
+	pthread_mutex_lock(&q.mutex);
+	q.exit = true;
+	pthread_cond_broadcast(&q.ready);
+	pthread_mutex_unlock(&q.mutex);
+	for (size_t t = 0; t < n_threads; t++)
+		pthread_join(threads[t], 0);
+	free(out); free(tasks); free(threads);
+	return elapsed / (n_tasks * n_batches);
+}
+
+
+static double bench_lockfree(size_t n_threads, size_t n_tasks, size_t n_batches)
+{
+	struct aylp_queue *q = calloc(1, sizeof(struct aylp_queue));
+	pthread_t *threads = calloc(n_threads, sizeof(pthread_t));
+	struct aylp_task *tasks = calloc(n_tasks, sizeof(struct aylp_task));
+	size_t *out = calloc(n_tasks, sizeof(size_t));
+	for (size_t t = 0; t < n_threads; t++)
+		pthread_create(&threads[t], 0, task_runner, q);
+
+	double start = now_ns();
+	for (size_t b = 0; b < n_batches; b++) {
+		for (size_t i = 0; i < n_tasks; i++) {
+			tasks[i] = (struct aylp_task){
+				.func = noop_task,
+				.src = (void *)i,
+				.dst = &out[i],
+			};
+			task_enqueue(q, &tasks[i]);
+		}
+		while (q->tasks_processing) sched_yield();
+	}
+	double elapsed = now_ns() - start;
+
+	shut_queue(q);
+	for (size_t t = 0; t < n_threads; t++)
+		pthread_join(threads[t], 0);
+	free(out); free(tasks); free(threads); free(q);
+	return elapsed / (n_tasks * n_batches);
+}
+
+
+static void noop_range(void *ctx, size_t start, size_t end)
+{
+	size_t *out = ctx;
+	for (size_t i = start; i < end; i++) out[i] = i;
+}
+
+
+static double bench_parallel_for(size_t n_threads, size_t n_tasks,
+	size_t n_batches
+){
+	struct aylp_pool *pool = calloc(1, sizeof(struct aylp_pool));
+	size_t *out = calloc(n_tasks, sizeof(size_t));
+	// the calling thread counts as one of the threads here
+	pool_start(pool, n_threads - 1, 0, 0);
+
+	double start = now_ns();
+	for (size_t b = 0; b < n_batches; b++) {
+		aylp_parallel_for(pool, n_tasks, 1, noop_range, out);
+	}
+	double elapsed = now_ns() - start;
+
+	pool_stop(pool);
+	free(out); free(pool);
+	return elapsed / (n_tasks * n_batches);
+}
+
+
+int main(int argc, char **argv)
+{
+	log_init(LOG_WARN);
+	size_t n_threads = argc > 1 ? strtoul(argv[1], 0, 0) : 4;
+	size_t n_tasks = argc > 2 ? strtoul(argv[2], 0, 0) : 256;
+	size_t n_batches = argc > 3 ? strtoul(argv[3], 0, 0) : 2000;
+	if (!n_threads || !n_tasks || !n_batches) {
+		fprintf(stderr, "usage: %s [threads] [tasks_per_batch] "
+			"[batches]\n", argv[0]
+		);
+		return EXIT_FAILURE;
+	}
+	printf("%zu threads, %zu batches of %zu tasks\n",
+		n_threads, n_batches, n_tasks
+	);
+	printf("mutex/condvar: %8.1f ns/task\n",
+		bench_mutex(n_threads, n_tasks, n_batches)
+	);
+	printf("lock-free:     %8.1f ns/task\n",
+		bench_lockfree(n_threads, n_tasks, n_batches)
+	);
+	printf("parallel_for:  %8.1f ns/task\n",
+		bench_parallel_for(n_threads, n_tasks, n_batches)
+	);
+	return EXIT_SUCCESS;
+}
+
@@ -1,68 +1,91 @@
+#include <math.h>
 #include <pthread.h>
 #include <string.h>
+#include <time.h>
 
 #include "anyloop.h"
 #include "logging.h"
 #include "thread_pool.h"
 #include "center_of_mass.h"
+#include "com_kernels.h"
+#include "load.h"
 #include "xalloc.h"
 
 
-// TODO: optimize? for example, if the matrix is contiguous and 8x8 in size, the
-// compiler can do some really nice optimizations here. but for variable sizes,
-// and non-contiguous matrices ... it gets a little harder.
-// With -O3, on my old laptop, I timed that this could do 10 million 8x8
-// matrices in 4.302 s, whereas the naive solution with contiguous memory took
-// 2.447 s. So even with this naive non-contiguous solution, we still get at
-// worst 0.4 μs per matrix, which is ... not the worst. That's 43 μs for a 10x10
-// grid of submatrices, with no multithreading. GCC is quite intelligent.
-/** Center of mass task for gsl_matrix_uchar.
-* Will write (y,x) coords (in that order) of the center of mass of the uchar
-* matrix at src to dst[0] and dst[1]. */
-void com_mat_uchar(gsl_matrix_uchar *src, double *dst)
+// Gaussian wcog weights centered on the region, out of COM_WEIGHT_ONE
+static int16_t *gaussian_weights(size_t height, size_t width, double fwhm)
 {
-	double y = 0.0, x = 0.0, s = 0.0;
-	// take weighted average
-	for (size_t i=0; i < src->size1; i++) {
-		for (size_t j=0; j < src->size2; j++) {
-			unsigned char el = src->data[i*src->tda + j];
-			y += i*el;
-			x += j*el;
-			s += el;
+	int16_t *weights = xmalloc(height * width * sizeof(int16_t));
+	double cy = (height - 1) / 2.0;
+	double cx = (width - 1) / 2.0;
+	double k = 4.0 * log(2.0) / (fwhm * fwhm);
+	for (size_t i = 0; i < height; i++) {
+		for (size_t j = 0; j < width; j++) {
+			double r2 = (i-cy)*(i-cy) + (j-cx)*(j-cx);
+			weights[i*width + j] = lround(
+				COM_WEIGHT_ONE * exp(-k * r2)
+			);
 		}
 	}
-	// set final values, scaling from 0:size-1 (given by y/s or x/s) to -1:1
-	dst[0] = -1.0 + 2*y/(s*(src->size1-1));
-	dst[1] = -1.0 + 2*x/(s*(src->size2-1));
+	return weights;
+}
+
+
+// read the valid_mask param, from an AYLP file or an inline json matrix
+static int load_valid_mask(gsl_matrix_uchar **mask, json_object *val)
+{
+	if (json_object_is_type(val, json_type_string)) {
+		return load_matrix_uchar_from_file(
+			mask, json_object_get_string(val)
+		);
+	}
+	gsl_matrix *m = 0;
+	if (load_matrix_from_json(&m, val)) {
+		xfree_type(gsl_matrix, m);
+		return -1;
+	}
+	if (!m) {
+		log_error("valid_mask is empty");
+		return -1;
+	}
+	*mask = xmalloc_type(gsl_matrix_uchar, m->size1, m->size2);
+	for (size_t i = 0; i < m->size1; i++) {
+		for (size_t j = 0; j < m->size2; j++) {
+			gsl_matrix_uchar_set(*mask, i, j,
+				gsl_matrix_get(m, i, j) != 0
+			);
+		}
+	}
+	xfree_type(gsl_matrix, m);
+	return 0;
 }
 
 
-// This is nice and fast, but doesn't work for us, because we want to find the
-// com of a slice of non-contiguous memory....
-// TODO: actually, it seems like contiguous matrices are one of the most likely
-// scenarios in practice, e.g. if we're reading from a camera. Consider
-// switching to this at runtime!
-// /** Hardcoded 8x8 center of mass task so the compiler can optimize it.
-// * Will look at 64 uchars at src, and write the output as two doubles in dst
-// * in (y,x) order. */
-// void com_8x8(unsigned char *src, double *dst)
-// {
-// 	double y = 0.0, x = 0.0, s = 0.0;
-// 	for (char i = 0; i < 8; i++) {
-// 		for (char j = 0; j < 8; j++) {
-// 			y += i * src->data[8*i+j];
-// 			x += j * src->data[8*i+j];
-// 			s += src->data[8*i+j];
-// 		}
-// 	}
-// 	dst[0] = y / s;
-// 	dst[1] = x / s;
-// }
+// compile the valid mask into a list of subapertures
+static void pack_subaps(struct aylp_center_of_mass_data *data)
+{
+	gsl_matrix_uchar *mask = data->valid_mask;
+	data->subaps = xmalloc(
+		mask->size1 * mask->size2 * sizeof(struct com_subap)
+	);
+	data->subap_count = 0;
+	for (size_t i = 0; i < mask->size1; i++) {
+		for (size_t j = 0; j < mask->size2; j++) {
+			if (!gsl_matrix_uchar_get(mask, i, j)) continue;
+			data->subaps[data->subap_count++] = (struct com_subap){
+				.y = i * data->region_height,
+				.x = j * data->region_width,
+			};
+		}
+	}
+	log_info("%zu of %zu subapertures are valid", data->subap_count,
+		mask->size1 * mask->size2
+	);
+}
 
 
 int center_of_mass_init(struct aylp_device *self)
 {
-	int err;
 	self->device_data = xcalloc(1, sizeof(struct aylp_center_of_mass_data));
 	struct aylp_center_of_mass_data *data = self->device_data;
 
@@ -70,6 +93,14 @@ int center_of_mass_init(struct aylp_device *self)
 	data->region_height = 0;
 	data->region_width = 0;
 	data->thread_count = 1;
+	data->tasks_per_thread = 4;
+	data->type = AYLP_T_MATRIX_UCHAR;
+	data->mode = COM_COG;
+	data->threshold = 0;
+	data->fwhm = 0;
+	// these depend on the type, so we check them after parsing
+	const char *dark_filename = 0;
+	size_t threshold = 0;
 	// parse parameters
 	if (!self->params) {
 		log_error("No params object found.");
@@ -84,6 +115,49 @@ int center_of_mass_init(struct aylp_device *self)
 		} else if (!strcmp(key, "region_width")) {
 			data->region_width = json_object_get_uint64(val);
 			log_trace("region_width = %zu", data->region_width);
+		} else if (!strcmp(key, "type")) {
+			const char *s = json_object_get_string(val);
+			data->type = aylp_type_from_string(s);
+			if (!(data->type
+				& (AYLP_T_MATRIX_UCHAR|AYLP_T_MATRIX_USHORT))
+				|| data->type == AYLP_T_ANY
+			) {
+				log_error("Unsupported type: %s", s);
+				return -1;
+			}
+			log_trace("type = %s (0x%hX)", s, data->type);
+		} else if (!strcmp(key, "mode")) {
+			const char *s = json_object_get_string(val);
+			if (!strcmp(s, "cog")) {
+				data->mode = COM_COG;
+			} else if (!strcmp(s, "tcog")) {
+				data->mode = COM_TCOG;
+			} else if (!strcmp(s, "wcog")) {
+				data->mode = COM_WCOG;
+			} else {
+				log_error("Unrecognized mode: %s", s);
+				return -1;
+			}
+			log_trace("mode = %s", s);
+		} else if (!strcmp(key, "dark")) {
+			dark_filename = json_object_get_string(val);
+			log_trace("dark = %s", dark_filename);
+		} else if (!strcmp(key, "threshold")) {
+			threshold = json_object_get_uint64(val);
+			log_trace("threshold = %zu", threshold);
+		} else if (!strcmp(key, "fwhm")) {
+			data->fwhm = json_object_get_double(val);
+			if (!(data->fwhm > 0)) {
+				log_error("fwhm must be positive");
+				return -1;
+			}
+			log_trace("fwhm = %G", data->fwhm);
+		} else if (!strcmp(key, "valid_mask")) {
+			if (load_valid_mask(&data->valid_mask, val))
+				return -1;
+			log_trace("valid_mask is %zu by %zu",
+				data->valid_mask->size1, data->valid_mask->size2
+			);
 		} else if (!strcmp(key, "thread_count")) {
 			data->thread_count = json_object_get_uint64(val);
 			if (data->thread_count == 0) {
@@ -91,6 +165,22 @@ int center_of_mass_init(struct aylp_device *self)
 				data->thread_count = 1;
 			}
 			log_trace("thread_count = %zu", data->thread_count);
+		} else if (!strcmp(key, "tasks_per_thread")) {
+			if (json_object_is_type(val, json_type_string)
+				&& !strcmp(json_object_get_string(val), "auto")
+			) {
+				data->tasks_per_thread = 0;
+				log_trace("tasks_per_thread = auto");
+				continue;
+			}
+			data->tasks_per_thread = json_object_get_uint64(val);
+			if (data->tasks_per_thread == 0) {
+				log_error("Correcting 0 tasks_per_thread to 1");
+				data->tasks_per_thread = 1;
+			}
+			log_trace("tasks_per_thread = %zu",
+				data->tasks_per_thread
+			);
 		} else {
 			log_warn("Unknown parameter \"%s\"", key);
 		}
@@ -101,22 +191,66 @@ int center_of_mass_init(struct aylp_device *self)
 		);
 		return -1;
 	}
-
-	if (data->thread_count > 1) {
-		// start threads
-		data->threads = xmalloc(data->thread_count * sizeof(pthread_t));
-		for (size_t t = 0; t < data->thread_count; t++) {
-			err = pthread_create(&data->threads[t],
-				0, task_runner, &data->queue
-			);
-			if (err) {
-				log_error("Couldn't create pthread: %s",
-					strerror(err)
-				);
-				return -1;
-			}
+	size_t pixel_size = 1;
+	size_t max_pixel = UINT8_MAX;
+	if (data->type == AYLP_T_MATRIX_USHORT) {
+		pixel_size = 2;
+		max_pixel = UINT16_MAX;
+	}
+	if (threshold > max_pixel) {
+		log_error("Threshold must be at most %zu", max_pixel);
+		return -1;
+	}
+	data->threshold = threshold;
+	if (dark_filename && pixel_size == 2) {
+		if (load_matrix_ushort_from_file(&data->dark_ushort,
+			dark_filename
+		)) return -1;
+		data->dark_data = (const char *)data->dark_ushort->data;
+	} else if (dark_filename) {
+		if (load_matrix_uchar_from_file(&data->dark, dark_filename))
+			return -1;
+		data->dark_data = (const char *)data->dark->data;
+	}
+	if (data->valid_mask) {
+		pack_subaps(data);
+		if (!data->subap_count) {
+			log_error("valid_mask has no valid subapertures");
+			return -1;
 		}
-		log_info("Started %zu threads", data->thread_count);
+	}
+	if (data->mode == COM_COG && (dark_filename || data->threshold)) {
+		log_warn("Dark frame and threshold are ignored in cog mode");
+	}
+	if (data->mode != COM_WCOG && data->fwhm) {
+		log_warn("fwhm is ignored outside wcog mode");
+	}
+	if (data->mode == COM_WCOG) {
+		if (!data->fwhm) data->fwhm = data->region_width;
+		data->weights = gaussian_weights(
+			data->region_height, data->region_width, data->fwhm
+		);
+	}
+	data->region = (struct com_region){
+		.height = data->region_height,
+		.width = data->region_width,
+		.pixel_size = pixel_size,
+		.dark_tda = data->dark ? data->dark->tda
+			: data->dark_ushort ? data->dark_ushort->tda : 0,
+		.threshold = data->threshold,
+		.weights = data->weights,
+	};
+	const char *kernel_name;
+	data->kernel = com_kernel_select(
+		&data->region, data->mode, &kernel_name
+	);
+	log_debug("Using %s kernel", kernel_name);
+
+	if (pool_for_device(self, data->thread_count, &data->pool,
+		&data->own_pool
+	)) return -1;
+	self->shape = &center_of_mass_shape;
+	if (data->pool) {
 		self->proc = &center_of_mass_proc_threaded;
 		self->fini = &center_of_mass_fini_threaded;
 	} else {
@@ -126,7 +260,7 @@ int center_of_mass_init(struct aylp_device *self)
 	}
 
 	// set types and units
-	self->type_in = AYLP_T_MATRIX_UCHAR;
+	self->type_in = data->type;
 	self->units_in = AYLP_U_ANY;
 	self->type_out = AYLP_T_VECTOR;
 	self->units_out = AYLP_U_MINMAX;
@@ -134,147 +268,238 @@ int center_of_mass_init(struct aylp_device *self)
 }
 
 
-int center_of_mass_proc(struct aylp_device *self, struct aylp_state *state)
+// Find the center of mass of every subaperture in rows start to end-1 of
+// subapertures. This is also the parallel_for body, so that each task works
+// through a band of the image from top to bottom.
+static void com_bands(void *ctx, size_t start, size_t end)
 {
-	struct aylp_center_of_mass_data *data = self->device_data;
-	size_t max_y = state->matrix_uchar->size1;
-	size_t max_x = state->matrix_uchar->size2;
+	struct aylp_center_of_mass_data *data = ctx;
+	size_t ps = data->region.pixel_size;
+	size_t tda = data->src_tda;
+	size_t dark_tda = data->region.dark_tda;
+	size_t n = start * data->x_subap_count;
+	for (size_t i = start; i < end; i++) {
+		size_t y = i * data->region_height;
+		const char *row = data->src + y*tda*ps;
+		const char *dark_row = data->dark_data + y*dark_tda*ps;
+		for (size_t j = 0; j < data->x_subap_count; j++) {
+			size_t x = j * data->region_width;
+			data->kernel(&data->region, row + x*ps, tda,
+				dark_row + x*ps, data->com->data + 2*n
+			);
+			n += 1;
+		}
+	}
+}
+
+
+// Like com_bands, but for subapertures start to end-1 of the valid list.
+static void com_list(void *ctx, size_t start, size_t end)
+{
+	struct aylp_center_of_mass_data *data = ctx;
+	size_t ps = data->region.pixel_size;
+	size_t tda = data->src_tda;
+	size_t dark_tda = data->region.dark_tda;
+	for (size_t n = start; n < end; n++) {
+		const struct com_subap *sa = &data->subaps[n];
+		data->kernel(&data->region,
+			data->src + (sa->y*tda + sa->x)*ps, tda,
+			data->dark_data + (sa->y*dark_tda + sa->x)*ps,
+			data->com->data + 2*n
+		);
+	}
+}
+
+
+// Check an image of max_y by max_x pixels against the regions, dark frame and
+// valid mask, and allocate for it. Returns the number of rows of subapertures
+// (or of valid subapertures, if there is a valid mask) to hand to com_bands or
+// com_list, or 0 on error.
+static size_t setup(struct aylp_center_of_mass_data *data,
+	size_t max_y, size_t max_x
+){
+	// gsl_matrix_uchar and gsl_matrix_ushort only differ in their pointer
+	// types, but let's not rely on that
+	size_t dark_y = 0, dark_x = 0;
+	if (data->type == AYLP_T_MATRIX_USHORT && data->dark_ushort) {
+		dark_y = data->dark_ushort->size1;
+		dark_x = data->dark_ushort->size2;
+	} else if (data->type == AYLP_T_MATRIX_UCHAR && data->dark) {
+		dark_y = data->dark->size1;
+		dark_x = data->dark->size2;
+	}
 	size_t y_subap_count = max_y / data->region_height;
 	size_t x_subap_count = max_x / data->region_width;
 	size_t subap_count = y_subap_count * x_subap_count;
-	if (UNLIKELY(!subap_count)) {
+	if (!subap_count) {
 		log_error("Refusing to process zero subapertures; "
 			"region size is %zu by %zu but image is %zu by %zu",
 			data->region_height, data->region_width, max_y, max_x
 		);
-		return -1;
+		return 0;
+	}
+	if (dark_y && (dark_y != max_y || dark_x != max_x)) {
+		log_error("Dark frame is %zu by %zu but image is %zu by %zu",
+			dark_y, dark_x, max_y, max_x
+		);
+		return 0;
 	}
-	// allocate the com vector if needed
-	if (UNLIKELY(!data->com || data->com->size < subap_count*2)) {
-		xfree_type(gsl_vector, data->com);
-		data->com = xmalloc_type(gsl_vector, subap_count*2);
+	if (!dark_y && data->no_dark_size < max_x) {
+		// subtract a row of zeroes instead (dark_tda is 0, so every
+		// row of the image reads the same row of zeroes)
+		xfree(data->no_dark);
+		data->no_dark_size = max_x;
+		data->no_dark = xcalloc(max_x, data->region.pixel_size);
+		data->dark_data = (const char *)data->no_dark;
 	}
-
-	size_t n = 0;
-	for (size_t i=0; i < y_subap_count; i++) {
-		for (size_t j=0; j < x_subap_count; j++) {
-			double y = 0.0, x = 0.0, s = 0.0;
-			// inlined version of com_mat_uchar basically
-			for (size_t l=0; l < data->region_height; l++) {
-				for (size_t m=0; m < data->region_width; m++) {
-					unsigned char el;
-					el = state->matrix_uchar->data[
-						(i*data->region_height + l)
-						* state->matrix_uchar->tda
-						+ j*data->region_width + m
-					];
-					y += l*el;
-					x += m*el;
-					s += el;
-				}
-			}
-			data->com->data[2*n] = -1.0
-				+ 2*y/(s*(data->region_height-1));
-			data->com->data[2*n+1] = -1.0
-				+ 2*x/(s*(data->region_width-1));
-			n += 1;
+	if (data->valid_mask) {
+		if (data->valid_mask->size1 != y_subap_count
+		|| data->valid_mask->size2 != x_subap_count) {
+			log_error("valid_mask is %zu by %zu but image has "
+				"%zu by %zu subapertures",
+				data->valid_mask->size1,
+				data->valid_mask->size2,
+				y_subap_count, x_subap_count
+			);
+			return 0;
 		}
+		subap_count = data->subap_count;
+	}
+	if (!data->com || data->com->size != subap_count*2) {
+		xfree_aligned_type(gsl_vector, data->com);
+		data->com = xmalloc_aligned_type(gsl_vector, subap_count*2);
+	}
+	data->x_subap_count = x_subap_count;
+	data->image_y = max_y;
+	data->image_x = max_x;
+	data->n_rows = data->valid_mask ? subap_count : y_subap_count;
+	return data->n_rows;
+}
+
+
+// Point the workers at the input, setting up again if its size changed.
+// Returns the number of rows of subapertures to process, or 0 on error.
+static size_t prepare(struct aylp_center_of_mass_data *data,
+	struct aylp_state *state
+){
+	size_t max_y, max_x;
+	if (data->type == AYLP_T_MATRIX_USHORT) {
+		max_y = state->matrix_ushort->size1;
+		max_x = state->matrix_ushort->size2;
+		data->src = (const char *)state->matrix_ushort->data;
+		data->src_tda = state->matrix_ushort->tda;
+	} else {
+		max_y = state->matrix_uchar->size1;
+		max_x = state->matrix_uchar->size2;
+		data->src = (const char *)state->matrix_uchar->data;
+		data->src_tda = state->matrix_uchar->tda;
 	}
+	if (UNLIKELY(max_y != data->image_y || max_x != data->image_x))
+		return setup(data, max_y, max_x);
+	return data->n_rows;
+}
+
+
+int center_of_mass_shape(struct aylp_device *self, struct aylp_shape *shape)
+{
+	struct aylp_center_of_mass_data *data = self->device_data;
+	if (!shape->y) return 0;
+	if (!setup(data, shape->y, shape->x)) return -1;
+	shape->y = data->com->size;
+	shape->x = 1;
+	return 0;
+}
+
 
-	// zero-copy update of pipeline state
+// zero-copy update of pipeline state
+static void finish(struct aylp_device *self, struct aylp_state *state)
+{
+	struct aylp_center_of_mass_data *data = self->device_data;
 	state->vector = data->com;
 	// housekeeping on the header
 	state->header.type = self->type_out;
 	state->header.units = self->units_out;
 	state->header.log_dim.y = data->com->size;
 	state->header.log_dim.x = 1;
+}
+
+
+int center_of_mass_proc(struct aylp_device *self, struct aylp_state *state)
+{
+	struct aylp_center_of_mass_data *data = self->device_data;
+	size_t n = prepare(data, state);
+	if (UNLIKELY(!n)) return -1;
+	if (data->valid_mask) com_list(data, 0, n);
+	else com_bands(data, 0, n);
+	finish(self, state);
 	return 0;
 }
 
 
 int center_of_mass_fini(struct aylp_device *self)
 {
+	struct aylp_center_of_mass_data *data = self->device_data;
+	xfree_aligned_type(gsl_vector, data->com);
+	xfree_type(gsl_matrix_uchar, data->dark);
+	xfree_type(gsl_matrix_ushort, data->dark_ushort);
+	xfree(data->no_dark);
+	xfree(data->weights);
+	xfree_type(gsl_matrix_uchar, data->valid_mask);
+	xfree(data->subaps);
 	xfree(self->device_data);
 	return 0;
 }
 
 
+// add the time taken for one frame to the current autotuning step, and settle
+// on the fastest tasks_per_thread once all the steps are done
+static void tune_record(struct aylp_center_of_mass_data *data, double t)
+{
+	data->tune_time[data->tune_step] += t;
+	if (++data->tune_frames < COM_TUNE_FRAMES) return;
+	data->tune_frames = 0;
+	if (++data->tune_step < COM_TUNE_STEPS) return;
+	size_t best = 0;
+	for (size_t s = 1; s < COM_TUNE_STEPS; s++) {
+		if (data->tune_time[s] < data->tune_time[best]) best = s;
+	}
+	data->tasks_per_thread = 1 << best;
+	log_info("Autotuned tasks_per_thread to %zu (%G us per frame)",
+		data->tasks_per_thread,
+		data->tune_time[best] / COM_TUNE_FRAMES * 1E6
+	);
+}
+
+
 int center_of_mass_proc_threaded(
 	struct aylp_device *self, struct aylp_state *state
 )
 {
 	struct aylp_center_of_mass_data *data = self->device_data;
-	size_t max_y = state->matrix_uchar->size1;
-	size_t max_x = state->matrix_uchar->size2;
-	size_t y_subap_count = max_y / data->region_height;
-	size_t x_subap_count = max_x / data->region_width;
-	// TODO: we assume one task per subaperture, but this might not be ideal
-	// for all subaperture counts and sizes. It may be that the overhead
-	// associated with processing one task can be comparable to the cost of
-	// calculating on one subaperture, and we should be creating tasks that
-	// process more than one subaperture at a time.
-	size_t n_tasks = y_subap_count * x_subap_count;
-	if (!n_tasks) {
-		log_error("Refusing to process zero subapertures; "
-			"region size is %zu by %zu but image is %zu by %zu",
-			data->region_height, data->region_width, max_y, max_x
+	size_t n = prepare(data, state);
+	if (UNLIKELY(!n)) return -1;
+
+	// split the image into a few bands of subapertures per thread (or the
+	// valid list into runs), which balances the cost of handing out bands
+	// against uneven finishing times
+	bool tuning = !data->tasks_per_thread;
+	size_t tasks_per_thread = tuning ?
+		(size_t)1 << data->tune_step : data->tasks_per_thread;
+	size_t n_bands = tasks_per_thread * (data->pool->n_threads + 1);
+	size_t chunk = (n + n_bands - 1) / n_bands;
+	struct timespec start, end;
+	if (UNLIKELY(tuning)) clock_gettime(CLOCK_MONOTONIC, &start);
+	aylp_parallel_for(data->pool, n, chunk,
+		data->valid_mask ? com_list : com_bands, data
+	);
+	if (UNLIKELY(tuning)) {
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		tune_record(data, (end.tv_sec - start.tv_sec)
+			+ (end.tv_nsec - start.tv_nsec) * 1E-9
 		);
-		return -1;
-	}
-	// It's unfortunately quite ugly that we malloc here, but it's the
-	// simplest fast solution I can think of to the issue of not knowing the
-	// size of state->matrix_uchar when init() is run. Remember that `data`
-	// is `calloc`ed so we are guaranteed to malloc on first proc.
-	if (data->n_tasks < n_tasks) {
-		// we *could* realloc instead of this free/malloc combo, but I
-		// expect free/malloc to be faster since we don't care about
-		// keeping the old memory (https://stackoverflow.com/a/39562813)
-		xfree(data->tasks);
-		data->tasks = xmalloc(n_tasks * sizeof(struct aylp_task));
-		data->n_tasks = n_tasks;
-		// allocate the matrices we use for sources too
-		data->subaps = xmalloc(n_tasks * sizeof(gsl_matrix_uchar));
-	}
-	// allocate the com vector if needed
-	if (!data->com || data->com->size < n_tasks*2) {
-		xfree_type(gsl_vector, data->com);
-		data->com = xmalloc_type(gsl_vector, n_tasks*2);
 	}
 
-	// start assigning tasks
-	size_t t = 0;
-	for (size_t i=0; i < y_subap_count; i++) {
-		for (size_t j=0; j < x_subap_count; j++) {
-			// set source data
-			data->subaps[t] = gsl_matrix_uchar_submatrix(
-				state->matrix_uchar,
-				i * data->region_height,
-				j * data->region_width,
-				data->region_height,
-				data->region_width
-			).matrix;
-			// set task
-			data->tasks[t] = (struct aylp_task){
-				.func = (void(*)(void*,void*))com_mat_uchar,
-				.src = &data->subaps[t],
-				.dst = (void *)(data->com->data+2*t),
-				.next_task = 0
-			};
-			task_enqueue(&data->queue, &data->tasks[t]);
-			t += 1;
-		}
-	}
-	// wait for threads to finish
-	while (data->queue.tasks_processing) {
-		sched_yield();	// (is there a better function to call?)
-	}
-	// zero-copy update of pipeline state
-	state->vector = data->com;
-	// housekeeping on the header
-	state->header.type = self->type_out;
-	state->header.units = self->units_out;
-	state->header.log_dim.y = data->com->size;
-	state->header.log_dim.x = 1;
+	finish(self, state);
 	return 0;
 }
 
@@ -282,13 +507,7 @@ int center_of_mass_proc_threaded(
 int center_of_mass_fini_threaded(struct aylp_device *self)
 {
 	struct aylp_center_of_mass_data *data = self->device_data;
-	shut_queue(&data->queue);
-	for (size_t t = 0; t < data->thread_count; t++) {
-		pthread_join(data->threads[t], 0);
-	}
-	xfree(data->threads);
-	xfree(data->tasks);
-	xfree(self->device_data);
-	return 0;
+	pool_release(&data->own_pool);
+	return center_of_mass_fini(self);
 }
 
@@ -3,24 +3,75 @@
 
 #include "anyloop.h"
 #include "thread_pool.h"
+#include "com_kernels.h"
+
+// tasks_per_thread values tried when autotuning (1, 2, 4, ... 16)
+#define COM_TUNE_STEPS 5
+// frames timed for each of them
+#define COM_TUNE_FRAMES 64
+
+// top-left pixel of a valid subaperture
+struct com_subap {
+	size_t y;
+	size_t x;
+};
 
 struct aylp_center_of_mass_data {
 	// param: height of regions/subapertures
 	size_t region_height;
 	// param: width of regions/subapertures
 	size_t region_width;
-	// param; set to 1 for no multithreading
+	// param: AYLP_T_MATRIX_UCHAR or AYLP_T_MATRIX_USHORT input
+	aylp_type type;
+	// param: how pixels are preprocessed before finding the centroid
+	enum com_mode mode;
+	// param: dark frame to subtract (tcog and wcog), of the input type, or
+	// null for none
+	gsl_matrix_uchar *dark;
+	gsl_matrix_ushort *dark_ushort;
+	// param: subtracted from each pixel after the dark frame
+	uint16_t threshold;
+	// param: full width at half maximum of the wcog weights, in pixels
+	double fwhm;
+	// a row of zeroes, standing in for the dark frame if there is none
+	unsigned char *no_dark;
+	size_t no_dark_size;
+	// pixels of the dark frame (or no_dark), whichever the type
+	const char *dark_data;
+	// region_height*region_width wcog weights
+	int16_t *weights;
+	// region shape and preprocessing, for the kernel
+	struct com_region region;
+	// param: which subapertures to process (nonzero means valid), or null
+	// for all of them
+	gsl_matrix_uchar *valid_mask;
+	// packed list of the valid subapertures, in output order
+	struct com_subap *subaps;
+	size_t subap_count;
+	// param; set above 1 for a private pool instead of the shared one
 	size_t thread_count;
-	// array of threads
-	pthread_t *threads;
-	// array of tasks
-	struct aylp_task *tasks;
-	// number of tasks
-	size_t n_tasks;
-	// array of gsl_matrix_uchar inputs for the tasks
-	gsl_matrix_uchar *subaps;
-	// queue of tasks
-	struct aylp_queue queue;
+	// pool we hand work to (the shared one, or own_pool)
+	struct aylp_pool *pool;
+	// pool of thread_count-1 workers, if thread_count > 1
+	struct aylp_pool *own_pool;
+	// param: row bands of subapertures per thread, or 0 to autotune
+	size_t tasks_per_thread;
+	// autotuning progress, and time taken by each step in total
+	size_t tune_step;
+	size_t tune_frames;
+	double tune_time[COM_TUNE_STEPS];
+	// input image for the current proc, for the workers to read, and the
+	// distance between its rows in pixels
+	const char *src;
+	size_t src_tda;
+	// size of the image we last set up for, the number of subapertures per
+	// row of it, and the number of rows (or valid subapertures) to process
+	size_t image_y;
+	size_t image_x;
+	size_t x_subap_count;
+	size_t n_rows;
+	// per-region kernel, picked for this CPU
+	com_kernel kernel;
 
 	// center of mass result (contiguous vector)
 	gsl_vector *com;
@@ -29,6 +80,9 @@ struct aylp_center_of_mass_data {
 // initialize center_of_mass device
 int center_of_mass_init(struct aylp_device *self);
 
+// set up for the shape of center_of_mass input, and declare its output
+int center_of_mass_shape(struct aylp_device *self, struct aylp_shape *shape);
+
 // process center_of_mass device once per loop
 int center_of_mass_proc(struct aylp_device *self, struct aylp_state *state);
 // multithreaded version of proc function
@@ -10,6 +10,7 @@ int clamp_init(struct aylp_device *self)
 	self->device_data = xcalloc(1, sizeof(struct aylp_clamp_data));
 	struct aylp_clamp_data *data = self->device_data;
 
+	self->shape = &clamp_shape;
 	self->fini = &clamp_fini;
 
 	// default to ±1
@@ -27,7 +28,7 @@ int clamp_init(struct aylp_device *self)
 		} else if (!strcmp(key, "type")) {
 			const char *s = json_object_get_string(val);
 			self->type_in = aylp_type_from_string(s);
-			log_trace("type = %s (0x%hhX)", s, self->type_in);
+			log_trace("type = %s (0x%hX)", s, self->type_in);
 		} else if (!strcmp(key, "min")) {
 			data->min = json_object_get_double(val);
 			log_trace("min = %d", data->min);
@@ -42,6 +43,11 @@ int clamp_init(struct aylp_device *self)
 		log_error("You must provide the type parameter.");
 		return -1;
 	}
+	// in batch mode, vectors come in as the columns of a matrix
+	if (self->batch > 1 && self->type_in == AYLP_T_VECTOR)
+		self->type_in = AYLP_T_MATRIX;
+	else if (self->batch > 1 && self->type_in == AYLP_T_VECTOR_FLOAT)
+		self->type_in = AYLP_T_MATRIX_FLOAT;
 
 	switch (self->type_in) {
 	// type-specific setup
@@ -51,13 +57,62 @@ int clamp_init(struct aylp_device *self)
 		break;
 	FOR_AYLP_CLAMP_TYPES(INIT_CASE_TYPE)
 	default:
-		log_error("Invalid input type %hhx", self->type_in);
+		log_error("Invalid input type %hx", self->type_in);
 		return -1;
 	}
 
 	self->units_in = AYLP_U_ANY;
 	self->type_out = AYLP_T_UNCHANGED;
 	self->units_out = AYLP_U_UNCHANGED;
+	self->scratch_out = true;
+	return 0;
+}
+
+
+int clamp_shape(struct aylp_device *self, struct aylp_shape *shape)
+{
+	struct aylp_clamp_data *data = self->device_data;
+	size_t y = shape->y, x = shape->x;
+	// we won't know where to put the result until the first proc
+	if (!y) return 0;
+	// allocate it now, in case the input turns out not to be ours to
+	// overwrite
+	switch (self->type_in) {
+	case AYLP_T_BLOCK:
+		data->block = xmalloc_aligned_type(gsl_block, y * x);
+		break;
+	case AYLP_T_VECTOR:
+		data->vector = xmalloc_aligned_type(gsl_vector, y * x);
+		break;
+	case AYLP_T_MATRIX:
+		data->matrix = xmalloc_aligned_type(gsl_matrix, y, x);
+		break;
+	case AYLP_T_BLOCK_UCHAR:
+		data->block_uchar = xmalloc_aligned_type(gsl_block_uchar,
+			y * x
+		);
+		break;
+	case AYLP_T_MATRIX_UCHAR:
+		data->matrix_uchar = xmalloc_aligned_type(gsl_matrix_uchar,
+			y, x
+		);
+		break;
+	case AYLP_T_MATRIX_USHORT:
+		data->matrix_ushort = xmalloc_aligned_type(gsl_matrix_ushort,
+			y, x
+		);
+		break;
+	case AYLP_T_VECTOR_FLOAT:
+		data->vector_float = xmalloc_aligned_type(gsl_vector_float,
+			y * x
+		);
+		break;
+	case AYLP_T_MATRIX_FLOAT:
+		data->matrix_float = xmalloc_aligned_type(gsl_matrix_float,
+			y, x
+		);
+		break;
+	}
 	return 0;
 }
 
@@ -65,44 +120,62 @@ int clamp_init(struct aylp_device *self)
 int clamp_proc_block(struct aylp_device *self, struct aylp_state *state)
 {
 	struct aylp_clamp_data *data = self->device_data;
-	if (UNLIKELY(!data->block)) {
-		// we have nowhere to put the result; let's allocate it
-		data->block = gsl_block_alloc(state->block->size);
-	} else if (UNLIKELY(data->block->size != state->block->size)) {
-		// somehow the state block changed size >:(
-		xfree_type(gsl_block, data->block);
-		data->block = gsl_block_alloc(state->block->size);
+	gsl_block *src = state->block;
+	gsl_block *dst = src;
+	if (!(state->header.status & AYLP_MUTABLE)) {
+		if (UNLIKELY(!data->block)) {
+			// we have nowhere to put the result; let's allocate it
+			data->block = xmalloc_aligned_type(gsl_block,
+				src->size
+			);
+		} else if (UNLIKELY(data->block->size != src->size)) {
+			// somehow the state block changed size >:(
+			xfree_aligned_type(gsl_block, data->block);
+			data->block = xmalloc_aligned_type(gsl_block,
+				src->size
+			);
+		}
+		dst = data->block;
 	}
 
-	for (size_t i = 0; i < data->block->size; i++) {
-		double x = state->block->data[i];
+	for (size_t i = 0; i < src->size; i++) {
+		double x = src->data[i];
 		if (x < data->min) x = data->min;
 		else if (data->max < x) x = data->max;
-		data->block->data[i] = x;
+		dst->data[i] = x;
 	}
 
-	state->block = data->block;
+	state->block = dst;
 	return 0;
 }
 
 int clamp_proc_vector(struct aylp_device *self, struct aylp_state *state)
 {
 	struct aylp_clamp_data *data = self->device_data;
-	if (UNLIKELY(!data->vector)) {
-		data->vector = gsl_vector_alloc(state->vector->size);
-	} else if (UNLIKELY(data->vector->size != state->vector->size)) {
-		xfree_type(gsl_vector, data->vector);
-		data->vector = gsl_vector_alloc(state->vector->size);
+	gsl_vector *src = state->vector;
+	gsl_vector *dst = src;
+	if (!(state->header.status & AYLP_MUTABLE)) {
+		if (UNLIKELY(!data->vector)) {
+			data->vector = xmalloc_aligned_type(gsl_vector,
+				src->size
+			);
+		} else if (UNLIKELY(data->vector->size != src->size)) {
+			xfree_aligned_type(gsl_vector, data->vector);
+			data->vector = xmalloc_aligned_type(gsl_vector,
+				src->size
+			);
+		}
+		dst = data->vector;
 	}
 
-	for (size_t i = 0; i < data->vector->size; i++) {
-		double x = state->vector->data[i * state->vector->stride];
+	for (size_t i = 0; i < src->size; i++) {
+		double x = src->data[i * src->stride];
 		if (x < data->min) x = data->min;
 		else if (data->max < x) x = data->max;
-		data->vector->data[i * data->vector->stride] = x;
+		dst->data[i * dst->stride] = x;
 	}
 
-	state->vector = data->vector;
+	state->vector = dst;
 	return 0;
 }
 
@@ -110,14 +183,21 @@ int clamp_proc_matrix(struct aylp_device *self, struct aylp_state *state)
 {
 	struct aylp_clamp_data *data = self->device_data;
 	gsl_matrix *src = state->matrix;
-	if (UNLIKELY(!data->matrix)) {
-		data->matrix = gsl_matrix_alloc(src->size1, src->size2);
-	} else if (UNLIKELY(data->matrix->size1 != src->size1
-	|| data->matrix->size2 != src->size2)) {
-		xfree_type(gsl_matrix, data->matrix);
-		data->matrix = gsl_matrix_alloc(src->size1, src->size2);
+	gsl_matrix *dst = src;
+	if (!(state->header.status & AYLP_MUTABLE)) {
+		if (UNLIKELY(!data->matrix)) {
+			data->matrix = xmalloc_aligned_type(gsl_matrix,
+				src->size1, src->size2
+			);
+		} else if (UNLIKELY(data->matrix->size1 != src->size1
+		|| data->matrix->size2 != src->size2)) {
+			xfree_aligned_type(gsl_matrix, data->matrix);
+			data->matrix = xmalloc_aligned_type(gsl_matrix,
+				src->size1, src->size2
+			);
+		}
+		dst = data->matrix;
 	}
-	gsl_matrix *dst = data->matrix;
 
 	for (size_t i = 0; i < src->size1; i++) {
 		for (size_t j = 0; j < src->size2; j++) {
@@ -128,7 +208,7 @@ int clamp_proc_matrix(struct aylp_device *self, struct aylp_state *state)
 		}
 	}
 
-	state->matrix = data->matrix;
+	state->matrix = dst;
 	return 0;
 }
 
@@ -136,29 +216,35 @@ int clamp_proc_block_uchar(
 	struct aylp_device *self, struct aylp_state *state
 ){
 	struct aylp_clamp_data *data = self->device_data;
-	gsl_block_uchar *src = data->block_uchar;
-	if (UNLIKELY(!data->block_uchar)) {
-		// we have nowhere to put the result; let's allocate it
-		data->block_uchar = gsl_block_uchar_alloc(src->size);
-	} else if (UNLIKELY(data->block_uchar->size != src->size)) {
-		// somehow the state block_uchar changed size >:(
-		xfree_type(gsl_block_uchar, data->block_uchar);
-		data->block_uchar = gsl_block_uchar_alloc(
-			state->block_uchar->size
-		);
+	gsl_block_uchar *src = state->block_uchar;
+	gsl_block_uchar *dst = src;
+	if (!(state->header.status & AYLP_MUTABLE)) {
+		if (UNLIKELY(!data->block_uchar)) {
+			// we have nowhere to put the result; let's allocate it
+			data->block_uchar = xmalloc_aligned_type(
+				gsl_block_uchar, src->size
+			);
+		} else if (UNLIKELY(data->block_uchar->size != src->size)) {
+			// somehow the state block_uchar changed size >:(
+			xfree_aligned_type(gsl_block_uchar, data->block_uchar);
+			data->block_uchar = xmalloc_aligned_type(
+				gsl_block_uchar, src->size
+			);
+		}
+		dst = data->block_uchar;
 	}
 
 	unsigned char min = data->min;
 	unsigned char max = data->max;
 
-	for (size_t i = 0; i < data->block_uchar->size; i++) {
+	for (size_t i = 0; i < src->size; i++) {
 		unsigned char x = src->data[i];
 		if (x < min) x = min;
 		else if (max < x) x = max;
-		data->block_uchar->data[i] = x;
+		dst->data[i] = x;
 	}
 
-	state->block_uchar = data->block_uchar;
+	state->block_uchar = dst;
 	return 0;
 }
 
@@ -167,18 +253,25 @@ int clamp_proc_matrix_uchar(
 ){
 	struct aylp_clamp_data *data = self->device_data;
 	gsl_matrix_uchar *src = state->matrix_uchar;
-	if (UNLIKELY(!data->matrix_uchar)) {
-		data->matrix_uchar = gsl_matrix_uchar_alloc(
-			src->size1, src->size2
-		);
-	} else if (UNLIKELY(data->matrix_uchar->size1 != src->size1
-	|| data->matrix_uchar->size2 != src->size2)) {
-		xfree_type(gsl_matrix_uchar, data->matrix_uchar);
-		data->matrix_uchar = gsl_matrix_uchar_alloc(
-			src->size1, src->size2
-		);
+	gsl_matrix_uchar *dst = src;
+	if (!(state->header.status & AYLP_MUTABLE)) {
+		if (UNLIKELY(!data->matrix_uchar)) {
+			data->matrix_uchar = xmalloc_aligned_type(
+				gsl_matrix_uchar, src->size1, src->size2
+			);
+		} else if (UNLIKELY(
+			data->matrix_uchar->size1 != src->size1
+			|| data->matrix_uchar->size2 != src->size2
+		)) {
+			xfree_aligned_type(gsl_matrix_uchar,
+				data->matrix_uchar
+			);
+			data->matrix_uchar = xmalloc_aligned_type(
+				gsl_matrix_uchar, src->size1, src->size2
+			);
+		}
+		dst = data->matrix_uchar;
 	}
-	gsl_matrix_uchar *dst = data->matrix_uchar;
 
 	for (size_t i = 0; i < src->size1; i++) {
 		for (size_t j = 0; j < src->size2; j++) {
@@ -189,16 +282,129 @@ int clamp_proc_matrix_uchar(
 		}
 	}
 
-	state->matrix_uchar = data->matrix_uchar;
+	state->matrix_uchar = dst;
+	return 0;
+}
+
+int clamp_proc_matrix_ushort(
+	struct aylp_device *self, struct aylp_state *state
+){
+	struct aylp_clamp_data *data = self->device_data;
+	gsl_matrix_ushort *src = state->matrix_ushort;
+	gsl_matrix_ushort *dst = src;
+	if (!(state->header.status & AYLP_MUTABLE)) {
+		if (UNLIKELY(!data->matrix_ushort)) {
+			data->matrix_ushort = xmalloc_aligned_type(
+				gsl_matrix_ushort, src->size1, src->size2
+			);
+		} else if (UNLIKELY(
+			data->matrix_ushort->size1 != src->size1
+			|| data->matrix_ushort->size2 != src->size2
+		)) {
+			xfree_aligned_type(gsl_matrix_ushort,
+				data->matrix_ushort
+			);
+			data->matrix_ushort = xmalloc_aligned_type(
+				gsl_matrix_ushort, src->size1, src->size2
+			);
+		}
+		dst = data->matrix_ushort;
+	}
+
+	for (size_t i = 0; i < src->size1; i++) {
+		for (size_t j = 0; j < src->size2; j++) {
+			unsigned short x = src->data[i * src->tda + j];
+			if (x < data->min) x = data->min;
+			else if (data->max < x) x = data->max;
+			dst->data[i * dst->tda + j] = x;
+		}
+	}
+
+	state->matrix_ushort = dst;
 	return 0;
 }
 
 
+int clamp_proc_vector_float(
+	struct aylp_device *self, struct aylp_state *state
+){
+	struct aylp_clamp_data *data = self->device_data;
+	gsl_vector_float *src = state->vector_float;
+	gsl_vector_float *dst = src;
+	if (!(state->header.status & AYLP_MUTABLE)) {
+		if (UNLIKELY(!data->vector_float)) {
+			data->vector_float = xmalloc_aligned_type(
+				gsl_vector_float, src->size
+			);
+		} else if (UNLIKELY(data->vector_float->size != src->size)) {
+			xfree_aligned_type(gsl_vector_float,
+				data->vector_float
+			);
+			data->vector_float = xmalloc_aligned_type(
+				gsl_vector_float, src->size
+			);
+		}
+		dst = data->vector_float;
+	}
+	float min = data->min;
+	float max = data->max;
+
+	for (size_t i = 0; i < src->size; i++) {
+		float x = src->data[i * src->stride];
+		if (x < min) x = min;
+		else if (max < x) x = max;
+		dst->data[i * dst->stride] = x;
+	}
+
+	state->vector_float = dst;
+	return 0;
+}
+
+int clamp_proc_matrix_float(
+	struct aylp_device *self, struct aylp_state *state
+){
+	struct aylp_clamp_data *data = self->device_data;
+	gsl_matrix_float *src = state->matrix_float;
+	gsl_matrix_float *dst = src;
+	if (!(state->header.status & AYLP_MUTABLE)) {
+		if (UNLIKELY(!data->matrix_float)) {
+			data->matrix_float = xmalloc_aligned_type(
+				gsl_matrix_float, src->size1, src->size2
+			);
+		} else if (UNLIKELY(
+			data->matrix_float->size1 != src->size1
+			|| data->matrix_float->size2 != src->size2
+		)) {
+			xfree_aligned_type(gsl_matrix_float,
+				data->matrix_float
+			);
+			data->matrix_float = xmalloc_aligned_type(
+				gsl_matrix_float, src->size1, src->size2
+			);
+		}
+		dst = data->matrix_float;
+	}
+	float min = data->min;
+	float max = data->max;
+
+	for (size_t i = 0; i < src->size1; i++) {
+		for (size_t j = 0; j < src->size2; j++) {
+			float x = src->data[i * src->tda + j];
+			if (x < min) x = min;
+			else if (max < x) x = max;
+			dst->data[i * dst->tda + j] = x;
+		}
+	}
+
+	state->matrix_float = dst;
+	return 0;
+}
+
 int clamp_fini(struct aylp_device *self)
 {
 	struct aylp_clamp_data *data = self->device_data;
 	#define FREE_RESULT(_, type) \
-		if (data->type) xfree_type(gsl_##type, data->type);
+		if (data->type) xfree_aligned_type(gsl_##type, data->type);
 	FOR_AYLP_CLAMP_TYPES(FREE_RESULT)
 	xfree(data);
 	return 0;
@@ -10,7 +10,10 @@
 	DO(VECTOR, vector) \
 	DO(MATRIX, matrix) \
 	DO(BLOCK_UCHAR, block_uchar) \
-	DO(MATRIX_UCHAR, matrix_uchar)
+	DO(MATRIX_UCHAR, matrix_uchar) \
+	DO(MATRIX_USHORT, matrix_ushort) \
+	DO(VECTOR_FLOAT, vector_float) \
+	DO(MATRIX_FLOAT, matrix_float)
 
 struct aylp_clamp_data {
 	// min and max values to clamp to
@@ -25,6 +28,9 @@ struct aylp_clamp_data {
 // initialize clamp device
 int clamp_init(struct aylp_device *self);
 
+// allocate for the shape of clamp input
+int clamp_shape(struct aylp_device *self, struct aylp_shape *shape);
+
 // different proc() function for each type
 #define DECLARE_PROC(_, type) int clamp_proc_##type( \
 	struct aylp_device *self, struct aylp_state *state \
@@ -0,0 +1,684 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define COM_X86 1
+#endif
+
+#include "com_kernels.h"
+
+// The SIMD kernels use 16-bit pixel indices and flush their 32-bit lanes at
+// least once per row, which is safe for regions up to this size in each
+// dimension (and smaller, for bigger pixels; see rows_per_flush). Bigger ones
+// go to the scalar kernel.
+#define SIMD_MAX_SIZE 2048
+
+
+static inline void com_finish(uint64_t s, uint64_t y, uint64_t x,
+	size_t height, size_t width, double *dst
+){
+	// a region with nothing left in it is taken to be centered, rather
+	// than giving NaNs that would stick in any integrator downstream
+	if (!s) {
+		dst[0] = 0.0;
+		dst[1] = 0.0;
+		return;
+	}
+	dst[0] = -1.0 + 2.0*y/((double)s*(height-1));
+	dst[1] = -1.0 + 2.0*x/((double)s*(width-1));
+}
+
+
+// The kernel bodies are always inlined, so that instantiating them with
+// constant sizes (see FOR_COM_SIZES) and modes lets the compiler unroll them
+// completely and drop whatever preprocessing the mode doesn't need.
+#define KERNEL_BODY static inline __attribute__((always_inline))
+
+
+// largest value a preprocessed pixel can take
+static inline size_t max_pixel(size_t psize, enum com_mode mode)
+{
+	size_t max = psize == 2 ? UINT16_MAX : UINT8_MAX;
+	return mode == COM_WCOG ? max * COM_WEIGHT_ONE : max;
+}
+
+
+// The scalar kernel accumulates each row in spans of pixels, with 32-bit sums
+// that can't overflow: max_pixel * span^2/2 < 2^32. That's 4096 pixels for
+// uchar images, down to 32 for weighted ushort ones.
+static inline size_t scalar_span(size_t psize, enum com_mode mode)
+{
+	size_t span = 4096;
+	while (max_pixel(psize, mode) * span * span / 2 > UINT32_MAX)
+		span /= 2;
+	return span;
+}
+
+
+// preprocess one pixel as for mode (the weight is only read in COM_WCOG mode)
+KERNEL_BODY uint32_t pixel(uint32_t v, uint32_t d, uint32_t t,
+	int16_t w, enum com_mode mode
+){
+	if (mode == COM_COG) return v;
+	v = v > d ? v - d : 0;
+	v = v > t ? v - t : 0;
+	if (mode == COM_WCOG) v *= w;
+	return v;
+}
+
+
+// pixel j of a row of psize-byte pixels
+KERNEL_BODY uint32_t at(const void *row, size_t j, size_t psize)
+{
+	if (psize == 2) return ((const uint16_t *)row)[j];
+	return ((const unsigned char *)row)[j];
+}
+
+
+KERNEL_BODY void com_scalar_body(const struct com_region *r,
+	const void *src, size_t tda, const void *dark, double *dst,
+	size_t height, size_t width, enum com_mode mode, size_t psize
+){
+	size_t span = scalar_span(psize, mode);
+	uint64_t s = 0, y = 0, x = 0;
+	for (size_t i = 0; i < height; i++) {
+		const char *row = (const char *)src + i*tda*psize;
+		const char *drow = mode == COM_COG ?
+			row : (const char *)dark + i*r->dark_tda*psize;
+		const int16_t *wrow = mode == COM_WCOG ?
+			r->weights + i*width : 0;
+		for (size_t j0 = 0; j0 < width; j0 += span) {
+			size_t n = width - j0 < span ? width - j0 : span;
+			uint32_t rs = 0, rx = 0;
+			for (uint32_t j = 0; j < n; j++) {
+				uint32_t v = pixel(at(row, j0+j, psize),
+					at(drow, j0+j, psize), r->threshold,
+					wrow ? wrow[j0+j] : 0, mode
+				);
+				rs += v;
+				rx += j * v;
+			}
+			s += rs;
+			y += i * rs;
+			x += j0 * rs + rx;
+		}
+	}
+	com_finish(s, y, x, height, width, dst);
+}
+
+
+#ifdef COM_X86
+
+// How many rows we can accumulate in 32-bit lanes before the sum of the lanes
+// might overflow, or 0 if even one row might. Each pixel adds at most
+// max_pixel*max(height,width) to a moment. (Lanes themselves may wrap past
+// 2^31, but that's fine, since the sum is taken mod 2^32 as well.)
+static inline size_t rows_per_flush(size_t height, size_t width,
+	enum com_mode mode, size_t psize
+){
+	size_t max = height > width ? height : width;
+	size_t per_row = max_pixel(psize, mode) * max * width;
+	// the usual case, where a whole region fits (saves a division)
+	if (per_row * height <= UINT32_MAX) return height;
+	return UINT32_MAX / per_row;
+}
+
+
+// add the lanes of s, y, and x to *s, *y, and *x
+__attribute__((target("sse4.1")))
+static inline void hsum3_128(__m128i vs, __m128i vy, __m128i vx,
+	uint64_t *s, uint64_t *y, uint64_t *x
+){
+	__m128i t = _mm_hadd_epi32(
+		_mm_hadd_epi32(vs, vy),
+		_mm_hadd_epi32(vx, _mm_setzero_si128())
+	);
+	uint32_t lanes[4];
+	_mm_storeu_si128((__m128i *)lanes, t);
+	*s += lanes[0];
+	*y += lanes[1];
+	*x += lanes[2];
+}
+
+
+// Load 8 pixels (or 4, leaving the top lanes zero), preprocess them as for
+// mode, and widen them to 16 bits. The dark frame and threshold are applied
+// with saturating 8-bit subtraction, before widening.
+__attribute__((target("sse4.1")))
+KERNEL_BODY __m128i load_8(const unsigned char *p, const unsigned char *d,
+	const int16_t *w, __m128i thr, enum com_mode mode, int n
+){
+	__m128i v, dv;
+	if (n == 4) {
+		uint32_t px;
+		memcpy(&px, p, 4);
+		v = _mm_cvtsi32_si128(px);
+	} else {
+		v = _mm_loadl_epi64((const __m128i *)p);
+	}
+	if (mode != COM_COG) {
+		if (n == 4) {
+			uint32_t px;
+			memcpy(&px, d, 4);
+			dv = _mm_cvtsi32_si128(px);
+		} else {
+			dv = _mm_loadl_epi64((const __m128i *)d);
+		}
+		v = _mm_subs_epu8(_mm_subs_epu8(v, dv), thr);
+	}
+	v = _mm_cvtepu8_epi16(v);
+	if (mode == COM_WCOG) {
+		v = _mm_mullo_epi16(v, n == 4 ?
+			_mm_loadl_epi64((const __m128i *)w)
+			: _mm_loadu_si128((const __m128i *)w)
+		);
+	}
+	return v;
+}
+
+
+__attribute__((target("sse4.1")))
+KERNEL_BODY void com_sse4_8_body(const struct com_region *r,
+	const void *src_, size_t tda, const void *dark_, double *dst,
+	size_t height, size_t width, enum com_mode mode
+){
+	const unsigned char *src = src_, *dark = dark_;
+	size_t flush = rows_per_flush(height, width, mode, 1);
+	if (height > SIMD_MAX_SIZE || width > SIMD_MAX_SIZE || !flush) {
+		com_scalar_body(r, src, tda, dark, dst, height, width, mode, 1);
+		return;
+	}
+	uint64_t s = 0, y = 0, x = 0;
+	const __m128i ones = _mm_set1_epi16(1);
+	const __m128i step = _mm_set1_epi16(8);
+	const __m128i idx0 = _mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7);
+	const __m128i thr = _mm_set1_epi8(r->threshold);
+	size_t rows_left = flush;
+	__m128i vs = _mm_setzero_si128();
+	__m128i vy = _mm_setzero_si128();
+	__m128i vx = _mm_setzero_si128();
+	for (size_t i = 0; i < height; i++) {
+		const unsigned char *row = src + i*tda;
+		const unsigned char *drow = mode == COM_COG ?
+			row : dark + i*r->dark_tda;
+		const int16_t *wrow = mode == COM_WCOG ?
+			r->weights + i*width : 0;
+		const __m128i vi = _mm_set1_epi16(i);
+		__m128i vj = idx0;
+		size_t j = 0;
+		for (; j + 8 <= width; j += 8) {
+			// multiply-add pairs of widened pixels
+			__m128i v = load_8(row+j, drow+j, wrow+j, thr, mode, 8);
+			vs = _mm_add_epi32(vs, _mm_madd_epi16(v, ones));
+			vy = _mm_add_epi32(vy, _mm_madd_epi16(v, vi));
+			vx = _mm_add_epi32(vx, _mm_madd_epi16(v, vj));
+			vj = _mm_add_epi16(vj, step);
+		}
+		if (j + 4 <= width) {
+			__m128i v = load_8(row+j, drow+j, wrow+j, thr, mode, 4);
+			vs = _mm_add_epi32(vs, _mm_madd_epi16(v, ones));
+			vy = _mm_add_epi32(vy, _mm_madd_epi16(v, vi));
+			vx = _mm_add_epi32(vx, _mm_madd_epi16(v, vj));
+			j += 4;
+		}
+		uint32_t rs = 0, rx = 0;
+		for (; j < width; j++) {
+			uint32_t v = pixel(row[j], drow[j], r->threshold,
+				wrow ? wrow[j] : 0, mode
+			);
+			rs += v;
+			rx += j * v;
+		}
+		s += rs;
+		y += i * rs;
+		x += rx;
+		if (!--rows_left || i+1 == height) {
+			rows_left = flush;
+			hsum3_128(vs, vy, vx, &s, &y, &x);
+			vs = vy = vx = _mm_setzero_si128();
+		}
+	}
+	com_finish(s, y, x, height, width, dst);
+}
+
+
+// fold the upper half of v onto the lower half
+__attribute__((target("avx2")))
+static inline __m128i fold_256(__m256i v)
+{
+	return _mm_add_epi32(_mm256_castsi256_si128(v),
+		_mm256_extracti128_si256(v, 1)
+	);
+}
+
+
+// like load_8, but for 16 pixels
+__attribute__((target("avx2")))
+KERNEL_BODY __m256i load_16(const unsigned char *p, const unsigned char *d,
+	const int16_t *w, __m128i thr, enum com_mode mode
+){
+	__m128i v = _mm_loadu_si128((const __m128i *)p);
+	if (mode != COM_COG) {
+		__m128i dv = _mm_loadu_si128((const __m128i *)d);
+		v = _mm_subs_epu8(_mm_subs_epu8(v, dv), thr);
+	}
+	__m256i v16 = _mm256_cvtepu8_epi16(v);
+	if (mode == COM_WCOG) {
+		v16 = _mm256_mullo_epi16(v16,
+			_mm256_loadu_si256((const __m256i *)w)
+		);
+	}
+	return v16;
+}
+
+
+__attribute__((target("avx2")))
+KERNEL_BODY void com_avx2_8_body(const struct com_region *r,
+	const void *src_, size_t tda, const void *dark_, double *dst,
+	size_t height, size_t width, enum com_mode mode
+){
+	const unsigned char *src = src_, *dark = dark_;
+	size_t flush = rows_per_flush(height, width, mode, 1);
+	if (height > SIMD_MAX_SIZE || width > SIMD_MAX_SIZE || !flush) {
+		com_scalar_body(r, src, tda, dark, dst, height, width, mode, 1);
+		return;
+	}
+	uint64_t s = 0, y = 0, x = 0;
+	const __m256i ones = _mm256_set1_epi16(1);
+	const __m256i step = _mm256_set1_epi16(16);
+	const __m256i idx0 = _mm256_setr_epi16(
+		0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15
+	);
+	const __m128i ones8 = _mm_set1_epi16(1);
+	const __m128i idx8 = _mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7);
+	const __m128i thr = _mm_set1_epi8(r->threshold);
+	size_t rows_left = flush;
+	// 16 pixels at a time in the 256-bit accumulators, then 8 and then 4
+	// at a time in the 128-bit ones (e.g. for 8-pixel-wide regions)
+	__m256i vs = _mm256_setzero_si256();
+	__m256i vy = _mm256_setzero_si256();
+	__m256i vx = _mm256_setzero_si256();
+	__m128i vs8 = _mm_setzero_si128();
+	__m128i vy8 = _mm_setzero_si128();
+	__m128i vx8 = _mm_setzero_si128();
+	for (size_t i = 0; i < height; i++) {
+		const unsigned char *row = src + i*tda;
+		const unsigned char *drow = mode == COM_COG ?
+			row : dark + i*r->dark_tda;
+		const int16_t *wrow = mode == COM_WCOG ?
+			r->weights + i*width : 0;
+		const __m256i vi = _mm256_set1_epi16(i);
+		__m256i vj = idx0;
+		size_t j = 0;
+		for (; j + 16 <= width; j += 16) {
+			__m256i v = load_16(row+j, drow+j, wrow+j, thr, mode);
+			vs = _mm256_add_epi32(vs, _mm256_madd_epi16(v, ones));
+			vy = _mm256_add_epi32(vy, _mm256_madd_epi16(v, vi));
+			vx = _mm256_add_epi32(vx, _mm256_madd_epi16(v, vj));
+			vj = _mm256_add_epi16(vj, step);
+		}
+		for (int n = 8; n >= 4; n -= 4) {
+			if (j + n > width) continue;
+			__m128i v = load_8(row+j, drow+j, wrow+j, thr, mode, n);
+			__m128i vj8 = _mm_add_epi16(idx8, _mm_set1_epi16(j));
+			vs8 = _mm_add_epi32(vs8, _mm_madd_epi16(v, ones8));
+			vy8 = _mm_add_epi32(vy8, _mm_madd_epi16(v,
+				_mm256_castsi256_si128(vi)
+			));
+			vx8 = _mm_add_epi32(vx8, _mm_madd_epi16(v, vj8));
+			j += n;
+		}
+		uint32_t rs = 0, rx = 0;
+		for (; j < width; j++) {
+			uint32_t v = pixel(row[j], drow[j], r->threshold,
+				wrow ? wrow[j] : 0, mode
+			);
+			rs += v;
+			rx += j * v;
+		}
+		s += rs;
+		y += i * rs;
+		x += rx;
+		if (!--rows_left || i+1 == height) {
+			rows_left = flush;
+			if (width >= 16) {
+				vs8 = _mm_add_epi32(vs8, fold_256(vs));
+				vy8 = _mm_add_epi32(vy8, fold_256(vy));
+				vx8 = _mm_add_epi32(vx8, fold_256(vx));
+			}
+			hsum3_128(vs8, vy8, vx8, &s, &y, &x);
+			vs = vy = vx = _mm256_setzero_si256();
+			vs8 = vy8 = vx8 = _mm_setzero_si128();
+		}
+	}
+	com_finish(s, y, x, height, width, dst);
+}
+
+// Load 4 ushort pixels, preprocess them as for mode (with saturating 16-bit
+// subtraction), and widen them to 32 bits.
+__attribute__((target("sse4.1")))
+KERNEL_BODY __m128i load_4_u16(const uint16_t *p, const uint16_t *d,
+	const int16_t *w, __m128i thr, enum com_mode mode
+){
+	__m128i v = _mm_loadl_epi64((const __m128i *)p);
+	if (mode != COM_COG) {
+		__m128i dv = _mm_loadl_epi64((const __m128i *)d);
+		v = _mm_subs_epu16(_mm_subs_epu16(v, dv), thr);
+	}
+	v = _mm_cvtepu16_epi32(v);
+	if (mode == COM_WCOG) {
+		v = _mm_mullo_epi32(v, _mm_cvtepi16_epi32(
+			_mm_loadl_epi64((const __m128i *)w)
+		));
+	}
+	return v;
+}
+
+
+// Ushort pixels don't fit the signed 16-bit inputs of pmaddwd, so the 16-bit
+// kernels widen them to 32 bits instead. Each row is summed on its own first,
+// so that there's one multiply by the row index per row rather than per pixel.
+__attribute__((target("sse4.1")))
+KERNEL_BODY void com_sse4_16_body(const struct com_region *r,
+	const void *src_, size_t tda, const void *dark_, double *dst,
+	size_t height, size_t width, enum com_mode mode
+){
+	const uint16_t *src = src_, *dark = dark_;
+	size_t flush = rows_per_flush(height, width, mode, 2);
+	if (height > SIMD_MAX_SIZE || width > SIMD_MAX_SIZE || !flush) {
+		com_scalar_body(r, src, tda, dark, dst, height, width, mode, 2);
+		return;
+	}
+	uint64_t s = 0, y = 0, x = 0;
+	const __m128i step = _mm_set1_epi32(4);
+	const __m128i idx0 = _mm_setr_epi32(0, 1, 2, 3);
+	const __m128i thr = _mm_set1_epi16(r->threshold);
+	size_t rows_left = flush;
+	__m128i vs = _mm_setzero_si128();
+	__m128i vy = _mm_setzero_si128();
+	__m128i vx = _mm_setzero_si128();
+	for (size_t i = 0; i < height; i++) {
+		const uint16_t *row = src + i*tda;
+		const uint16_t *drow = mode == COM_COG ?
+			row : dark + i*r->dark_tda;
+		const int16_t *wrow = mode == COM_WCOG ?
+			r->weights + i*width : 0;
+		__m128i vr = _mm_setzero_si128();
+		__m128i vj = idx0;
+		size_t j = 0;
+		for (; j + 4 <= width; j += 4) {
+			__m128i v = load_4_u16(
+				row+j, drow+j, wrow+j, thr, mode
+			);
+			vr = _mm_add_epi32(vr, v);
+			vx = _mm_add_epi32(vx, _mm_mullo_epi32(v, vj));
+			vj = _mm_add_epi32(vj, step);
+		}
+		vs = _mm_add_epi32(vs, vr);
+		vy = _mm_add_epi32(vy, _mm_mullo_epi32(vr, _mm_set1_epi32(i)));
+		uint32_t rs = 0, rx = 0;
+		for (; j < width; j++) {
+			uint32_t v = pixel(row[j], drow[j], r->threshold,
+				wrow ? wrow[j] : 0, mode
+			);
+			rs += v;
+			rx += j * v;
+		}
+		s += rs;
+		y += i * rs;
+		x += rx;
+		if (!--rows_left || i+1 == height) {
+			rows_left = flush;
+			hsum3_128(vs, vy, vx, &s, &y, &x);
+			vs = vy = vx = _mm_setzero_si128();
+		}
+	}
+	com_finish(s, y, x, height, width, dst);
+}
+
+
+// like load_4_u16, but for 8 pixels
+__attribute__((target("avx2")))
+KERNEL_BODY __m256i load_8_u16(const uint16_t *p, const uint16_t *d,
+	const int16_t *w, __m128i thr, enum com_mode mode
+){
+	__m128i v = _mm_loadu_si128((const __m128i *)p);
+	if (mode != COM_COG) {
+		__m128i dv = _mm_loadu_si128((const __m128i *)d);
+		v = _mm_subs_epu16(_mm_subs_epu16(v, dv), thr);
+	}
+	__m256i v32 = _mm256_cvtepu16_epi32(v);
+	if (mode == COM_WCOG) {
+		v32 = _mm256_mullo_epi32(v32, _mm256_cvtepi16_epi32(
+			_mm_loadu_si128((const __m128i *)w)
+		));
+	}
+	return v32;
+}
+
+
+__attribute__((target("avx2")))
+KERNEL_BODY void com_avx2_16_body(const struct com_region *r,
+	const void *src_, size_t tda, const void *dark_, double *dst,
+	size_t height, size_t width, enum com_mode mode
+){
+	const uint16_t *src = src_, *dark = dark_;
+	size_t flush = rows_per_flush(height, width, mode, 2);
+	if (height > SIMD_MAX_SIZE || width > SIMD_MAX_SIZE || !flush) {
+		com_scalar_body(r, src, tda, dark, dst, height, width, mode, 2);
+		return;
+	}
+	uint64_t s = 0, y = 0, x = 0;
+	const __m256i step = _mm256_set1_epi32(8);
+	const __m256i idx0 = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	const __m128i idx4 = _mm_setr_epi32(0, 1, 2, 3);
+	const __m128i thr = _mm_set1_epi16(r->threshold);
+	size_t rows_left = flush;
+	// 8 pixels at a time in the 256-bit accumulators, then 4 at a time in
+	// the 128-bit ones
+	__m256i vs = _mm256_setzero_si256();
+	__m256i vy = _mm256_setzero_si256();
+	__m256i vx = _mm256_setzero_si256();
+	__m128i vs4 = _mm_setzero_si128();
+	__m128i vy4 = _mm_setzero_si128();
+	__m128i vx4 = _mm_setzero_si128();
+	for (size_t i = 0; i < height; i++) {
+		const uint16_t *row = src + i*tda;
+		const uint16_t *drow = mode == COM_COG ?
+			row : dark + i*r->dark_tda;
+		const int16_t *wrow = mode == COM_WCOG ?
+			r->weights + i*width : 0;
+		__m256i vr = _mm256_setzero_si256();
+		__m256i vj = idx0;
+		size_t j = 0;
+		for (; j + 8 <= width; j += 8) {
+			__m256i v = load_8_u16(
+				row+j, drow+j, wrow+j, thr, mode
+			);
+			vr = _mm256_add_epi32(vr, v);
+			vx = _mm256_add_epi32(vx, _mm256_mullo_epi32(v, vj));
+			vj = _mm256_add_epi32(vj, step);
+		}
+		if (width >= 8) {
+			vs = _mm256_add_epi32(vs, vr);
+			vy = _mm256_add_epi32(vy, _mm256_mullo_epi32(vr,
+				_mm256_set1_epi32(i)
+			));
+		}
+		if (j + 4 <= width) {
+			__m128i v = load_4_u16(
+				row+j, drow+j, wrow+j, thr, mode
+			);
+			__m128i vj4 = _mm_add_epi32(idx4, _mm_set1_epi32(j));
+			vs4 = _mm_add_epi32(vs4, v);
+			vy4 = _mm_add_epi32(vy4,
+				_mm_mullo_epi32(v, _mm_set1_epi32(i))
+			);
+			vx4 = _mm_add_epi32(vx4, _mm_mullo_epi32(v, vj4));
+			j += 4;
+		}
+		uint32_t rs = 0, rx = 0;
+		for (; j < width; j++) {
+			uint32_t v = pixel(row[j], drow[j], r->threshold,
+				wrow ? wrow[j] : 0, mode
+			);
+			rs += v;
+			rx += j * v;
+		}
+		s += rs;
+		y += i * rs;
+		x += rx;
+		if (!--rows_left || i+1 == height) {
+			rows_left = flush;
+			if (width >= 8) {
+				vs4 = _mm_add_epi32(vs4, fold_256(vs));
+				vy4 = _mm_add_epi32(vy4, fold_256(vy));
+				vx4 = _mm_add_epi32(vx4, fold_256(vx));
+			}
+			hsum3_128(vs4, vy4, vx4, &s, &y, &x);
+			vs = vy = vx = _mm256_setzero_si256();
+			vs4 = vy4 = vx4 = _mm_setzero_si128();
+		}
+	}
+	com_finish(s, y, x, height, width, dst);
+}
+
+#endif
+
+
+// The scalar kernel, for 8 and 16-bit pixels.
+KERNEL_BODY void com_scalar_8_body(const struct com_region *r,
+	const void *src, size_t tda, const void *dark, double *dst,
+	size_t height, size_t width, enum com_mode mode
+){
+	com_scalar_body(r, src, tda, dark, dst, height, width, mode, 1);
+}
+KERNEL_BODY void com_scalar_16_body(const struct com_region *r,
+	const void *src, size_t tda, const void *dark, double *dst,
+	size_t height, size_t width, enum com_mode mode
+){
+	com_scalar_body(r, src, tda, dark, dst, height, width, mode, 2);
+}
+
+
+// Generic kernels, for any size of region, in each mode.
+#define DEFINE_GENERIC(isa, bits, mode, ...) \
+	__VA_ARGS__ static void com_##isa##_##bits##_##mode( \
+		const struct com_region *r, const void *src, size_t tda, \
+		const void *dark, double *dst \
+	){ \
+		com_##isa##_##bits##_body(r, src, tda, dark, dst, \
+			r->height, r->width, mode \
+		); \
+	}
+
+// Kernels for square regions of size n by n, in each mode.
+#define DEFINE_FIXED(n, isa, bits, mode, ...) \
+	__VA_ARGS__ static void com_##isa##_##bits##_##n##x##n##_##mode( \
+		const struct com_region *r, const void *src, size_t tda, \
+		const void *dark, double *dst \
+	){ \
+		com_##isa##_##bits##_body(r, src, tda, dark, dst, \
+			n, n, mode \
+		); \
+	}
+
+#define DEFINE_MODES(DEFINE, ...) \
+	DEFINE(__VA_ARGS__, COM_COG) \
+	DEFINE(__VA_ARGS__, COM_TCOG) \
+	DEFINE(__VA_ARGS__, COM_WCOG)
+#define DEFINE_ALL(isa, bits) \
+	DEFINE_MODES(DEFINE_GENERIC, isa, bits)
+#define DEFINE_FIXED_SCALAR(n) \
+	DEFINE_MODES(DEFINE_FIXED, n, scalar, 8) \
+	DEFINE_MODES(DEFINE_FIXED, n, scalar, 16)
+DEFINE_ALL(scalar, 8)
+DEFINE_ALL(scalar, 16)
+FOR_COM_SIZES(DEFINE_FIXED_SCALAR)
+#ifdef COM_X86
+// the target attribute has to go in front, so these put isa and bits last
+#define DEFINE_GENERIC_X86(tgt, isa, bits, mode) \
+	DEFINE_GENERIC(isa, bits, mode, __attribute__((target(tgt))))
+#define DEFINE_FIXED_X86(tgt, n, isa, bits, mode) \
+	DEFINE_FIXED(n, isa, bits, mode, __attribute__((target(tgt))))
+#define DEFINE_ALL_X86(tgt, isa, bits) \
+	DEFINE_MODES(DEFINE_GENERIC_X86, tgt, isa, bits)
+#define DEFINE_FIXED_SSE4(n) \
+	DEFINE_MODES(DEFINE_FIXED_X86, "sse4.1", n, sse4, 8) \
+	DEFINE_MODES(DEFINE_FIXED_X86, "sse4.1", n, sse4, 16)
+#define DEFINE_FIXED_AVX2(n) \
+	DEFINE_MODES(DEFINE_FIXED_X86, "avx2", n, avx2, 8) \
+	DEFINE_MODES(DEFINE_FIXED_X86, "avx2", n, avx2, 16)
+DEFINE_ALL_X86("sse4.1", sse4, 8)
+DEFINE_ALL_X86("sse4.1", sse4, 16)
+DEFINE_ALL_X86("avx2", avx2, 8)
+DEFINE_ALL_X86("avx2", avx2, 16)
+FOR_COM_SIZES(DEFINE_FIXED_SSE4)
+FOR_COM_SIZES(DEFINE_FIXED_AVX2)
+#undef DEFINE_FIXED_AVX2
+#undef DEFINE_FIXED_SSE4
+#undef DEFINE_ALL_X86
+#undef DEFINE_FIXED_X86
+#undef DEFINE_GENERIC_X86
+#endif
+#undef DEFINE_FIXED_SCALAR
+#undef DEFINE_ALL
+#undef DEFINE_MODES
+#undef DEFINE_FIXED
+#undef DEFINE_GENERIC
+
+
+com_kernel com_kernel_select(const struct com_region *region,
+	enum com_mode mode, const char **name
+){
+	const char *dummy;
+	if (!name) name = &dummy;
+	size_t height = region->height;
+	size_t width = region->width;
+	bool wide = region->pixel_size == 2;
+	// use a fixed-size kernel if there is one, or else a generic one
+	#define SELECT_MODE(f, desc) \
+		switch (mode) { \
+		case COM_COG: *name = desc; return f##_COM_COG; \
+		case COM_TCOG: *name = desc ", tcog"; return f##_COM_TCOG; \
+		case COM_WCOG: *name = desc ", wcog"; return f##_COM_WCOG; \
+		}
+	#define SELECT_BITS(f, isa, desc) \
+		if (wide) { \
+			SELECT_MODE(com_##isa##_16##f, #isa ", 16-bit" desc) \
+		} else { \
+			SELECT_MODE(com_##isa##_8##f, #isa desc) \
+		}
+	#define SELECT_FIXED(n, isa) \
+		if (height == n && width == n) { \
+			SELECT_BITS(_##n##x##n, isa, ", " #n "x" #n) \
+		}
+	#define SELECT_GENERIC(isa) SELECT_BITS(, isa, "")
+	#define SELECT_FIXED_SCALAR(n) SELECT_FIXED(n, scalar)
+	#define SELECT_FIXED_SSE4(n) SELECT_FIXED(n, sse4)
+	#define SELECT_FIXED_AVX2(n) SELECT_FIXED(n, avx2)
+#ifdef COM_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		FOR_COM_SIZES(SELECT_FIXED_AVX2)
+		SELECT_GENERIC(avx2)
+	}
+	if (__builtin_cpu_supports("sse4.1")) {
+		FOR_COM_SIZES(SELECT_FIXED_SSE4)
+		SELECT_GENERIC(sse4)
+	}
+#endif
+	FOR_COM_SIZES(SELECT_FIXED_SCALAR)
+	SELECT_GENERIC(scalar)
+	return 0;
+	#undef SELECT_FIXED_AVX2
+	#undef SELECT_FIXED_SSE4
+	#undef SELECT_FIXED_SCALAR
+	#undef SELECT_GENERIC
+	#undef SELECT_FIXED
+	#undef SELECT_BITS
+	#undef SELECT_MODE
+}
+
@@ -0,0 +1,65 @@
+#ifndef AYLP_DEVICES_COM_KERNELS_H_
+#define AYLP_DEVICES_COM_KERNELS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Weight that leaves a pixel unchanged in COM_WCOG mode. Weights are small
+* enough that a weighted uchar pixel still fits in a signed 16-bit integer. */
+#define COM_WEIGHT_ONE 128
+
+/** What to do to each pixel before summing it. */
+enum com_mode {
+	// use the raw pixel values
+	COM_COG,
+	// subtract the dark frame and then the threshold, clamping at zero
+	COM_TCOG,
+	// as COM_TCOG, then multiply by the weight for that pixel
+	COM_WCOG,
+};
+
+/** Shape of the regions, and how to preprocess their pixels. */
+struct com_region {
+	// size of each region
+	size_t height;
+	size_t width;
+	// bytes per pixel, of the image and the dark frame: 1 for unsigned
+	// char, or 2 for unsigned short
+	size_t pixel_size;
+	// distance between rows of the dark frame, in pixels
+	size_t dark_tda;
+	// subtracted from each pixel after the dark frame
+	uint16_t threshold;
+	// height*width weights, in row-major order, out of COM_WEIGHT_ONE
+	const int16_t *weights;
+};
+
+/** Center of mass kernel for one region of an image.
+* Reads region->height rows of region->width pixels starting at src, with rows
+* `tda` pixels apart, and writes the (y,x) coords (in that order) of the center
+* of mass to dst[0] and dst[1], scaled from 0:size-1 to -1:1. Dark is the
+* same region of the dark frame, which is only read in COM_TCOG and COM_WCOG
+* modes. Pixel sums and moments are accumulated as integers, and only
+* converted to double at the end. */
+typedef void (*com_kernel)(const struct com_region *region,
+	const void *src, size_t tda, const void *dark, double *dst
+);
+
+/** Sizes of square regions that have kernels of their own. */
+#define FOR_COM_SIZES(DO) \
+	DO(4) \
+	DO(6) \
+	DO(8) \
+	DO(10) \
+	DO(12) \
+	DO(16)
+
+/** Pick the fastest kernel this CPU supports for the given mode and regions.
+* Name is set to a short description of the kernel (e.g. "avx2, 8x8") if it is
+* not null. */
+com_kernel com_kernel_select(const struct com_region *region,
+	enum com_mode mode, const char **name
+);
+
+#endif
+
@@ -5,8 +5,10 @@
 #include "devices/clamp.h"
 #include "devices/delay.h"
 #include "devices/file_sink.h"
+#include "devices/iir.h"
 #include "devices/logger.h"
 #include "devices/matmul.h"
+#include "devices/matmul_pid.h"
 #include "devices/pid.h"
 #include "devices/poke.h"
 #include "devices/remove_piston.h"
@@ -23,8 +25,10 @@ static const struct {
 	{ "anyloop:clamp", clamp_init },
 	{ "anyloop:delay", delay_init },
 	{ "anyloop:file_sink", file_sink_init },
+	{ "anyloop:iir", iir_init },
 	{ "anyloop:logger", logger_init },
 	{ "anyloop:matmul", matmul_init },
+	{ "anyloop:matmul_pid", matmul_pid_init },
 	{ "anyloop:pid", pid_init },
 	{ "anyloop:poke", poke_init },
 	{ "anyloop:remove_piston", remove_piston_init },
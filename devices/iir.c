@@ -0,0 +1,278 @@
+#include <gsl/gsl_matrix.h>
+#include <json-c/json.h>
+#include "anyloop.h"
+#include "iir.h"
+#include "load.h"
+#include "logging.h"
+#include "xalloc.h"
+
+
+// Lay out normalized coefficients and zeroed state for n elements. The
+// coefficients must have one row, or n rows.
+static void iir_setup(struct aylp_iir_data *data, size_t n)
+{
+	size_t ns = data->n_sections;
+	if (data->soa) {
+		xfree_aligned(data->soa);
+		xfree_aligned_type(gsl_vector, data->res);
+	}
+	data->n = n;
+	data->soa = xcalloc_aligned(7 * ns * n, sizeof(double));
+	data->res = xmalloc_aligned_type(gsl_vector, n);
+	double *b0 = data->soa, *b1 = b0 + ns*n, *b2 = b1 + ns*n;
+	double *a1 = b2 + ns*n, *a2 = a1 + ns*n;
+	double *z1 = a2 + ns*n, *z2 = z1 + ns*n;
+	for (size_t k = 0; k < ns; k++) {
+		data->sections[k] = (struct iir_section){
+			b0 + k*n, b1 + k*n, b2 + k*n, a1 + k*n, a2 + k*n,
+			z1 + k*n, z2 + k*n,
+		};
+		for (size_t j = 0; j < n; j++) {
+			size_t row = data->coeffs->size1 == 1 ? 0 : j;
+			const double *c = data->coeffs->data
+				+ row * data->coeffs->tda
+				+ k * IIR_COEFFS_PER_SECTION;
+			// divide through by a0 here, so the kernel never has to
+			b0[k*n + j] = c[0] / c[3];
+			b1[k*n + j] = c[1] / c[3];
+			b2[k*n + j] = c[2] / c[3];
+			a1[k*n + j] = c[4] / c[3];
+			a2[k*n + j] = c[5] / c[3];
+		}
+	}
+}
+
+
+int iir_init(struct aylp_device *self)
+{
+	int err;
+	self->proc = &iir_proc;
+	self->shape = &iir_shape;
+	self->fini = &iir_fini;
+	self->device_data = xcalloc(1, sizeof(struct aylp_iir_data));
+	struct aylp_iir_data *data = self->device_data;
+
+	// json array for coefficients passed in config file
+	json_object *json_mat = 0;
+	// or, filename for aylp file
+	const char *filename = 0;
+
+	// parse parameters
+	if (!self->params) {
+		log_error("No params object found.");
+		return -1;
+	}
+	json_object_object_foreach(self->params, key, val) {
+		if (key[0] == '_') {
+			// keys starting with _ are comments
+		} else if (!strcmp(key, "coefficients")) {
+			json_mat = val;
+			log_trace("Read coefficients from json");
+		} else if (!strcmp(key, "filename")) {
+			filename = json_object_get_string(val);
+			log_trace("filename = %s", filename);
+		} else if (!strcmp(key, "units")) {
+			const char *s = json_object_get_string(val);
+			data->units = aylp_units_from_string(s);
+			log_trace("units = %s (0x%hhX)", s, data->units);
+		} else {
+			log_warn("Unknown parameter \"%s\"", key);
+		}
+	}
+
+	if (filename && json_mat) {
+		log_error("Provide only one of the filename and coefficients "
+			"params."
+		);
+		return -1;
+	} else if (filename) {
+		err = load_matrix_from_file(&data->coeffs, filename);
+		if (err) return err;
+	} else if (json_mat) {
+		err = load_matrix_from_json(&data->coeffs, json_mat);
+		if (err) return err;
+	} else {
+		log_error("No coefficients provided. Check filename and "
+			"coefficients params."
+		);
+		return -1;
+	}
+	gsl_matrix *c = data->coeffs;
+	if (!c->size1 || !c->size2 || c->size2 % IIR_COEFFS_PER_SECTION) {
+		log_error("Coefficients must have a multiple of %d columns, "
+			"but are %zux%zu", IIR_COEFFS_PER_SECTION,
+			c->size1, c->size2
+		);
+		return -1;
+	}
+	data->n_sections = c->size2 / IIR_COEFFS_PER_SECTION;
+	for (size_t row = 0; row < c->size1; row++) {
+		for (size_t k = 0; k < data->n_sections; k++) {
+			size_t a0 = k*IIR_COEFFS_PER_SECTION + 3;
+			if (!gsl_matrix_get(c, row, a0)) {
+				log_error("a0 of section %zu of row %zu is "
+					"zero", k, row
+				);
+				return -1;
+			}
+		}
+	}
+	log_info("Read %zu sections for %zu %s", data->n_sections, c->size1,
+		c->size1 == 1 ? "row, shared by all elements" : "elements"
+	);
+
+	data->sections = xcalloc(data->n_sections, sizeof(struct iir_section));
+	// with a row per element we know the size already; otherwise wait for
+	// the shape of the input
+	if (c->size1 > 1) iir_setup(data, c->size1);
+
+	const char *kernel_name;
+	data->kernel = iir_kernel_select(&kernel_name);
+	log_debug("Using %s kernel", kernel_name);
+
+	// in batch mode, vectors come in as the columns of a matrix
+	if (self->batch > 1) {
+		data->batched = true;
+		self->proc = &iir_proc_batch;
+		// a dummy, so that proc() can skip checking if it exists
+		data->res_m = xmalloc_aligned_type(gsl_matrix, 0, 0);
+	}
+
+	// set types and units
+	self->type_in = data->batched ? AYLP_T_MATRIX : AYLP_T_VECTOR;
+	self->units_in = AYLP_U_ANY;
+	self->type_out = AYLP_T_UNCHANGED;
+	self->units_out = data->units;
+	self->scratch_out = true;
+	return 0;
+}
+
+
+int iir_shape(struct aylp_device *self, struct aylp_shape *shape)
+{
+	struct aylp_iir_data *data = self->device_data;
+	// batched, there is one set of state per row
+	size_t n = data->batched ? shape->y : shape->y * shape->x;
+	if (data->batched && n) {
+		xfree_aligned_type(gsl_matrix, data->res_m);
+		data->res_m = xmalloc_aligned_type(gsl_matrix,
+			shape->y, shape->x
+		);
+	}
+	if (!n || n == data->n) return 0;
+	if (data->coeffs->size1 > 1) {
+		log_error("Input vector has size %zu, but coefficients have "
+			"%zu rows", n, data->coeffs->size1
+		);
+		return -1;
+	}
+	iir_setup(data, n);
+	return 0;
+}
+
+
+int iir_proc(struct aylp_device *self, struct aylp_state *state)
+{
+	struct aylp_iir_data *data = self->device_data;
+	gsl_vector *s = state->vector;
+
+	if (UNLIKELY(s->size != data->n)) {
+		if (data->coeffs->size1 > 1) {
+			log_error("Input vector has size %zu, but coefficients "
+				"have %zu rows", s->size, data->coeffs->size1
+			);
+			return -1;
+		}
+		log_debug("Setting up for %zu elements", s->size);
+		iir_setup(data, s->size);
+	}
+
+	if (LIKELY(s->stride == 1 && state->header.status & AYLP_MUTABLE)) {
+		// every section can work on the input in place
+		for (size_t k = 0; k < data->n_sections; k++) {
+			data->kernel(&data->sections[k], data->n,
+				s->data, s->data
+			);
+		}
+		return 0;
+	}
+
+	// the first section reads the input, and the rest work in place
+	const double *x = s->data;
+	if (UNLIKELY(s->stride != 1)) {
+		for (size_t j = 0; j < s->size; j++)
+			data->res->data[j] = s->data[j * s->stride];
+		x = data->res->data;
+	}
+	for (size_t k = 0; k < data->n_sections; k++) {
+		data->kernel(&data->sections[k], data->n, x, data->res->data);
+		x = data->res->data;
+	}
+
+	// update pipeline state
+	state->vector = data->res;
+	return 0;
+}
+
+
+int iir_proc_batch(struct aylp_device *self, struct aylp_state *state)
+{
+	struct aylp_iir_data *data = self->device_data;
+	gsl_matrix *s = state->matrix;
+
+	if (UNLIKELY(s->size1 != data->n)) {
+		if (data->coeffs->size1 > 1) {
+			log_error("Input matrix has %zu rows, but coefficients "
+				"have %zu", s->size1, data->coeffs->size1
+			);
+			return -1;
+		}
+		log_debug("Setting up for %zu elements", s->size1);
+		iir_setup(data, s->size1);
+	}
+
+	gsl_matrix *r = s;
+	if (!(state->header.status & AYLP_MUTABLE)) {
+		if (UNLIKELY(data->res_m->size1 != s->size1
+		|| data->res_m->size2 != s->size2)) {
+			xfree_aligned_type(gsl_matrix, data->res_m);
+			data->res_m = xmalloc_aligned_type(gsl_matrix,
+				s->size1, s->size2
+			);
+		}
+		r = data->res_m;
+	}
+
+	// each element's frames are in order along its row, so all the
+	// elements are stepped through one column at a time, gathered into res
+	// so that the kernel gets them contiguous
+	double *col = data->res->data;
+	for (size_t x = 0; x < s->size2; x++) {
+		for (size_t y = 0; y < s->size1; y++)
+			col[y] = s->data[y*s->tda + x];
+		for (size_t k = 0; k < data->n_sections; k++)
+			data->kernel(&data->sections[k], data->n, col, col);
+		for (size_t y = 0; y < s->size1; y++)
+			r->data[y*r->tda + x] = col[y];
+	}
+
+	// update pipeline state
+	state->matrix = r;
+	return 0;
+}
+
+
+int iir_fini(struct aylp_device *self)
+{
+	struct aylp_iir_data *data = self->device_data;
+	xfree_type(gsl_matrix, data->coeffs);
+	if (data->batched) xfree_aligned_type(gsl_matrix, data->res_m);
+	xfree(data->sections);
+	if (data->soa) {
+		xfree_aligned(data->soa);
+		xfree_aligned_type(gsl_vector, data->res);
+	}
+	xfree(data);
+	return 0;
+}
+
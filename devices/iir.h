@@ -0,0 +1,53 @@
+#ifndef AYLP_DEVICES_IIR_H_
+#define AYLP_DEVICES_IIR_H_
+
+#include <gsl/gsl_matrix.h>
+#include <gsl/gsl_vector.h>
+#include "anyloop.h"
+#include "iir_kernels.h"
+
+// coefficients per biquad section: b0, b1, b2, a0, a1, a2
+#define IIR_COEFFS_PER_SECTION 6
+
+struct aylp_iir_data {
+	// coefficients as given, one row per element or a single row for all
+	// of them, with IIR_COEFFS_PER_SECTION columns per section
+	gsl_matrix *coeffs;
+	// number of biquad sections each element goes through, in order
+	size_t n_sections;
+	// number of elements the sections are currently set up for
+	size_t n;
+	// one section per n_sections, each over n elements
+	struct iir_section *sections;
+	// the arrays the sections point into: the five normalized coefficients
+	// and then the two states, each n_sections*n long
+	double *soa;
+	// the result, or in batch mode the column being filtered
+	gsl_vector *res;
+	// whether vectors come batched as the columns of a matrix, in which
+	// case the result goes in res_m
+	bool batched;
+	gsl_matrix *res_m;
+	// units to output
+	aylp_units units;
+	// biquad kernel, picked for this CPU
+	iir_kernel kernel;
+};
+
+// initialize iir device
+int iir_init(struct aylp_device *self);
+
+// set up the iir sections for the shape of its input
+int iir_shape(struct aylp_device *self, struct aylp_shape *shape);
+
+// process iir device once per loop
+int iir_proc(struct aylp_device *self, struct aylp_state *state);
+
+// process a batch of vectors, one per column of a matrix, once per loop
+int iir_proc_batch(struct aylp_device *self, struct aylp_state *state);
+
+// close iir device when loop exits
+int iir_fini(struct aylp_device *self);
+
+#endif
+
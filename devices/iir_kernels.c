@@ -0,0 +1,70 @@
+#include <stdbool.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define IIR_X86 1
+#endif
+
+#include "cpu.h"
+#include "iir_kernels.h"
+
+
+static void iir_scalar(const struct iir_section *sec, size_t n,
+	const double *x, double *y
+){
+	for (size_t j = 0; j < n; j++) {
+		double xj = x[j];
+		double yj = sec->b0[j] * xj + sec->z1[j];
+		sec->z1[j] = sec->b1[j] * xj - sec->a1[j] * yj + sec->z2[j];
+		sec->z2[j] = sec->b2[j] * xj - sec->a2[j] * yj;
+		y[j] = yj;
+	}
+}
+
+
+#ifdef IIR_X86
+
+__attribute__((target("avx2,fma")))
+static void iir_avx2(const struct iir_section *sec, size_t n,
+	const double *x, double *y
+){
+	size_t j = 0;
+	for (; j + 4 <= n; j += 4) {
+		__m256d xj = _mm256_loadu_pd(x + j);
+		__m256d yj = _mm256_fmadd_pd(_mm256_loadu_pd(sec->b0 + j), xj,
+			_mm256_loadu_pd(sec->z1 + j)
+		);
+		__m256d z1 = _mm256_fmadd_pd(_mm256_loadu_pd(sec->b1 + j), xj,
+			_mm256_loadu_pd(sec->z2 + j)
+		);
+		z1 = _mm256_fnmadd_pd(_mm256_loadu_pd(sec->a1 + j), yj, z1);
+		__m256d z2 = _mm256_mul_pd(_mm256_loadu_pd(sec->b2 + j), xj);
+		z2 = _mm256_fnmadd_pd(_mm256_loadu_pd(sec->a2 + j), yj, z2);
+		_mm256_storeu_pd(sec->z1 + j, z1);
+		_mm256_storeu_pd(sec->z2 + j, z2);
+		_mm256_storeu_pd(y + j, yj);
+	}
+	struct iir_section tail = {
+		sec->b0 + j, sec->b1 + j, sec->b2 + j, sec->a1 + j, sec->a2 + j,
+		sec->z1 + j, sec->z2 + j,
+	};
+	iir_scalar(&tail, n - j, x + j, y + j);
+}
+
+#endif
+
+
+iir_kernel iir_kernel_select(const char **name)
+{
+	const char *dummy;
+	if (!name) name = &dummy;
+#ifdef IIR_X86
+	if (cpu_has_avx2_fma()) {
+		*name = "avx2";
+		return iir_avx2;
+	}
+#endif
+	*name = "scalar";
+	return iir_scalar;
+}
+
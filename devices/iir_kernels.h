@@ -0,0 +1,30 @@
+#ifndef AYLP_DEVICES_IIR_KERNELS_H_
+#define AYLP_DEVICES_IIR_KERNELS_H_
+
+#include <stddef.h>
+
+/** One biquad section for each of n elements, in structure-of-arrays layout:
+* element j has coefficients b0[j], b1[j], ..., normalized so that a0 = 1, and
+* state z1[j] and z2[j]. */
+struct iir_section {
+	const double *b0, *b1, *b2, *a1, *a2;
+	double *z1, *z2;
+};
+
+/** Biquad kernel for n contiguous elements, in transposed direct form II:
+*
+*     y = b0*x + z1
+*     z1 = b1*x - a1*y + z2
+*     z2 = b2*x - a2*y
+*
+* x and y may be the same array, to run a section in place. */
+typedef void (*iir_kernel)(const struct iir_section *sec, size_t n,
+	const double *x, double *y
+);
+
+/** Pick the fastest iir kernel this CPU supports. Name is set to a short
+* description of the kernel (e.g. "avx2") if it is not null. */
+iir_kernel iir_kernel_select(const char **name);
+
+#endif
+
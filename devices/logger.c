@@ -39,8 +39,28 @@ int logger_proc(struct aylp_device *self, struct aylp_state *state)
 		);
 		pretty_matrix_uchar(state->matrix_uchar);
 		break;
+	case AYLP_T_MATRIX_USHORT:
+		log_info("Seeing matrix of size %zux%zu:",
+			state->matrix_ushort->size1,
+			state->matrix_ushort->size2
+		);
+		pretty_matrix_ushort(state->matrix_ushort);
+		break;
+	case AYLP_T_VECTOR_FLOAT:
+		log_info("Seeing vector of size %zu:",
+			state->vector_float->size
+		);
+		logn_info("");
+		pretty_vector_float(state->vector_float);
+		break;
+	case AYLP_T_MATRIX_FLOAT:
+		log_info("Seeing matrix of size %zux%zu:",
+			state->matrix_float->size1, state->matrix_float->size2
+		);
+		pretty_matrix_float(state->matrix_float);
+		break;
 	default:
-		log_warn("Seeing type %hhX but don't know how to print it",
+		log_warn("Seeing type %hX but don't know how to print it",
 			state->header.type
 		);
 		if (!state->header.type)
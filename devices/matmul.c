@@ -1,105 +1,171 @@
+#include <math.h>
+#include <stdint.h>
 #include <gsl/gsl_blas.h>
+#include <gsl/gsl_linalg.h>
 #include <gsl/gsl_matrix.h>
 #include <json-c/json.h>
 #include "anyloop.h"
 #include "block.h"
+#include "load.h"
 #include "logging.h"
 #include "matmul.h"
 #include "pretty.h"
+#include "thread_pool.h"
 #include "xalloc.h"
 
+// With param sparse set to "auto", matrices with at most this fraction of
+// nonzeros are stored sparsely. Each nonzero costs 12 bytes in CSR against 8
+// per element dense, and gathers are slower than contiguous loads, so it has
+// to be quite sparse to be worth it (break-even is around 25% with AVX2).
+#define MATMUL_SPARSE_AUTO_DENSITY 0.2
 
-static int load_matrix_from_file(gsl_matrix **mat, const char *filename)
+// values of param sparse
+enum matmul_sparse {
+	MATMUL_SPARSE_NEVER,
+	MATMUL_SPARSE_ALWAYS,
+	MATMUL_SPARSE_AUTO,
+};
+
+
+// number of elements of m that are more than tol away from zero
+static size_t count_nonzeros(const gsl_matrix *m, double tol)
 {
-	int err;
-	// open input file
-	FILE *fp = fopen(filename, "r");
-	if (!fp) {
-		log_error("Couldn't open file: %s", strerror(errno));
-		return -1;
-	}
-	// grab header
-	struct aylp_header head = {0};
-	size_t n = fread(&head, 1, sizeof(struct aylp_header), fp);
-	if (n < sizeof(struct aylp_header)) {
-		log_error("Short read: %llu of %llu",
-			n, sizeof(struct aylp_header)
-		);
-		return -1;
+	size_t nnz = 0;
+	for (size_t i = 0; i < m->size1; i++) {
+		for (size_t j = 0; j < m->size2; j++) {
+			if (fabs(m->data[i*m->tda + j]) > tol) nnz++;
+		}
 	}
-	// check header
-	if (head.magic != AYLP_MAGIC) {
-		log_error("File provided is not an AYLP file.");
-		return -1;
-	} else if (head.version != AYLP_SCHEMA_VERSION) {
-		log_error("File provided has different AYLP_SCHEMA_VERSION "
-			"(we are %hhX, file is %hhX)",
-			AYLP_SCHEMA_VERSION, head.version
-		);
-		return -1;
-	} else if (head.type != AYLP_T_MATRIX) {
-		log_error("Data in file is not of type AYLP_T_MATRIX.");
-		return -1;
+	return nnz;
+}
+
+
+// Make a CSR copy of the elements of m that are more than tol away from zero
+// (of which there are nnz), in single precision if use_float.
+static struct csr_matrix *csr_from_dense(const gsl_matrix *m, size_t nnz,
+	double tol, bool use_float
+){
+	struct csr_matrix *csr = xcalloc(1, sizeof(struct csr_matrix));
+	csr->size1 = m->size1;
+	csr->size2 = m->size2;
+	csr->nnz = nnz;
+	csr->row_ptr = xmalloc((m->size1 + 1) * sizeof(size_t));
+	csr->col = xmalloc(nnz * sizeof(uint32_t));
+	if (use_float) csr->val_f = xmalloc(nnz * sizeof(float));
+	else csr->val = xmalloc(nnz * sizeof(double));
+	size_t k = 0;
+	for (size_t i = 0; i < m->size1; i++) {
+		csr->row_ptr[i] = k;
+		for (size_t j = 0; j < m->size2; j++) {
+			double x = m->data[i*m->tda + j];
+			if (!(fabs(x) > tol)) continue;
+			csr->col[k] = j;
+			if (use_float) csr->val_f[k] = x;
+			else csr->val[k] = x;
+			k++;
+		}
 	}
-	// allocate and grab data
-	*mat = gsl_matrix_alloc(head.log_dim.y, head.log_dim.x);
-	err = gsl_matrix_fread(fp, *mat);
-	if (err) {
-		log_error("Error in reading matrix: ", gsl_strerror(err));
-		return -1;
+	csr->row_ptr[m->size1] = k;
+	return csr;
+}
+
+
+static void csr_free(struct csr_matrix *csr)
+{
+	xfree(csr->row_ptr);
+	xfree(csr->col);
+	xfree(csr->val);
+	xfree(csr->val_f);
+	xfree(csr);
+}
+
+
+// single-precision copy of m
+static gsl_matrix_float *matrix_to_float(const gsl_matrix *m)
+{
+	gsl_matrix_float *f = xmalloc_type(gsl_matrix_float,
+		m->size1, m->size2
+	);
+	for (size_t i = 0; i < m->size1; i++) {
+		for (size_t j = 0; j < m->size2; j++) {
+			f->data[i*f->tda + j] = m->data[i*m->tda + j];
+		}
 	}
-	// close input file
-	fclose(fp);
-	return 0;
+	return f;
 }
 
 
-static int load_matrix_from_json(gsl_matrix **mat, json_object *json_mat)
+// Factor data->mat as U S V^T, and keep the rank largest singular values as
+// lr_u = U (size1 x rank) and lr_sv = S V^T (rank x size2), so that the
+// product can be done as two thin ones.
+static int factor_low_rank(struct aylp_matmul_data *data, size_t rank)
 {
-	errno = 0;
-	if (!json_object_is_type(json_mat, json_type_array)) {
-		log_error("Matrix passed in json must be a json array");
+	size_t m = data->mat->size1;
+	size_t n = data->mat->size2;
+	// gsl wants at least as many rows as columns, so for wide matrices we
+	// factor the transpose, A^T = U' S V'^T, and then A = V' S U'^T
+	bool wide = m < n;
+	size_t rows = wide ? n : m;
+	size_t cols = wide ? m : n;
+	if (rank > cols) {
+		log_warn("rank %zu is more than the matrix has; using %zu",
+			rank, cols
+		);
+		rank = cols;
+	}
+	gsl_matrix *a = xmalloc_type(gsl_matrix, rows, cols);
+	if (wide) gsl_matrix_transpose_memcpy(a, data->mat);
+	else gsl_matrix_memcpy(a, data->mat);
+	gsl_matrix *v = xmalloc_type(gsl_matrix, cols, cols);
+	gsl_vector *sing = xmalloc_type(gsl_vector, cols);
+	gsl_vector *work = xmalloc_type(gsl_vector, cols);
+	int err = gsl_linalg_SV_decomp(a, v, sing, work);
+	xfree_type(gsl_vector, work);
+	if (err) {
+		log_error("Error during SVD: %s", gsl_strerror(err));
+		xfree_type(gsl_matrix, a);
+		xfree_type(gsl_matrix, v);
+		xfree_type(gsl_vector, sing);
 		return -1;
 	}
+	// now a holds U (or U'), and v holds V (or V')
+	gsl_matrix *left = wide ? v : a;
+	gsl_matrix *right = wide ? a : v;
 
-	size_t M = json_object_array_length(json_mat);
-	size_t N = 0;
-
-	json_object *row;
-	json_object *element;
-	for (size_t i = 0; i < M; i++) {
-		row = json_object_array_get_idx(json_mat, i);
-		if (!json_object_is_type(row, json_type_array)) {
-			log_error("Row %zu of matrix is not an array", i);
-			return -1;
-		}
-		size_t N_this = json_object_array_length(row);
-		if (!N) {
-			N = N_this;
-			*mat = gsl_matrix_alloc(M, N);
-			log_trace("Matrix is %zu by %zu", M, N);
-		} else if (N_this != N) {
-			log_error("Row %zu of matrix has length %zu, "
-				"but previous rows had length %zu", i, N_this, N
+	data->lr_u = xmalloc_type(gsl_matrix, m, rank);
+	data->lr_sv = xmalloc_type(gsl_matrix, rank, n);
+	for (size_t i = 0; i < m; i++) {
+		for (size_t k = 0; k < rank; k++) {
+			gsl_matrix_set(data->lr_u, i, k,
+				gsl_matrix_get(left, i, k)
 			);
-			return -1;
 		}
-		for (size_t j = 0; j < N; j++) {
-			element = json_object_array_get_idx(row, j);
-			double x = json_object_get_double(element);
-			if (x != x) {
-				log_error("Found NaN at %llu,%llu", i, j);
-				if (errno) {
-					log_error("(errno was %d: %s)",
-						errno, strerror(errno)
-					);
-				}
-				return -1;
-			}
-			gsl_matrix_set(*mat, i, j, x);
+	}
+	for (size_t k = 0; k < rank; k++) {
+		for (size_t j = 0; j < n; j++) {
+			gsl_matrix_set(data->lr_sv, k, j,
+				gsl_vector_get(sing, k)
+				* gsl_matrix_get(right, j, k)
+			);
 		}
 	}
 
+	// tell the user how much of the matrix we threw away
+	double kept = 0, total = 0;
+	for (size_t k = 0; k < cols; k++) {
+		double s2 = gsl_vector_get(sing, k) * gsl_vector_get(sing, k);
+		total += s2;
+		if (k < rank) kept += s2;
+	}
+	log_info("Keeping %zu of %zu singular values (down to %G), with "
+		"%.6G%% of the squared Frobenius norm",
+		rank, cols, rank ? gsl_vector_get(sing, rank-1) : 0.0,
+		total > 0 ? 100 * kept / total : 100.0
+	);
+
+	xfree_type(gsl_matrix, a);
+	xfree_type(gsl_matrix, v);
+	xfree_type(gsl_vector, sing);
 	return 0;
 }
 
@@ -110,12 +176,16 @@ int matmul_init(struct aylp_device *self)
 	self->device_data = xcalloc(1, sizeof(struct aylp_matmul_data));
 	struct aylp_matmul_data *data = self->device_data;
 
-	// json array for matrix passed in config file
-	json_object *json_mat = 0;
-	// or, filename for aylp file
-	const char *filename = 0;
 	// so we can check if we got a type
 	self->type_in = AYLP_T_NONE;
+	// whether to do the multiplication in single precision
+	bool use_float = false;
+	// whether to store the matrix sparsely, and what counts as zero
+	enum matmul_sparse sparse = MATMUL_SPARSE_NEVER;
+	double sparse_tolerance = 0.0;
+	// number of singular values to keep, or 0 for the whole matrix
+	size_t rank = 0;
+	data->thread_count = 1;
 
 	// parse the params json into our data struct
 	if (!self->params) {
@@ -125,16 +195,9 @@ int matmul_init(struct aylp_device *self)
 	json_object_object_foreach(self->params, key, val) {
 		if (key[0] == '_') {
 			// keys starting with _ are comments
-		} else if (!strcmp(key, "matrix")) {
-			json_mat = val;
-			err = load_matrix_from_json(&data->mat, json_mat);
-			if (err) return err;
-			log_trace("Read matrix from json");
-		} else if (!strcmp(key, "filename")) {
-			filename = json_object_get_string(val);
-			log_trace("filename = %s", filename);
-			err = load_matrix_from_file(&data->mat, filename);
-			if (err) return err;
+		} else if (!strcmp(key, "matrix") || !strcmp(key, "filename")
+			|| !strcmp(key, "load")) {
+			// read by load_matrix_param below
 		} else if (!strcmp(key, "type")) {
 			const char *s = json_object_get_string(val);
 			if (!strcmp(s, "vector"))
@@ -143,18 +206,51 @@ int matmul_init(struct aylp_device *self)
 				self->type_in = AYLP_T_MATRIX;
 			else log_error("Unrecognized type: %s", s);
 			log_trace("type = %s (0x%X)", s, self->type_in);
+		} else if (!strcmp(key, "precision")) {
+			const char *s = json_object_get_string(val);
+			if (!strcmp(s, "float")) use_float = true;
+			else if (!strcmp(s, "double")) use_float = false;
+			else {
+				log_error("Unrecognized precision: %s", s);
+				return -1;
+			}
+			log_trace("precision = %s", s);
+		} else if (!strcmp(key, "thread_count")) {
+			data->thread_count = json_object_get_uint64(val);
+			if (data->thread_count == 0) {
+				log_warn("thread_count must be at least 1");
+				data->thread_count = 1;
+			}
+			log_trace("thread_count = %zu", data->thread_count);
+		} else if (!strcmp(key, "sparse")) {
+			if (json_object_is_type(val, json_type_string)) {
+				const char *s = json_object_get_string(val);
+				if (strcmp(s, "auto")) {
+					log_error("Unrecognized sparse: %s", s);
+					return -1;
+				}
+				sparse = MATMUL_SPARSE_AUTO;
+			} else if (json_object_get_boolean(val)) {
+				sparse = MATMUL_SPARSE_ALWAYS;
+			} else {
+				sparse = MATMUL_SPARSE_NEVER;
+			}
+			log_trace("sparse = %d", sparse);
+		} else if (!strcmp(key, "rank")) {
+			rank = json_object_get_uint64(val);
+			log_trace("rank = %zu", rank);
+		} else if (!strcmp(key, "sparse_tolerance")) {
+			sparse_tolerance = json_object_get_double(val);
+			log_trace("sparse_tolerance = %G", sparse_tolerance);
 		} else {
 			log_warn("Unknown parameter \"%s\"", key);
 		}
 	}
 
+	err = load_matrix_param(&data->mat, &data->map, self->params);
+	if (err) return err;
+
 	// make sure we didn't miss any params
-	if (!data->mat) {
-		log_error(
-			"No matrix provided. Check filename and matrix params."
-		);
-		return -1;
-	}
 	if (self->type_in == AYLP_T_NONE) {
 		log_error("You must provide the type param.");
 		return -1;
@@ -168,6 +264,69 @@ int matmul_init(struct aylp_device *self)
 		pretty_matrix(data->mat);
 	}
 
+	// in batch mode, the frames come in as the columns of a matrix, so the
+	// matrix-vector products become one matrix-matrix product
+	if (self->batch > 1 && self->type_in == AYLP_T_VECTOR) {
+		log_debug("Multiplying %zu frames at a time", self->batch);
+		self->type_in = AYLP_T_MATRIX;
+	}
+
+	// Decide whether to go sparse. Only matrix-vector products have a
+	// sparse kernel, and its gathers take 32-bit signed column indices.
+	bool is_vec = self->type_in == AYLP_T_VECTOR;
+	if (rank && !is_vec) {
+		log_warn("rank is only supported for type vector");
+		rank = 0;
+	} else if (rank && sparse != MATMUL_SPARSE_NEVER) {
+		log_error("rank and sparse can't be used together");
+		return -1;
+	} else if (rank) {
+		err = factor_low_rank(data, rank);
+		if (err) return err;
+		// we won't need the full matrix
+		if (data->map.addr) unload_matrix_map(&data->mat, &data->map);
+		else xfree_type(gsl_matrix, data->mat);
+	}
+	if (sparse != MATMUL_SPARSE_NEVER && !is_vec) {
+		log_warn("Sparse matrices are only supported for type vector");
+	} else if (sparse != MATMUL_SPARSE_NEVER
+	&& data->mat->size2 > INT32_MAX) {
+		log_warn("Matrix is too wide to store sparsely");
+	} else if (sparse != MATMUL_SPARSE_NEVER) {
+		size_t nnz = count_nonzeros(data->mat, sparse_tolerance);
+		double density = nnz / (double)(
+			data->mat->size1 * data->mat->size2
+		);
+		log_info("Matrix has %zu nonzeros (%.3G%%)",
+			nnz, density * 100
+		);
+		if (sparse == MATMUL_SPARSE_ALWAYS
+		|| density <= MATMUL_SPARSE_AUTO_DENSITY) {
+			data->csr = csr_from_dense(data->mat, nnz,
+				sparse_tolerance, use_float
+			);
+			// we won't need the dense copy
+			if (data->map.addr)
+				unload_matrix_map(&data->mat, &data->map);
+			else xfree_type(gsl_matrix, data->mat);
+		}
+	}
+
+	// convert to single precision once, here, instead of every proc
+	if (use_float && data->lr_u) {
+		data->lr_u_f = matrix_to_float(data->lr_u);
+		data->lr_sv_f = matrix_to_float(data->lr_sv);
+	} else if (use_float && !data->csr) {
+		data->mat_f = matrix_to_float(data->mat);
+		// we won't need the double precision copy
+		if (data->map.addr) unload_matrix_map(&data->mat, &data->map);
+		else xfree_type(gsl_matrix, data->mat);
+	}
+	if (use_float && self->type_in == AYLP_T_MATRIX)
+		self->type_in = AYLP_T_MATRIX_FLOAT;
+	else if (use_float && self->type_in == AYLP_T_VECTOR)
+		self->type_in = AYLP_T_VECTOR_FLOAT;
+
 	switch (self->type_in) {
 	case AYLP_T_MATRIX:
 		self->proc = &matmul_proc_mm;
@@ -175,34 +334,164 @@ int matmul_init(struct aylp_device *self)
 	case AYLP_T_VECTOR:
 		self->proc = &matmul_proc_mv;
 		break;
+	case AYLP_T_MATRIX_FLOAT:
+		self->proc = &matmul_proc_mm_float;
+		break;
+	case AYLP_T_VECTOR_FLOAT:
+		self->proc = &matmul_proc_mv_float;
+		break;
 	default:
 		log_error("BUG: self->type_in is wrong");
 		return -1;
 	}
+	self->shape = &matmul_shape;
 	self->fini = &matmul_fini;
 
+	if (data->lr_u) {
+		// the thin products are left to BLAS, unthreaded
+		self->proc = use_float ? &matmul_proc_mv_low_rank_float
+			: &matmul_proc_mv_low_rank;
+		is_vec = false;
+	}
+
+	// matrix-vector products can be split up by rows between threads
+	if (is_vec) {
+		err = pool_for_device(self, data->thread_count, &data->pool,
+			&data->own_pool
+		);
+		if (err) return err;
+	}
+	if (data->csr) {
+		// bands with equal numbers of nonzeros, rather than of rows
+		const char *kernel_name;
+		if (use_float) {
+			data->sspmv = sspmv_kernel_select(&kernel_name);
+			self->proc = &matmul_proc_mv_sparse_float;
+		} else {
+			data->spmv = spmv_kernel_select(&kernel_name);
+			self->proc = &matmul_proc_mv_sparse;
+		}
+		data->n_bands = data->pool ? MATMUL_TASKS_PER_THREAD
+			* (data->pool->n_threads + 1) : 1;
+		data->bands = xmalloc((data->n_bands + 1) * sizeof(size_t));
+		size_t row = 0;
+		for (size_t b = 0; b < data->n_bands; b++) {
+			size_t target = data->csr->nnz * b / data->n_bands;
+			while (data->csr->row_ptr[row] < target) row++;
+			data->bands[b] = row;
+		}
+		data->bands[data->n_bands] = data->csr->size1;
+		log_debug("Using %s kernel, %zu bands", kernel_name,
+			data->n_bands
+		);
+	} else if (data->pool) {
+		const char *kernel_name;
+		if (use_float) {
+			data->sgemv = sgemv_kernel_select(&kernel_name);
+			self->proc = &matmul_proc_mv_float_threaded;
+		} else {
+			data->gemv = gemv_kernel_select(&kernel_name);
+			self->proc = &matmul_proc_mv_threaded;
+		}
+		size_t rows = use_float ? data->mat_f->size1 : data->mat->size1;
+		size_t n_bands = MATMUL_TASKS_PER_THREAD
+			* (data->pool->n_threads + 1);
+		data->chunk = (rows + n_bands - 1) / n_bands;
+		data->chunk = (data->chunk + MATMUL_ROW_ALIGN - 1)
+			/ MATMUL_ROW_ALIGN * MATMUL_ROW_ALIGN;
+		log_debug("Using %s kernel, %zu rows per task on %zu threads",
+			kernel_name, data->chunk, data->pool->n_threads + 1
+		);
+	}
+
 	// set types and units
 	self->units_in = AYLP_U_ANY;
 	self->type_out = AYLP_T_UNCHANGED;
 	self->units_out = AYLP_U_UNCHANGED;
+	self->scratch_out = true;
 
 	return 0;
 }
 
 
+int matmul_shape(struct aylp_device *self, struct aylp_shape *shape)
+{
+	struct aylp_matmul_data *data = self->device_data;
+	// by now the matrix may only be around as its factors, sparsely, or in
+	// single precision
+	size_t rows, cols;
+	if (data->lr_u) {
+		rows = data->lr_u->size1;
+		cols = data->lr_sv->size2;
+	} else if (data->csr) {
+		rows = data->csr->size1;
+		cols = data->csr->size2;
+	} else if (data->mat_f) {
+		rows = data->mat_f->size1;
+		cols = data->mat_f->size2;
+	} else {
+		rows = data->mat->size1;
+		cols = data->mat->size2;
+	}
+	bool is_vec = self->type_in & (AYLP_T_VECTOR|AYLP_T_VECTOR_FLOAT);
+	size_t len = is_vec ? shape->y * shape->x : shape->y;
+	if (shape->y && len != cols) {
+		log_error("Input of shape %zux%zu doesn't fit a matrix with "
+			"%zu columns", shape->y, shape->x, cols
+		);
+		return -1;
+	}
+
+	switch (self->type_in) {
+	case AYLP_T_VECTOR:
+		data->vec_res = xmalloc_aligned_type(gsl_vector, rows);
+		if (data->lr_u)
+			data->lr_tmp = xmalloc_aligned_type(gsl_vector,
+				data->lr_u->size2
+			);
+		break;
+	case AYLP_T_VECTOR_FLOAT:
+		data->vec_res_f = xmalloc_aligned_type(gsl_vector_float, rows);
+		if (data->lr_u_f) data->lr_tmp_f = xmalloc_aligned_type(
+			gsl_vector_float, data->lr_u_f->size2
+		);
+		break;
+	case AYLP_T_MATRIX:
+		// the result is as wide as the input, which we may not know
+		if (shape->x) data->mat_res = xmalloc_aligned_type(
+			gsl_matrix, rows, shape->x
+		);
+		break;
+	case AYLP_T_MATRIX_FLOAT:
+		if (shape->x) data->mat_res_f = xmalloc_aligned_type(
+			gsl_matrix_float, rows, shape->x
+		);
+		break;
+	}
+
+	if (is_vec) {
+		shape->y = rows;
+		shape->x = 1;
+	} else if (shape->x) {
+		shape->y = rows;
+	}
+	return 0;
+}
+
+
 int matmul_proc_mm(struct aylp_device *self, struct aylp_state *state)
 {
 	struct aylp_matmul_data *data = self->device_data;
 
 	if (UNLIKELY(!data->mat_res)) {
 		// we have nowhere to put the result; let's allocate it
-		data->mat_res = gsl_matrix_alloc(
+		data->mat_res = xmalloc_aligned_type(gsl_matrix,
 			data->mat->size1, state->matrix->size2
 		);
 	} else if (UNLIKELY(data->mat_res->size2 != state->matrix->size2)) {
 		// somehow the state matrix changed width >:(
-		xfree_type(gsl_matrix, data->mat_res);
-		data->mat_res = gsl_matrix_alloc(
+		xfree_aligned_type(gsl_matrix, data->mat_res);
+		data->mat_res = xmalloc_aligned_type(gsl_matrix,
 			data->mat->size1, state->matrix->size2
 		);
 	}
@@ -238,7 +527,9 @@ int matmul_proc_mv(struct aylp_device *self, struct aylp_state *state)
 
 	if (UNLIKELY(!data->vec_res)) {
 		// we have nowhere to put the result; let's allocate it
-		data->vec_res = gsl_vector_alloc(data->mat->size1);
+		data->vec_res = xmalloc_aligned_type(gsl_vector,
+			data->mat->size1
+		);
 	}
 
 	// y = αAx + βy
@@ -265,16 +556,350 @@ int matmul_proc_mv(struct aylp_device *self, struct aylp_state *state)
 }
 
 
+// worker for the threaded procs: rows [start, end) of the product
+static void mv_rows(void *ctx, size_t start, size_t end)
+{
+	struct aylp_matmul_data *data = ctx;
+	size_t tda = data->mat->tda;
+	data->gemv(data->mat->data + start*tda, tda, end - start,
+		data->mat->size2, data->x, data->vec_res->data + start
+	);
+}
+
+
+static void mv_rows_float(void *ctx, size_t start, size_t end)
+{
+	struct aylp_matmul_data *data = ctx;
+	size_t tda = data->mat_f->tda;
+	data->sgemv(data->mat_f->data + start*tda, tda, end - start,
+		data->mat_f->size2, data->x, data->vec_res_f->data + start
+	);
+}
+
+
+int matmul_proc_mv_threaded(struct aylp_device *self, struct aylp_state *state)
+{
+	struct aylp_matmul_data *data = self->device_data;
+	gsl_vector *x = state->vector;
+
+	// the kernels need a contiguous input; strided views are left to gsl
+	if (UNLIKELY(x->stride != 1)) return matmul_proc_mv(self, state);
+	if (UNLIKELY(x->size != data->mat->size2)) {
+		log_error("Input vector has size %zu, but matrix has "
+			"%zu columns", x->size, data->mat->size2
+		);
+		return -1;
+	}
+	if (UNLIKELY(!data->vec_res)) {
+		// we have nowhere to put the result; let's allocate it
+		data->vec_res = xmalloc_aligned_type(gsl_vector,
+			data->mat->size1
+		);
+	}
+
+	data->x = x->data;
+	aylp_parallel_for(data->pool, data->mat->size1, data->chunk,
+		mv_rows, data
+	);
+
+	// update pipeline state
+	state->vector = data->vec_res;
+	// housekeeping on the header
+	state->header.log_dim.y = data->vec_res->size;
+	state->header.log_dim.x = 1;
+
+	return 0;
+}
+
+
+int matmul_proc_mv_float_threaded(
+	struct aylp_device *self, struct aylp_state *state
+){
+	struct aylp_matmul_data *data = self->device_data;
+	gsl_vector_float *x = state->vector_float;
+
+	// the kernels need a contiguous input; strided views are left to gsl
+	if (UNLIKELY(x->stride != 1)) return matmul_proc_mv_float(self, state);
+	if (UNLIKELY(x->size != data->mat_f->size2)) {
+		log_error("Input vector has size %zu, but matrix has "
+			"%zu columns", x->size, data->mat_f->size2
+		);
+		return -1;
+	}
+	if (UNLIKELY(!data->vec_res_f)) {
+		// we have nowhere to put the result; let's allocate it
+		data->vec_res_f = xmalloc_aligned_type(gsl_vector_float,
+			data->mat_f->size1
+		);
+	}
+
+	data->x = x->data;
+	aylp_parallel_for(data->pool, data->mat_f->size1, data->chunk,
+		mv_rows_float, data
+	);
+
+	// update pipeline state
+	state->vector_float = data->vec_res_f;
+	// housekeeping on the header
+	state->header.log_dim.y = data->vec_res_f->size;
+	state->header.log_dim.x = 1;
+
+	return 0;
+}
+
+
+// worker for the sparse procs: bands [start, end) of the product
+static void spmv_bands(void *ctx, size_t start, size_t end)
+{
+	struct aylp_matmul_data *data = ctx;
+	for (size_t b = start; b < end; b++) {
+		data->spmv(data->csr, data->bands[b], data->bands[b+1],
+			data->x, data->vec_res->data
+		);
+	}
+}
+
+
+static void spmv_bands_float(void *ctx, size_t start, size_t end)
+{
+	struct aylp_matmul_data *data = ctx;
+	for (size_t b = start; b < end; b++) {
+		data->sspmv(data->csr, data->bands[b], data->bands[b+1],
+			data->x, data->vec_res_f->data
+		);
+	}
+}
+
+
+int matmul_proc_mv_sparse(struct aylp_device *self, struct aylp_state *state)
+{
+	struct aylp_matmul_data *data = self->device_data;
+	gsl_vector *x = state->vector;
+
+	if (UNLIKELY(x->size != data->csr->size2 || x->stride != 1)) {
+		log_error("Input vector has size %zu and stride %zu, but "
+			"sparse matrix needs size %zu and stride 1",
+			x->size, x->stride, data->csr->size2
+		);
+		return -1;
+	}
+	if (UNLIKELY(!data->vec_res)) {
+		// we have nowhere to put the result; let's allocate it
+		data->vec_res = xmalloc_aligned_type(gsl_vector,
+			data->csr->size1
+		);
+	}
+
+	data->x = x->data;
+	aylp_parallel_for(data->pool, data->n_bands, 1, spmv_bands, data);
+
+	// update pipeline state
+	state->vector = data->vec_res;
+	// housekeeping on the header
+	state->header.log_dim.y = data->vec_res->size;
+	state->header.log_dim.x = 1;
+
+	return 0;
+}
+
+
+int matmul_proc_mv_sparse_float(
+	struct aylp_device *self, struct aylp_state *state
+){
+	struct aylp_matmul_data *data = self->device_data;
+	gsl_vector_float *x = state->vector_float;
+
+	if (UNLIKELY(x->size != data->csr->size2 || x->stride != 1)) {
+		log_error("Input vector has size %zu and stride %zu, but "
+			"sparse matrix needs size %zu and stride 1",
+			x->size, x->stride, data->csr->size2
+		);
+		return -1;
+	}
+	if (UNLIKELY(!data->vec_res_f)) {
+		// we have nowhere to put the result; let's allocate it
+		data->vec_res_f = xmalloc_aligned_type(gsl_vector_float,
+			data->csr->size1
+		);
+	}
+
+	data->x = x->data;
+	aylp_parallel_for(data->pool, data->n_bands, 1,
+		spmv_bands_float, data
+	);
+
+	// update pipeline state
+	state->vector_float = data->vec_res_f;
+	// housekeeping on the header
+	state->header.log_dim.y = data->vec_res_f->size;
+	state->header.log_dim.x = 1;
+
+	return 0;
+}
+
+
+int matmul_proc_mv_low_rank(struct aylp_device *self, struct aylp_state *state)
+{
+	struct aylp_matmul_data *data = self->device_data;
+
+	if (UNLIKELY(!data->vec_res)) {
+		// we have nowhere to put the results; let's allocate them
+		data->vec_res = xmalloc_aligned_type(gsl_vector,
+			data->lr_u->size1
+		);
+		data->lr_tmp = xmalloc_aligned_type(gsl_vector,
+			data->lr_u->size2
+		);
+	}
+
+	// t = (S V^T) x, then y = U t
+	int err = gsl_blas_dgemv(CblasNoTrans,
+		1.0, data->lr_sv, state->vector, 0.0, data->lr_tmp
+	);
+	if (!err) err = gsl_blas_dgemv(CblasNoTrans,
+		1.0, data->lr_u, data->lr_tmp, 0.0, data->vec_res
+	);
+	if (err) {
+		log_error("Error during dgemv: %s", gsl_strerror(err));
+		return -1;
+	}
+
+	// update pipeline state
+	state->vector = data->vec_res;
+	// housekeeping on the header
+	state->header.log_dim.y = data->vec_res->size;
+	state->header.log_dim.x = 1;
+
+	return 0;
+}
+
+
+int matmul_proc_mv_low_rank_float(
+	struct aylp_device *self, struct aylp_state *state
+){
+	struct aylp_matmul_data *data = self->device_data;
+
+	if (UNLIKELY(!data->vec_res_f)) {
+		// we have nowhere to put the results; let's allocate them
+		data->vec_res_f = xmalloc_aligned_type(gsl_vector_float,
+			data->lr_u_f->size1
+		);
+		data->lr_tmp_f = xmalloc_aligned_type(gsl_vector_float,
+			data->lr_u_f->size2
+		);
+	}
+
+	// t = (S V^T) x, then y = U t
+	int err = gsl_blas_sgemv(CblasNoTrans,
+		1.0f, data->lr_sv_f, state->vector_float, 0.0f, data->lr_tmp_f
+	);
+	if (!err) err = gsl_blas_sgemv(CblasNoTrans,
+		1.0f, data->lr_u_f, data->lr_tmp_f, 0.0f, data->vec_res_f
+	);
+	if (err) {
+		log_error("Error during sgemv: %s", gsl_strerror(err));
+		return -1;
+	}
+
+	// update pipeline state
+	state->vector_float = data->vec_res_f;
+	// housekeeping on the header
+	state->header.log_dim.y = data->vec_res_f->size;
+	state->header.log_dim.x = 1;
+
+	return 0;
+}
+
+
+int matmul_proc_mm_float(struct aylp_device *self, struct aylp_state *state)
+{
+	struct aylp_matmul_data *data = self->device_data;
+
+	if (UNLIKELY(!data->mat_res_f
+	|| data->mat_res_f->size2 != state->matrix_float->size2)) {
+		if (data->mat_res_f)
+			xfree_aligned_type(gsl_matrix_float, data->mat_res_f);
+		data->mat_res_f = xmalloc_aligned_type(gsl_matrix_float,
+			data->mat_f->size1, state->matrix_float->size2
+		);
+	}
+
+	// C = αAB + βC
+	int err = gsl_blas_sgemm(CblasNoTrans, CblasNoTrans,
+		1.0f, data->mat_f, state->matrix_float, 0.0f, data->mat_res_f
+	);
+	if (err) {
+		log_error("Error during sgemm: %s", gsl_strerror(err));
+		return -1;
+	}
+
+	// update pipeline state
+	state->matrix_float = data->mat_res_f;
+	// housekeeping on the header
+	state->header.log_dim.y = data->mat_res_f->size1;
+	state->header.log_dim.x = data->mat_res_f->size2;
+
+	return 0;
+}
+
+
+int matmul_proc_mv_float(struct aylp_device *self, struct aylp_state *state)
+{
+	struct aylp_matmul_data *data = self->device_data;
+
+	if (UNLIKELY(!data->vec_res_f)) {
+		// we have nowhere to put the result; let's allocate it
+		data->vec_res_f = xmalloc_aligned_type(gsl_vector_float,
+			data->mat_f->size1
+		);
+	}
+
+	// y = αAx + βy
+	int err = gsl_blas_sgemv(CblasNoTrans,
+		1.0f, data->mat_f, state->vector_float, 0.0f, data->vec_res_f
+	);
+	if (err) {
+		log_error("Error during sgemv: %s", gsl_strerror(err));
+		return -1;
+	}
+
+	// update pipeline state
+	state->vector_float = data->vec_res_f;
+	// housekeeping on the header
+	state->header.log_dim.y = data->vec_res_f->size;
+	state->header.log_dim.x = 1;
+
+	return 0;
+}
+
+
 int matmul_fini(struct aylp_device *self)
 {
 	struct aylp_matmul_data *data = self->device_data;
-	xfree_type(gsl_matrix, data->mat);
+	pool_release(&data->own_pool);
+	if (data->map.addr) unload_matrix_map(&data->mat, &data->map);
+	else xfree_type(gsl_matrix, data->mat);
+	xfree_type(gsl_matrix_float, data->mat_f);
+	if (data->csr) csr_free(data->csr);
+	xfree_type(gsl_matrix, data->lr_u);
+	xfree_type(gsl_matrix, data->lr_sv);
+	xfree_aligned_type(gsl_vector, data->lr_tmp);
+	xfree_type(gsl_matrix_float, data->lr_u_f);
+	xfree_type(gsl_matrix_float, data->lr_sv_f);
+	xfree_aligned_type(gsl_vector_float, data->lr_tmp_f);
+	xfree(data->bands);
 	switch (self->type_in) {
 	case AYLP_T_MATRIX:
-		xfree_type(gsl_matrix, data->mat_res);
+		xfree_aligned_type(gsl_matrix, data->mat_res);
 		break;
 	case AYLP_T_VECTOR:
-		xfree_type(gsl_vector, data->vec_res);
+		xfree_aligned_type(gsl_vector, data->vec_res);
+		break;
+	case AYLP_T_MATRIX_FLOAT:
+		xfree_aligned_type(gsl_matrix_float, data->mat_res_f);
+		break;
+	case AYLP_T_VECTOR_FLOAT:
+		xfree_aligned_type(gsl_vector_float, data->vec_res_f);
 		break;
 	default:
 		break;
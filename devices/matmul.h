@@ -4,26 +4,106 @@
 #include "anyloop.h"
 #include <gsl/gsl_matrix.h>
 #include <gsl/gsl_vector.h>
+#include "load.h"
+#include "matmul_kernels.h"
+
+// Row bands per thread (counting the loop thread) when multithreaded. Rows all
+// cost the same, so this only needs to be enough to absorb a late thread.
+#define MATMUL_TASKS_PER_THREAD 2
+
+// Bands are a multiple of this many rows, so that no two of them write to the
+// same cache line of the result.
+#define MATMUL_ROW_ALIGN 16
 
 struct aylp_matmul_data {
-	// the matrix we multiply by
+	// the matrix we multiply by (null once it has been converted to mat_f,
+	// csr, or the low-rank factors)
 	gsl_matrix *mat;
+	// memory mapping behind mat, if param load is "mmap" or "hugepage"
+	struct load_map map;
+	// single-precision version of mat, if param precision is "float"
+	gsl_matrix_float *mat_f;
+	// sparse copy of mat (which is then freed), if param sparse says so
+	struct csr_matrix *csr;
+	// truncated SVD factors of mat (which is then freed), if param rank is
+	// set: mat is approximately lr_u lr_sv, with lr_tmp for the product in
+	// between, and single-precision versions of each
+	gsl_matrix *lr_u;
+	gsl_matrix *lr_sv;
+	gsl_vector *lr_tmp;
+	gsl_matrix_float *lr_u_f;
+	gsl_matrix_float *lr_sv_f;
+	gsl_vector_float *lr_tmp_f;
+	// rows at which each of the n_bands sparse tasks start, and then the
+	// number of rows
+	size_t *bands;
+	size_t n_bands;
 	// the result
 	union {
 		gsl_matrix *mat_res;
 		gsl_vector *vec_res;
+		gsl_matrix_float *mat_res_f;
+		gsl_vector_float *vec_res_f;
 	};
+	// param; set above 1 for a private pool instead of the shared one
+	size_t thread_count;
+	// pool we hand rows to (the shared one, or own_pool)
+	struct aylp_pool *pool;
+	// pool of thread_count-1 workers, if thread_count > 1
+	struct aylp_pool *own_pool;
+	// rows of the matrix per task
+	size_t chunk;
+	// row kernels, picked for this CPU
+	gemv_kernel gemv;
+	sgemv_kernel sgemv;
+	spmv_kernel spmv;
+	sspmv_kernel sspmv;
+	// input vector data for the current proc, for the workers to read
+	const void *x;
 };
 
 // initialize matmul device
 int matmul_init(struct aylp_device *self);
 
+// allocate the result for the shape of matmul input
+int matmul_shape(struct aylp_device *self, struct aylp_shape *shape);
+
 // matrix-matrix product
 int matmul_proc_mm(struct aylp_device *self, struct aylp_state *state);
 
 // matrix-vector product
 int matmul_proc_mv(struct aylp_device *self, struct aylp_state *state);
 
+// matrix-vector product, with the rows split between threads
+int matmul_proc_mv_threaded(struct aylp_device *self, struct aylp_state *state);
+
+// sparse matrix-vector product
+int matmul_proc_mv_sparse(struct aylp_device *self, struct aylp_state *state);
+
+// matrix-vector product through truncated SVD factors
+int matmul_proc_mv_low_rank(struct aylp_device *self, struct aylp_state *state);
+
+// single-precision matrix-matrix product
+int matmul_proc_mm_float(struct aylp_device *self, struct aylp_state *state);
+
+// single-precision matrix-vector product
+int matmul_proc_mv_float(struct aylp_device *self, struct aylp_state *state);
+
+// single-precision matrix-vector product, with the rows split between threads
+int matmul_proc_mv_float_threaded(
+	struct aylp_device *self, struct aylp_state *state
+);
+
+// single-precision sparse matrix-vector product
+int matmul_proc_mv_sparse_float(
+	struct aylp_device *self, struct aylp_state *state
+);
+
+// single-precision matrix-vector product through truncated SVD factors
+int matmul_proc_mv_low_rank_float(
+	struct aylp_device *self, struct aylp_state *state
+);
+
 // close matmul device when loop exits
 int matmul_fini(struct aylp_device *self);
 
@@ -0,0 +1,353 @@
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GEMV_X86 1
+#endif
+
+#include "cpu.h"
+#include "matmul_kernels.h"
+
+// Width of the column tiles, in bytes of x. Half of a typical L1 data cache,
+// so that the tile of x stays put while rows of the matrix stream past it.
+#define GEMV_TILE_BYTES 16384
+
+// Rows are done four at a time, so that each element of x loaded is used four
+// times, and the four sums give the cpu independent chains to overlap.
+#define GEMV_ROWS 4
+
+
+// Plain C kernels. Without -ffast-math the compiler won't reorder the sums to
+// vectorize them, but they still get the tiling and row blocking.
+#define DEFINE_SCALAR(name, T) \
+static void name(const T *a, size_t tda, size_t rows, size_t cols, \
+	const T *x, T *y \
+){ \
+	const size_t tile = GEMV_TILE_BYTES / sizeof(T); \
+	memset(y, 0, rows * sizeof(T)); \
+	for (size_t j0 = 0; j0 < cols; j0 += tile) { \
+		size_t j1 = j0 + tile < cols ? j0 + tile : cols; \
+		size_t i = 0; \
+		for (; i + GEMV_ROWS <= rows; i += GEMV_ROWS) { \
+			const T *a0 = a + i*tda, *a1 = a0 + tda; \
+			const T *a2 = a1 + tda, *a3 = a2 + tda; \
+			T s0 = 0, s1 = 0, s2 = 0, s3 = 0; \
+			for (size_t j = j0; j < j1; j++) { \
+				T xj = x[j]; \
+				s0 += a0[j] * xj; \
+				s1 += a1[j] * xj; \
+				s2 += a2[j] * xj; \
+				s3 += a3[j] * xj; \
+			} \
+			y[i] += s0; \
+			y[i+1] += s1; \
+			y[i+2] += s2; \
+			y[i+3] += s3; \
+		} \
+		for (; i < rows; i++) { \
+			const T *a0 = a + i*tda; \
+			T s0 = 0; \
+			for (size_t j = j0; j < j1; j++) s0 += a0[j] * x[j]; \
+			y[i] += s0; \
+		} \
+	} \
+}
+DEFINE_SCALAR(gemv_scalar, double)
+DEFINE_SCALAR(sgemv_scalar, float)
+#undef DEFINE_SCALAR
+
+
+#define DEFINE_SPMV_SCALAR(name, T, v) \
+static void name(const struct csr_matrix *m, size_t start, size_t end, \
+	const T *x, T *y \
+){ \
+	for (size_t i = start; i < end; i++) { \
+		T s = 0; \
+		for (size_t k = m->row_ptr[i]; k < m->row_ptr[i+1]; k++) \
+			s += m->v[k] * x[m->col[k]]; \
+		y[i] = s; \
+	} \
+}
+DEFINE_SPMV_SCALAR(spmv_scalar, double, val)
+DEFINE_SPMV_SCALAR(sspmv_scalar, float, val_f)
+#undef DEFINE_SPMV_SCALAR
+
+
+#ifdef GEMV_X86
+
+// the four sums of the lanes of s0..s3, in that order
+__attribute__((target("avx2,fma")))
+static inline __m256d hsum4_pd(__m256d s0, __m256d s1, __m256d s2, __m256d s3)
+{
+	__m256d t0 = _mm256_hadd_pd(s0, s1);
+	__m256d t1 = _mm256_hadd_pd(s2, s3);
+	return _mm256_add_pd(
+		_mm256_permute2f128_pd(t0, t1, 0x20),
+		_mm256_permute2f128_pd(t0, t1, 0x31)
+	);
+}
+
+
+__attribute__((target("avx2,fma")))
+static inline double hsum_pd(__m256d s)
+{
+	__m128d v = _mm_add_pd(
+		_mm256_castpd256_pd128(s), _mm256_extractf128_pd(s, 1)
+	);
+	return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v)));
+}
+
+
+__attribute__((target("avx2,fma")))
+static void gemv_avx2(const double *a, size_t tda, size_t rows, size_t cols,
+	const double *x, double *y
+){
+	const size_t tile = GEMV_TILE_BYTES / sizeof(double);
+	memset(y, 0, rows * sizeof(double));
+	for (size_t j0 = 0; j0 < cols; j0 += tile) {
+		size_t j1 = j0 + tile < cols ? j0 + tile : cols;
+		size_t i = 0;
+		for (; i + GEMV_ROWS <= rows; i += GEMV_ROWS) {
+			const double *a0 = a + i*tda, *a1 = a0 + tda;
+			const double *a2 = a1 + tda, *a3 = a2 + tda;
+			__m256d s0 = _mm256_setzero_pd(), s1 = s0, s2 = s0;
+			__m256d s3 = s0;
+			size_t j = j0;
+			for (; j + 4 <= j1; j += 4) {
+				__m256d xv = _mm256_loadu_pd(x + j);
+				s0 = _mm256_fmadd_pd(
+					_mm256_loadu_pd(a0 + j), xv, s0
+				);
+				s1 = _mm256_fmadd_pd(
+					_mm256_loadu_pd(a1 + j), xv, s1
+				);
+				s2 = _mm256_fmadd_pd(
+					_mm256_loadu_pd(a2 + j), xv, s2
+				);
+				s3 = _mm256_fmadd_pd(
+					_mm256_loadu_pd(a3 + j), xv, s3
+				);
+			}
+			double s[4];
+			_mm256_storeu_pd(s, hsum4_pd(s0, s1, s2, s3));
+			for (; j < j1; j++) {
+				s[0] += a0[j] * x[j];
+				s[1] += a1[j] * x[j];
+				s[2] += a2[j] * x[j];
+				s[3] += a3[j] * x[j];
+			}
+			y[i] += s[0];
+			y[i+1] += s[1];
+			y[i+2] += s[2];
+			y[i+3] += s[3];
+		}
+		for (; i < rows; i++) {
+			const double *a0 = a + i*tda;
+			__m256d s0 = _mm256_setzero_pd();
+			size_t j = j0;
+			for (; j + 4 <= j1; j += 4) {
+				s0 = _mm256_fmadd_pd(_mm256_loadu_pd(a0 + j),
+					_mm256_loadu_pd(x + j), s0
+				);
+			}
+			double s = hsum_pd(s0);
+			for (; j < j1; j++) s += a0[j] * x[j];
+			y[i] += s;
+		}
+	}
+}
+
+
+// the four sums of the lanes of s0..s3, in that order
+__attribute__((target("avx2,fma")))
+static inline __m128 hsum4_ps(__m256 s0, __m256 s1, __m256 s2, __m256 s3)
+{
+	__m256 t = _mm256_hadd_ps(
+		_mm256_hadd_ps(s0, s1), _mm256_hadd_ps(s2, s3)
+	);
+	return _mm_add_ps(
+		_mm256_castps256_ps128(t), _mm256_extractf128_ps(t, 1)
+	);
+}
+
+
+__attribute__((target("avx2,fma")))
+static inline float hsum_ps(__m256 s)
+{
+	__m128 v = _mm_add_ps(
+		_mm256_castps256_ps128(s), _mm256_extractf128_ps(s, 1)
+	);
+	v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+	return _mm_cvtss_f32(_mm_add_ss(v, _mm_movehdup_ps(v)));
+}
+
+
+__attribute__((target("avx2,fma")))
+static void sgemv_avx2(const float *a, size_t tda, size_t rows, size_t cols,
+	const float *x, float *y
+){
+	const size_t tile = GEMV_TILE_BYTES / sizeof(float);
+	memset(y, 0, rows * sizeof(float));
+	for (size_t j0 = 0; j0 < cols; j0 += tile) {
+		size_t j1 = j0 + tile < cols ? j0 + tile : cols;
+		size_t i = 0;
+		for (; i + GEMV_ROWS <= rows; i += GEMV_ROWS) {
+			const float *a0 = a + i*tda, *a1 = a0 + tda;
+			const float *a2 = a1 + tda, *a3 = a2 + tda;
+			__m256 s0 = _mm256_setzero_ps(), s1 = s0, s2 = s0;
+			__m256 s3 = s0;
+			size_t j = j0;
+			for (; j + 8 <= j1; j += 8) {
+				__m256 xv = _mm256_loadu_ps(x + j);
+				s0 = _mm256_fmadd_ps(
+					_mm256_loadu_ps(a0 + j), xv, s0
+				);
+				s1 = _mm256_fmadd_ps(
+					_mm256_loadu_ps(a1 + j), xv, s1
+				);
+				s2 = _mm256_fmadd_ps(
+					_mm256_loadu_ps(a2 + j), xv, s2
+				);
+				s3 = _mm256_fmadd_ps(
+					_mm256_loadu_ps(a3 + j), xv, s3
+				);
+			}
+			float s[4];
+			_mm_storeu_ps(s, hsum4_ps(s0, s1, s2, s3));
+			for (; j < j1; j++) {
+				s[0] += a0[j] * x[j];
+				s[1] += a1[j] * x[j];
+				s[2] += a2[j] * x[j];
+				s[3] += a3[j] * x[j];
+			}
+			y[i] += s[0];
+			y[i+1] += s[1];
+			y[i+2] += s[2];
+			y[i+3] += s[3];
+		}
+		for (; i < rows; i++) {
+			const float *a0 = a + i*tda;
+			__m256 s0 = _mm256_setzero_ps();
+			size_t j = j0;
+			for (; j + 8 <= j1; j += 8) {
+				s0 = _mm256_fmadd_ps(_mm256_loadu_ps(a0 + j),
+					_mm256_loadu_ps(x + j), s0
+				);
+			}
+			float s = hsum_ps(s0);
+			for (; j < j1; j++) s += a0[j] * x[j];
+			y[i] += s;
+		}
+	}
+}
+
+
+// Gathers are slower than plain loads, but still beat doing the multiplies
+// one at a time once a row has a few nonzeros.
+__attribute__((target("avx2,fma")))
+static void spmv_avx2(const struct csr_matrix *m, size_t start, size_t end,
+	const double *x, double *y
+){
+	for (size_t i = start; i < end; i++) {
+		size_t k = m->row_ptr[i], k1 = m->row_ptr[i+1];
+		__m256d s0 = _mm256_setzero_pd();
+		for (; k + 4 <= k1; k += 4) {
+			__m128i idx = _mm_loadu_si128(
+				(const __m128i *)(m->col + k)
+			);
+			s0 = _mm256_fmadd_pd(_mm256_loadu_pd(m->val + k),
+				_mm256_i32gather_pd(x, idx, 8), s0
+			);
+		}
+		double s = hsum_pd(s0);
+		for (; k < k1; k++) s += m->val[k] * x[m->col[k]];
+		y[i] = s;
+	}
+}
+
+
+__attribute__((target("avx2,fma")))
+static void sspmv_avx2(const struct csr_matrix *m, size_t start, size_t end,
+	const float *x, float *y
+){
+	for (size_t i = start; i < end; i++) {
+		size_t k = m->row_ptr[i], k1 = m->row_ptr[i+1];
+		__m256 s0 = _mm256_setzero_ps();
+		for (; k + 8 <= k1; k += 8) {
+			__m256i idx = _mm256_loadu_si256(
+				(const __m256i *)(m->col + k)
+			);
+			s0 = _mm256_fmadd_ps(_mm256_loadu_ps(m->val_f + k),
+				_mm256_i32gather_ps(x, idx, 4), s0
+			);
+		}
+		float s = hsum_ps(s0);
+		for (; k < k1; k++) s += m->val_f[k] * x[m->col[k]];
+		y[i] = s;
+	}
+}
+
+#endif
+
+
+gemv_kernel gemv_kernel_select(const char **name)
+{
+	const char *dummy;
+	if (!name) name = &dummy;
+#ifdef GEMV_X86
+	if (cpu_has_avx2_fma()) {
+		*name = "avx2";
+		return gemv_avx2;
+	}
+#endif
+	*name = "scalar";
+	return gemv_scalar;
+}
+
+
+sgemv_kernel sgemv_kernel_select(const char **name)
+{
+	const char *dummy;
+	if (!name) name = &dummy;
+#ifdef GEMV_X86
+	if (cpu_has_avx2_fma()) {
+		*name = "avx2";
+		return sgemv_avx2;
+	}
+#endif
+	*name = "scalar";
+	return sgemv_scalar;
+}
+
+
+
+spmv_kernel spmv_kernel_select(const char **name)
+{
+	const char *dummy;
+	if (!name) name = &dummy;
+#ifdef GEMV_X86
+	if (cpu_has_avx2_fma()) {
+		*name = "avx2, sparse";
+		return spmv_avx2;
+	}
+#endif
+	*name = "scalar, sparse";
+	return spmv_scalar;
+}
+
+
+sspmv_kernel sspmv_kernel_select(const char **name)
+{
+	const char *dummy;
+	if (!name) name = &dummy;
+#ifdef GEMV_X86
+	if (cpu_has_avx2_fma()) {
+		*name = "avx2, sparse";
+		return sspmv_avx2;
+	}
+#endif
+	*name = "scalar, sparse";
+	return sspmv_scalar;
+}
+
@@ -0,0 +1,59 @@
+#ifndef AYLP_DEVICES_MATMUL_KERNELS_H_
+#define AYLP_DEVICES_MATMUL_KERNELS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Matrix-vector product kernel for a band of rows of a row-major matrix.
+* Sets y[i] to the dot product of row i of a (whose rows are `tda` elements
+* apart) with the first `cols` elements of x, for i in [0, rows). Both x and y
+* must be contiguous. Columns are walked in tiles that keep their part of x in
+* L1 cache while every row of the band goes past it. */
+typedef void (*gemv_kernel)(const double *a, size_t tda, size_t rows,
+	size_t cols, const double *x, double *y
+);
+
+/** Single-precision version of gemv_kernel. Sums are kept in floats. */
+typedef void (*sgemv_kernel)(const float *a, size_t tda, size_t rows,
+	size_t cols, const float *x, float *y
+);
+
+/** A sparse matrix in compressed sparse row (CSR) format. The nonzeros of row
+* i are at indices [row_ptr[i], row_ptr[i+1]) of col and val (or val_f, for
+* single precision, in which case val is null, and vice versa). */
+struct csr_matrix {
+	size_t size1;
+	size_t size2;
+	size_t nnz;
+	// size1+1 offsets into col and val
+	size_t *row_ptr;
+	// column of each nonzero; 32 bits, to halve the index traffic
+	uint32_t *col;
+	double *val;
+	float *val_f;
+};
+
+/** Sparse matrix-vector product kernel for a band of rows of a CSR matrix.
+* Sets y[i] to the dot product of row i of m with x, for i in [start, end). */
+typedef void (*spmv_kernel)(const struct csr_matrix *m, size_t start,
+	size_t end, const double *x, double *y
+);
+
+/** Single-precision version of spmv_kernel, which uses m->val_f. */
+typedef void (*sspmv_kernel)(const struct csr_matrix *m, size_t start,
+	size_t end, const float *x, float *y
+);
+
+/** Pick the fastest gemv kernel this CPU supports. Name is set to a short
+* description of the kernel (e.g. "avx2") if it is not null. */
+gemv_kernel gemv_kernel_select(const char **name);
+
+/** Pick the fastest sgemv kernel this CPU supports, as gemv_kernel_select. */
+sgemv_kernel sgemv_kernel_select(const char **name);
+
+/** Pick the fastest spmv and sspmv kernels, as gemv_kernel_select. */
+spmv_kernel spmv_kernel_select(const char **name);
+sspmv_kernel sspmv_kernel_select(const char **name);
+
+#endif
+
@@ -0,0 +1,214 @@
+#include <time.h>
+#include <gsl/gsl_matrix.h>
+#include <json-c/json.h>
+#include "anyloop.h"
+#include "load.h"
+#include "logging.h"
+#include "matmul.h"
+#include "matmul_pid.h"
+#include "pid.h"
+#include "thread_pool.h"
+#include "xalloc.h"
+
+// Rows are multiplied this many at a time, and then PID-controlled and clamped
+// right away, while their part of the result is still in L1 cache.
+#define MATMUL_PID_BLOCK_ROWS 64
+
+
+int matmul_pid_init(struct aylp_device *self)
+{
+	int err;
+	self->proc = &matmul_pid_proc;
+	self->shape = &matmul_pid_shape;
+	self->fini = &matmul_pid_fini;
+	self->device_data = xcalloc(1, sizeof(struct aylp_matmul_pid_data));
+	struct aylp_matmul_pid_data *data = self->device_data;
+
+	// set defaults
+	data->p = 1.0;
+	data->i = 0.0;
+	data->d = 0.0;
+	data->clamp = 1.0;
+	data->min = -1.0;
+	data->max = 1.0;
+	data->thread_count = 1;
+
+	// parse parameters
+	if (!self->params) {
+		log_error("No params object found.");
+		return -1;
+	}
+	json_object_object_foreach(self->params, key, val) {
+		if (key[0] == '_') {
+			// keys starting with _ are comments
+		} else if (!strcmp(key, "matrix") || !strcmp(key, "filename")
+			|| !strcmp(key, "load")) {
+			// read by load_matrix_param below
+		} else if (!strcmp(key, "units")) {
+			const char *s = json_object_get_string(val);
+			data->units = aylp_units_from_string(s);
+			log_trace("units = %s (0x%hhX)", s, data->units);
+		} else if (!strcmp(key, "p")) {
+			data->p = json_object_get_double(val);
+			log_trace("p = %G", data->p);
+		} else if (!strcmp(key, "i")) {
+			data->i = json_object_get_double(val);
+			log_trace("i = %G", data->i);
+		} else if (!strcmp(key, "d")) {
+			data->d = json_object_get_double(val);
+			log_trace("d = %G", data->d);
+		} else if (!strcmp(key, "clamp")) {
+			data->clamp = json_object_get_double(val);
+			if (data->clamp < 0)
+				data->clamp = -data->clamp;
+			log_trace("clamp = ±%G", data->clamp);
+		} else if (!strcmp(key, "min")) {
+			data->min = json_object_get_double(val);
+			log_trace("min = %G", data->min);
+		} else if (!strcmp(key, "max")) {
+			data->max = json_object_get_double(val);
+			log_trace("max = %G", data->max);
+		} else if (!strcmp(key, "fixed_dt")) {
+			data->fixed_dt = json_object_get_double(val);
+			log_trace("fixed_dt = %G s", data->fixed_dt);
+		} else if (!strcmp(key, "thread_count")) {
+			data->thread_count = json_object_get_uint64(val);
+			if (data->thread_count == 0) {
+				log_warn("thread_count must be at least 1");
+				data->thread_count = 1;
+			}
+			log_trace("thread_count = %zu", data->thread_count);
+		} else {
+			log_warn("Unknown parameter \"%s\"", key);
+		}
+	}
+
+	err = load_matrix_param(&data->mat, &data->map, self->params);
+	if (err) return err;
+	log_info("Read matrix of size %zux%zu",
+		data->mat->size1, data->mat->size2
+	);
+
+	data->cells = xcalloc(data->mat->size1, sizeof(struct matmul_pid_cell));
+	data->res = xmalloc_aligned_type(gsl_vector, data->mat->size1);
+
+	err = pool_for_device(self, data->thread_count, &data->pool,
+		&data->own_pool
+	);
+	if (err) return err;
+	const char *kernel_name;
+	data->gemv = gemv_kernel_select(&kernel_name);
+	size_t n_threads = data->pool ? data->pool->n_threads + 1 : 1;
+	size_t n_bands = MATMUL_TASKS_PER_THREAD * n_threads;
+	data->chunk = (data->mat->size1 + n_bands - 1) / n_bands;
+	data->chunk = (data->chunk + MATMUL_ROW_ALIGN - 1)
+		/ MATMUL_ROW_ALIGN * MATMUL_ROW_ALIGN;
+	log_debug("Using %s kernel, %zu rows per task on %zu threads",
+		kernel_name, data->chunk, n_threads
+	);
+
+	// the first frame's dt is measured from here
+	struct timespec tp;
+	err = clock_gettime(CLOCK_MONOTONIC, &tp);
+	if (err) {
+		log_error("Couldn't get time: %s", strerror(err));
+		return -1;
+	}
+	data->t_prev = (uint64_t)tp.tv_sec * 1000000000 + tp.tv_nsec;
+
+	// set types and units
+	self->type_in = AYLP_T_VECTOR;
+	self->units_in = AYLP_U_ANY;
+	self->type_out = AYLP_T_UNCHANGED;
+	self->units_out = data->units;
+	self->scratch_out = true;
+	return 0;
+}
+
+
+int matmul_pid_shape(struct aylp_device *self, struct aylp_shape *shape)
+{
+	struct aylp_matmul_pid_data *data = self->device_data;
+	if (shape->y && shape->y * shape->x != data->mat->size2) {
+		log_error("Input vector has size %zu, but matrix has %zu "
+			"columns", shape->y * shape->x, data->mat->size2
+		);
+		return -1;
+	}
+	// everything else was allocated in init
+	shape->y = data->mat->size1;
+	shape->x = 1;
+	return 0;
+}
+
+
+// rows [start, end) of the product, PID-controlled and clamped
+static void matmul_pid_rows(void *ctx, size_t start, size_t end)
+{
+	struct aylp_matmul_pid_data *data = ctx;
+	const gsl_matrix *m = data->mat;
+	double *y = data->res->data;
+	for (size_t r0 = start; r0 < end; r0 += MATMUL_PID_BLOCK_ROWS) {
+		size_t r1 = r0 + MATMUL_PID_BLOCK_ROWS < end ?
+			r0 + MATMUL_PID_BLOCK_ROWS : end;
+		data->gemv(m->data + r0*m->tda, m->tda, r1 - r0, m->size2,
+			data->x, y + r0
+		);
+		for (size_t r = r0; r < r1; r++) {
+			struct matmul_pid_cell *c = &data->cells[r];
+			double v = pid_step(data->p, data->i, data->d,
+				data->clamp, data->dt, y[r], &c->acc, &c->pre
+			);
+			if (v < data->min) v = data->min;
+			else if (data->max < v) v = data->max;
+			y[r] = v;
+		}
+	}
+}
+
+
+int matmul_pid_proc(struct aylp_device *self, struct aylp_state *state)
+{
+	struct aylp_matmul_pid_data *data = self->device_data;
+	gsl_vector *x = state->vector;
+
+	if (UNLIKELY(x->size != data->mat->size2 || x->stride != 1)) {
+		log_error("Input vector has size %zu and stride %zu, but "
+			"matrix needs size %zu and stride 1",
+			x->size, x->stride, data->mat->size2
+		);
+		return -1;
+	}
+
+	data->dt = pid_dt(data->fixed_dt, state->header.timestamp,
+		&data->t_prev
+	);
+	log_trace("dt = %G s", data->dt);
+
+	data->x = x->data;
+	aylp_parallel_for(data->pool, data->mat->size1, data->chunk,
+		matmul_pid_rows, data
+	);
+
+	// update pipeline state
+	state->vector = data->res;
+	// housekeeping on the header
+	state->header.log_dim.y = data->res->size;
+	state->header.log_dim.x = 1;
+
+	return 0;
+}
+
+
+int matmul_pid_fini(struct aylp_device *self)
+{
+	struct aylp_matmul_pid_data *data = self->device_data;
+	pool_release(&data->own_pool);
+	if (data->map.addr) unload_matrix_map(&data->mat, &data->map);
+	else xfree_type(gsl_matrix, data->mat);
+	xfree(data->cells);
+	xfree_aligned_type(gsl_vector, data->res);
+	xfree(data);
+	return 0;
+}
+
@@ -0,0 +1,67 @@
+#ifndef AYLP_DEVICES_MATMUL_PID_H_
+#define AYLP_DEVICES_MATMUL_PID_H_
+
+#include <gsl/gsl_matrix.h>
+#include <gsl/gsl_vector.h>
+#include "anyloop.h"
+#include "load.h"
+#include "matmul_kernels.h"
+
+// PID state for one output element. They are kept side by side, so that the
+// update only streams through one array of state.
+struct matmul_pid_cell {
+	// accumulated error
+	double acc;
+	// previous error
+	double pre;
+};
+
+struct aylp_matmul_pid_data {
+	// the matrix we multiply by
+	gsl_matrix *mat;
+	// memory mapping behind mat, if param load is "mmap" or "hugepage"
+	struct load_map map;
+	// PID state, one per row of mat
+	struct matmul_pid_cell *cells;
+	// the result
+	gsl_vector *res;
+	// units to output
+	aylp_units units;
+	// pid params, clamp for maximum correction (by i term and in total)
+	double p, i, d, clamp;
+	// limits of the output, as for the clamp device
+	double min, max;
+	// timestamp of the previous frame in ns, and time since it in seconds
+	// for the current proc
+	uint64_t t_prev;
+	double dt;
+	// param; if positive, used as dt instead of the timestamps
+	double fixed_dt;
+	// param; set above 1 for a private pool instead of the shared one
+	size_t thread_count;
+	// pool we hand rows to (the shared one, or own_pool)
+	struct aylp_pool *pool;
+	// pool of thread_count-1 workers, if thread_count > 1
+	struct aylp_pool *own_pool;
+	// rows of the matrix per task
+	size_t chunk;
+	// row kernel, picked for this CPU
+	gemv_kernel gemv;
+	// input vector data for the current proc, for the workers to read
+	const double *x;
+};
+
+// initialize matmul_pid device
+int matmul_pid_init(struct aylp_device *self);
+
+// check the shape of matmul_pid input, and declare its output
+int matmul_pid_shape(struct aylp_device *self, struct aylp_shape *shape);
+
+// process matmul_pid device once per loop
+int matmul_pid_proc(struct aylp_device *self, struct aylp_state *state);
+
+// close matmul_pid device when loop exits
+int matmul_pid_fini(struct aylp_device *self);
+
+#endif
+
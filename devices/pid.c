@@ -10,6 +10,7 @@ int pid_init(struct aylp_device *self)
 {
 	int err;
 	self->proc = &pid_proc;
+	self->shape = &pid_shape;
 	self->fini = &pid_fini;
 	self->device_data = xcalloc(1, sizeof(struct aylp_pid_data));
 	struct aylp_pid_data *data = self->device_data;
@@ -19,6 +20,7 @@ int pid_init(struct aylp_device *self)
 	data->i = 0.0;
 	data->d = 0.0;
 	data->clamp = 1.0;
+	data->thread_count = 1;
 
 	// parse parameters
 	if (!self->params) {
@@ -34,8 +36,12 @@ int pid_init(struct aylp_device *self)
 				data->type = AYLP_T_VECTOR;
 			else if (!strcmp(s, "matrix"))
 				data->type = AYLP_T_MATRIX;
+			else if (!strcmp(s, "vector_float"))
+				data->type = AYLP_T_VECTOR_FLOAT;
+			else if (!strcmp(s, "matrix_float"))
+				data->type = AYLP_T_MATRIX_FLOAT;
 			else log_error("Unrecognized type: %s", s);
-			log_trace("type = %s (0x%hhX)", s, data->type);
+			log_trace("type = %s (0x%hX)", s, data->type);
 		} else if (!strcmp(key, "units")) {
 			const char *s = json_object_get_string(val);
 			data->units = aylp_units_from_string(s);
@@ -54,6 +60,16 @@ int pid_init(struct aylp_device *self)
 			if (data->clamp < 0)
 				data->clamp = -data->clamp;
 			log_trace("clamp = ±%G", data->clamp);
+		} else if (!strcmp(key, "fixed_dt")) {
+			data->fixed_dt = json_object_get_double(val);
+			log_trace("fixed_dt = %G s", data->fixed_dt);
+		} else if (!strcmp(key, "thread_count")) {
+			data->thread_count = json_object_get_uint64(val);
+			if (data->thread_count == 0) {
+				log_warn("thread_count must be at least 1");
+				data->thread_count = 1;
+			}
+			log_trace("thread_count = %zu", data->thread_count);
 		} else {
 			log_warn("Unknown parameter \"%s\"", key);
 		}
@@ -64,50 +80,211 @@ int pid_init(struct aylp_device *self)
 		return -1;
 	}
 
+	// in batch mode, vectors come in as the columns of a matrix
+	if (self->batch > 1
+	&& data->type & (AYLP_T_VECTOR|AYLP_T_VECTOR_FLOAT)) {
+		data->batched = true;
+		self->proc = &pid_proc_batch;
+	}
+
 	// allocate dummy vectors or matrices so we can skip checking if they
 	// exist in proc()
 	switch (data->type) {
 	case AYLP_T_VECTOR:
-		data->acc_v = xmalloc_type(gsl_vector, 0);
-		data->pre_v = xmalloc_type(gsl_vector, 0);
-		data->res_v = xmalloc_type(gsl_vector, 0);
+		data->acc_v = xmalloc_aligned_type(gsl_vector, 0);
+		data->pre_v = xmalloc_aligned_type(gsl_vector, 0);
+		if (data->batched)
+			data->res_m = xmalloc_aligned_type(gsl_matrix, 0, 0);
+		else data->res_v = xmalloc_aligned_type(gsl_vector, 0);
 		break;
 	case AYLP_T_MATRIX:
-		data->acc_m = xmalloc_type(gsl_matrix, 0, 0);
-		data->pre_m = xmalloc_type(gsl_matrix, 0, 0);
-		data->res_m = xmalloc_type(gsl_matrix, 0, 0);
+		data->acc_m = xmalloc_aligned_type(gsl_matrix, 0, 0);
+		data->pre_m = xmalloc_aligned_type(gsl_matrix, 0, 0);
+		data->res_m = xmalloc_aligned_type(gsl_matrix, 0, 0);
+		break;
+	case AYLP_T_VECTOR_FLOAT:
+		data->acc_vf = xmalloc_aligned_type(gsl_vector_float, 0);
+		data->pre_vf = xmalloc_aligned_type(gsl_vector_float, 0);
+		if (data->batched)
+			data->res_mf = xmalloc_aligned_type(gsl_matrix_float,
+				0, 0
+			);
+		else data->res_vf = xmalloc_aligned_type(gsl_vector_float, 0);
+		break;
+	case AYLP_T_MATRIX_FLOAT:
+		data->acc_mf = xmalloc_aligned_type(gsl_matrix_float, 0, 0);
+		data->pre_mf = xmalloc_aligned_type(gsl_matrix_float, 0, 0);
+		data->res_mf = xmalloc_aligned_type(gsl_matrix_float, 0, 0);
 		break;
 	}
 
-	err = clock_gettime(CLOCK_MONOTONIC, &data->tp);
+	const char *kernel_name;
+	data->kernel = pid_kernel_select(&kernel_name);
+	data->skernel = spid_kernel_select(0);
+	err = pool_for_device(self, data->thread_count, &data->pool,
+		&data->own_pool
+	);
+	if (err) return err;
+	log_debug("Using %s kernel for contiguous input, on %zu threads above "
+		"%d elements", kernel_name,
+		data->pool ? data->pool->n_threads + 1 : 1, PID_PARALLEL_MIN
+	);
+
+	// the first frame's dt is measured from here
+	struct timespec tp;
+	err = clock_gettime(CLOCK_MONOTONIC, &tp);
 	if (err) {
 		log_error("Couldn't get time: %s", strerror(err));
 		return -1;
 	}
+	data->t_prev = (uint64_t)tp.tv_sec * 1000000000 + tp.tv_nsec;
 
 	// set types and units
 	self->type_in = data->type;
+	if (data->batched) self->type_in = data->type == AYLP_T_VECTOR ?
+		AYLP_T_MATRIX : AYLP_T_MATRIX_FLOAT;
 	self->units_in = AYLP_U_ANY;
 	self->type_out = AYLP_T_UNCHANGED;
 	self->units_out = data->units;
+	self->scratch_out = true;
 	return 0;
 }
 
 
-int pid_proc(struct aylp_device *self, struct aylp_state *state)
+int pid_shape(struct aylp_device *self, struct aylp_shape *shape)
 {
-	int err;
 	struct aylp_pid_data *data = self->device_data;
-	struct timespec tp1;
-	err = clock_gettime(CLOCK_MONOTONIC, &tp1);
-	if (err) {
-		log_error("Couldn't get time: %s", strerror(err));
-		return -1;
+	size_t y = shape->y, x = shape->x;
+	// keep the dummies until the first proc if we don't know
+	if (!y) return 0;
+	// batched, there is one set of state per row
+	size_t n = data->batched ? y : y * x;
+	switch (data->type) {
+	case AYLP_T_VECTOR:
+		xfree_aligned_type(gsl_vector, data->acc_v);
+		xfree_aligned_type(gsl_vector, data->pre_v);
+		data->acc_v = xcalloc_aligned_type(gsl_vector, n);
+		data->pre_v = xcalloc_aligned_type(gsl_vector, n);
+		if (data->batched) {
+			xfree_aligned_type(gsl_matrix, data->res_m);
+			data->res_m = xmalloc_aligned_type(gsl_matrix, y, x);
+		} else {
+			xfree_aligned_type(gsl_vector, data->res_v);
+			data->res_v = xmalloc_aligned_type(gsl_vector, n);
+		}
+		break;
+	case AYLP_T_MATRIX:
+		xfree_aligned_type(gsl_matrix, data->acc_m);
+		xfree_aligned_type(gsl_matrix, data->pre_m);
+		xfree_aligned_type(gsl_matrix, data->res_m);
+		data->acc_m = xcalloc_aligned_type(gsl_matrix, y, x);
+		data->pre_m = xcalloc_aligned_type(gsl_matrix, y, x);
+		data->res_m = xmalloc_aligned_type(gsl_matrix, y, x);
+		break;
+	case AYLP_T_VECTOR_FLOAT:
+		xfree_aligned_type(gsl_vector_float, data->acc_vf);
+		xfree_aligned_type(gsl_vector_float, data->pre_vf);
+		data->acc_vf = xcalloc_aligned_type(gsl_vector_float, n);
+		data->pre_vf = xcalloc_aligned_type(gsl_vector_float, n);
+		if (data->batched) {
+			xfree_aligned_type(gsl_matrix_float, data->res_mf);
+			data->res_mf = xmalloc_aligned_type(gsl_matrix_float,
+				y, x
+			);
+		} else {
+			xfree_aligned_type(gsl_vector_float, data->res_vf);
+			data->res_vf = xmalloc_aligned_type(gsl_vector_float,
+				n
+			);
+		}
+		break;
+	case AYLP_T_MATRIX_FLOAT:
+		xfree_aligned_type(gsl_matrix_float, data->acc_mf);
+		xfree_aligned_type(gsl_matrix_float, data->pre_mf);
+		xfree_aligned_type(gsl_matrix_float, data->res_mf);
+		data->acc_mf = xcalloc_aligned_type(gsl_matrix_float, y, x);
+		data->pre_mf = xcalloc_aligned_type(gsl_matrix_float, y, x);
+		data->res_mf = xmalloc_aligned_type(gsl_matrix_float, y, x);
+		break;
+	}
+	return 0;
+}
+
+
+// same as pid_step, but with the state kept in single precision
+static inline float pid_step_float(struct aylp_pid_data *data, float dt,
+	float s, float *a, float *p
+){
+	float clamp = data->clamp;
+	*a += dt * s;
+	if (*a > clamp) *a = clamp;
+	else if (*a < -clamp) *a = -clamp;
+	float r = - (float)data->p * s - (float)data->i * *a
+		- (float)data->d * (s - *p) / dt;
+	if (r > clamp) r = clamp;
+	else if (r < -clamp) r = -clamp;
+	*p = s;
+	return r;
+}
+
+
+static void pid_range(void *ctx, size_t start, size_t end)
+{
+	struct aylp_pid_data *data = ctx;
+	const double *s = data->s;
+	double *a = data->a, *p = data->pre, *r = data->res;
+	data->kernel(&data->k, end - start,
+		s + start, a + start, p + start, r + start
+	);
+}
+
+
+static void pid_range_float(void *ctx, size_t start, size_t end)
+{
+	struct aylp_pid_data *data = ctx;
+	const float *s = data->s;
+	float *a = data->a, *p = data->pre, *r = data->res;
+	data->skernel(&data->k, end - start,
+		s + start, a + start, p + start, r + start
+	);
+}
+
+
+// Run the kernel over n contiguous elements, split between threads if there
+// are enough of them. The state and result are ours, so always contiguous.
+static void pid_contiguous(struct aylp_pid_data *data, size_t n, bool is_float,
+	const void *s, void *a, void *p, void *r
+){
+	void (*range)(void *, size_t, size_t) = is_float ?
+		pid_range_float : pid_range;
+	data->s = s;
+	data->a = a;
+	data->pre = p;
+	data->res = r;
+	if (!data->pool || n < PID_PARALLEL_MIN) {
+		range(data, 0, n);
+		return;
 	}
-	double dt = tp1.tv_sec - data->tp.tv_sec;
-	dt += 1E-9 * (tp1.tv_nsec - data->tp.tv_nsec);
-	data->tp = tp1;
+	// two tasks per thread, in multiples of 64 elements so that no two
+	// threads write the same cache line
+	size_t n_tasks = 2 * (data->pool->n_threads + 1);
+	size_t chunk = (n + n_tasks - 1) / n_tasks;
+	chunk = (chunk + 63) / 64 * 64;
+	aylp_parallel_for(data->pool, n, chunk, range, data);
+}
+
+
+int pid_proc(struct aylp_device *self, struct aylp_state *state)
+{
+	struct aylp_pid_data *data = self->device_data;
+	double dt = pid_dt(data->fixed_dt, state->header.timestamp,
+		&data->t_prev
+	);
 	log_trace("dt = %G s", dt);
+	data->k = (struct pid_coeffs){
+		.p = data->p, .i = data->i, .clamp = data->clamp,
+		.dt = dt, .d_dt = data->d / dt,
+	};
 
 	switch (data->type) {
 	case AYLP_T_VECTOR: {
@@ -116,42 +293,37 @@ int pid_proc(struct aylp_device *self, struct aylp_state *state)
 		gsl_vector *r = data->res_v;
 		gsl_vector *s = state->vector;
 		// check if we need to (re)initialize
-		if (a->size != s->size) {
-			xfree_type(gsl_vector, data->acc_v);
-			data->acc_v = xcalloc_type(gsl_vector, s->size);
+		if (UNLIKELY(a->size != s->size)) {
+			xfree_aligned_type(gsl_vector, data->acc_v);
+			data->acc_v = xcalloc_aligned_type(gsl_vector, s->size);
+		}
+		if (UNLIKELY(p->size != s->size)) {
+			xfree_aligned_type(gsl_vector, data->pre_v);
+			data->pre_v = xcalloc_aligned_type(gsl_vector, s->size);
 		}
-		if (p->size != s->size) {
-			xfree_type(gsl_vector, data->pre_v);
-			data->pre_v = xcalloc_type(gsl_vector, s->size);
+		if (UNLIKELY(r->size != s->size)) {
+			xfree_aligned_type(gsl_vector, data->res_v);
+			data->res_v = xmalloc_aligned_type(gsl_vector, s->size);
 		}
-		if (r->size != s->size) {
-			xfree_type(gsl_vector, data->res_v);
-			data->res_v = xmalloc_type(gsl_vector, s->size);
+		a = data->acc_v;
+		p = data->pre_v;
+		r = data->res_v;
+		if (LIKELY(s->stride == 1)) {
+			// overwrite the input if we may
+			if (state->header.status & AYLP_MUTABLE) r = s;
+			pid_contiguous(data, s->size, false,
+				s->data, a->data, p->data, r->data
+			);
+			state->vector = r;
+			break;
 		}
 		// loop over elements and apply PID control
 		for (size_t j = 0; j < s->size; j++) {
-			// update accumulator and clamp if needed
-			a->data[j*a->stride] += dt * s->data[j*s->stride];
-			if (a->data[j*a->stride] > data->clamp)
-				a->data[j*a->stride] = data->clamp;
-			else if (a->data[j*a->stride] < -data->clamp)
-				a->data[j*a->stride] = -data->clamp;
-			// apply pid params to result
-			r->data[j*r->stride] =
-				- data->p * s->data[j*s->stride]
-				- data->i * a->data[j*a->stride]
-				- data->d * (
-					s->data[j*s->stride]
-					- p->data[j*p->stride]
-				) / dt
-			;
-			// clamp result if needed
-			if (r->data[j*r->stride] > data->clamp)
-				r->data[j*r->stride] = data->clamp;
-			else if (r->data[j*r->stride] < -data->clamp)
-				r->data[j*r->stride] = -data->clamp;
-			// update previous
-			p->data[j*p->stride] = s->data[j*s->stride];
+			r->data[j*r->stride] = pid_step(
+				data->p, data->i, data->d, data->clamp, dt,
+				s->data[j*s->stride], &a->data[j*a->stride],
+				&p->data[j*p->stride]
+			);
 		}
 		state->vector = data->res_v;
 		break;
@@ -164,53 +336,225 @@ int pid_proc(struct aylp_device *self, struct aylp_state *state)
 		gsl_matrix *s = state->matrix;
 		// check if we need to (re)initialize
 		if (UNLIKELY(a->size1 != s->size1 || a->size2 != s->size2)) {
-			xfree_type(gsl_matrix, data->acc_m);
-			data->acc_m = xcalloc_type(gsl_matrix,
+			xfree_aligned_type(gsl_matrix, data->acc_m);
+			data->acc_m = xcalloc_aligned_type(gsl_matrix,
 				s->size1, s->size2
 			);
 		}
 		if (UNLIKELY(p->size1 != s->size1 || p->size2 != s->size2)) {
-			xfree_type(gsl_matrix, data->pre_m);
-			data->pre_m = xcalloc_type(gsl_matrix,
+			xfree_aligned_type(gsl_matrix, data->pre_m);
+			data->pre_m = xcalloc_aligned_type(gsl_matrix,
 				s->size1, s->size2
 			);
 		}
 		if (UNLIKELY(r->size1 != s->size1 || r->size2 != s->size2)) {
-			xfree_type(gsl_matrix, data->res_m);
-			data->res_m = xmalloc_type(gsl_matrix,
+			xfree_aligned_type(gsl_matrix, data->res_m);
+			data->res_m = xmalloc_aligned_type(gsl_matrix,
 				s->size1, s->size2
 			);
 		}
+		a = data->acc_m;
+		p = data->pre_m;
+		r = data->res_m;
+		if (LIKELY(s->tda == s->size2)) {
+			// overwrite the input if we may
+			if (state->header.status & AYLP_MUTABLE) r = s;
+			pid_contiguous(data, s->size1 * s->size2, false,
+				s->data, a->data, p->data, r->data
+			);
+			state->matrix = r;
+			break;
+		}
 		// loop over elements and apply PID control
 		for (size_t y = 0; y < s->size1; y++) {
 			for (size_t x = 0; x < s->size2; x++) {
-				// update accumulator and clamp if needed
-				a->data[y*a->tda+x] += dt * s->data[y*s->tda+x];
-				if (a->data[y*a->tda+x] > data->clamp)
-					a->data[y*a->tda+x] = data->clamp;
-				else if (a->data[y*a->tda+x] < -data->clamp)
-					a->data[y*a->tda+x] = -data->clamp;
-				// apply pid params to result
-				r->data[y*r->tda+x] =
-					- data->p * s->data[y*s->tda+x]
-					- data->i * a->data[y*a->tda+x]
-					- data->d * (
-						s->data[y*s->tda+x]
-						- p->data[y*p->tda+x]
-					) / dt
-				;
-				// clamp result if needed
-				if (r->data[y*r->tda+x] > data->clamp)
-					r->data[y*r->tda+x] = data->clamp;
-				if (r->data[y*r->tda+x] < -data->clamp)
-					r->data[y*r->tda+x] = -data->clamp;
-				// update previous
-				p->data[y*p->tda+x] = s->data[y*s->tda+x];
+				r->data[y*r->tda+x] = pid_step(
+					data->p, data->i, data->d, data->clamp,
+					dt, s->data[y*s->tda+x],
+					&a->data[y*a->tda+x],
+					&p->data[y*p->tda+x]
+				);
 			}
 		}
 		state->matrix = data->res_m;
 		break;
 	}
+
+	case AYLP_T_VECTOR_FLOAT: {
+		gsl_vector_float *a = data->acc_vf;
+		gsl_vector_float *p = data->pre_vf;
+		gsl_vector_float *r = data->res_vf;
+		gsl_vector_float *s = state->vector_float;
+		// check if we need to (re)initialize
+		if (UNLIKELY(a->size != s->size)) {
+			xfree_aligned_type(gsl_vector_float, data->acc_vf);
+			data->acc_vf = xcalloc_aligned_type(
+				gsl_vector_float, s->size
+			);
+		}
+		if (UNLIKELY(p->size != s->size)) {
+			xfree_aligned_type(gsl_vector_float, data->pre_vf);
+			data->pre_vf = xcalloc_aligned_type(
+				gsl_vector_float, s->size
+			);
+		}
+		if (UNLIKELY(r->size != s->size)) {
+			xfree_aligned_type(gsl_vector_float, data->res_vf);
+			data->res_vf = xmalloc_aligned_type(gsl_vector_float,
+				s->size
+			);
+		}
+		a = data->acc_vf;
+		p = data->pre_vf;
+		r = data->res_vf;
+		if (LIKELY(s->stride == 1)) {
+			// overwrite the input if we may
+			if (state->header.status & AYLP_MUTABLE) r = s;
+			pid_contiguous(data, s->size, true,
+				s->data, a->data, p->data, r->data
+			);
+			state->vector_float = r;
+			break;
+		}
+		// loop over elements and apply PID control
+		for (size_t j = 0; j < s->size; j++) {
+			r->data[j*r->stride] = pid_step_float(data, dt,
+				s->data[j*s->stride], &a->data[j*a->stride],
+				&p->data[j*p->stride]
+			);
+		}
+		state->vector_float = data->res_vf;
+		break;
+	}
+
+	case AYLP_T_MATRIX_FLOAT: {
+		gsl_matrix_float *a = data->acc_mf;
+		gsl_matrix_float *p = data->pre_mf;
+		gsl_matrix_float *r = data->res_mf;
+		gsl_matrix_float *s = state->matrix_float;
+		// check if we need to (re)initialize
+		if (UNLIKELY(a->size1 != s->size1 || a->size2 != s->size2)) {
+			xfree_aligned_type(gsl_matrix_float, data->acc_mf);
+			data->acc_mf = xcalloc_aligned_type(gsl_matrix_float,
+				s->size1, s->size2
+			);
+		}
+		if (UNLIKELY(p->size1 != s->size1 || p->size2 != s->size2)) {
+			xfree_aligned_type(gsl_matrix_float, data->pre_mf);
+			data->pre_mf = xcalloc_aligned_type(gsl_matrix_float,
+				s->size1, s->size2
+			);
+		}
+		if (UNLIKELY(r->size1 != s->size1 || r->size2 != s->size2)) {
+			xfree_aligned_type(gsl_matrix_float, data->res_mf);
+			data->res_mf = xmalloc_aligned_type(gsl_matrix_float,
+				s->size1, s->size2
+			);
+		}
+		a = data->acc_mf;
+		p = data->pre_mf;
+		r = data->res_mf;
+		if (LIKELY(s->tda == s->size2)) {
+			// overwrite the input if we may
+			if (state->header.status & AYLP_MUTABLE) r = s;
+			pid_contiguous(data, s->size1 * s->size2, true,
+				s->data, a->data, p->data, r->data
+			);
+			state->matrix_float = r;
+			break;
+		}
+		// loop over elements and apply PID control
+		for (size_t y = 0; y < s->size1; y++) {
+			for (size_t x = 0; x < s->size2; x++) {
+				r->data[y*r->tda+x] = pid_step_float(data, dt,
+					s->data[y*s->tda+x],
+					&a->data[y*a->tda+x],
+					&p->data[y*p->tda+x]
+				);
+			}
+		}
+		state->matrix_float = data->res_mf;
+		break;
+	}
+	}
+
+	return 0;
+}
+
+
+int pid_proc_batch(struct aylp_device *self, struct aylp_state *state)
+{
+	struct aylp_pid_data *data = self->device_data;
+	double dt = pid_dt(data->fixed_dt, state->header.timestamp,
+		&data->t_prev
+	);
+	// the frames of the batch are taken to be evenly spaced in time
+	if (data->fixed_dt <= 0) dt /= self->batch;
+	log_trace("dt = %G s per frame", dt);
+
+	if (data->type == AYLP_T_VECTOR) {
+		gsl_matrix *s = state->matrix;
+		// check if we need to (re)initialize
+		if (UNLIKELY(data->acc_v->size != s->size1)) {
+			xfree_aligned_type(gsl_vector, data->acc_v);
+			data->acc_v = xcalloc_aligned_type(
+				gsl_vector, s->size1
+			);
+			xfree_aligned_type(gsl_vector, data->pre_v);
+			data->pre_v = xcalloc_aligned_type(
+				gsl_vector, s->size1
+			);
+		}
+		if (UNLIKELY(data->res_m->size1 != s->size1
+		|| data->res_m->size2 != s->size2)) {
+			xfree_aligned_type(gsl_matrix, data->res_m);
+			data->res_m = xmalloc_aligned_type(gsl_matrix,
+				s->size1, s->size2
+			);
+		}
+		// each element's frames are in order along its row
+		gsl_matrix *r = data->res_m;
+		double *a = data->acc_v->data;
+		double *p = data->pre_v->data;
+		for (size_t y = 0; y < s->size1; y++) {
+			for (size_t x = 0; x < s->size2; x++) {
+				r->data[y*r->tda+x] = pid_step(
+					data->p, data->i, data->d, data->clamp,
+					dt, s->data[y*s->tda+x], &a[y], &p[y]
+				);
+			}
+		}
+		state->matrix = data->res_m;
+	} else {
+		gsl_matrix_float *s = state->matrix_float;
+		if (UNLIKELY(data->acc_vf->size != s->size1)) {
+			xfree_aligned_type(gsl_vector_float, data->acc_vf);
+			data->acc_vf = xcalloc_aligned_type(
+				gsl_vector_float, s->size1
+			);
+			xfree_aligned_type(gsl_vector_float, data->pre_vf);
+			data->pre_vf = xcalloc_aligned_type(
+				gsl_vector_float, s->size1
+			);
+		}
+		if (UNLIKELY(data->res_mf->size1 != s->size1
+		|| data->res_mf->size2 != s->size2)) {
+			xfree_aligned_type(gsl_matrix_float, data->res_mf);
+			data->res_mf = xmalloc_aligned_type(gsl_matrix_float,
+				s->size1, s->size2
+			);
+		}
+		gsl_matrix_float *r = data->res_mf;
+		float *a = data->acc_vf->data;
+		float *p = data->pre_vf->data;
+		for (size_t y = 0; y < s->size1; y++) {
+			for (size_t x = 0; x < s->size2; x++) {
+				r->data[y*r->tda+x] = pid_step_float(data, dt,
+					s->data[y*s->tda+x], &a[y], &p[y]
+				);
+			}
+		}
+		state->matrix_float = data->res_mf;
 	}
 
 	return 0;
@@ -220,16 +564,35 @@ int pid_proc(struct aylp_device *self, struct aylp_state *state)
 int pid_fini(struct aylp_device *self)
 {
 	struct aylp_pid_data *data = self->device_data;
-	switch (data->type) {
+	pool_release(&data->own_pool);
+	if (data->batched && data->type == AYLP_T_VECTOR) {
+		xfree_aligned_type(gsl_vector, data->acc_v);
+		xfree_aligned_type(gsl_vector, data->pre_v);
+		xfree_aligned_type(gsl_matrix, data->res_m);
+	} else if (data->batched) {
+		xfree_aligned_type(gsl_vector_float, data->acc_vf);
+		xfree_aligned_type(gsl_vector_float, data->pre_vf);
+		xfree_aligned_type(gsl_matrix_float, data->res_mf);
+	} else switch (data->type) {
 	case AYLP_T_VECTOR:
-		xfree_type(gsl_vector, data->acc_v);
-		xfree_type(gsl_vector, data->pre_v);
-		xfree_type(gsl_vector, data->res_v);
+		xfree_aligned_type(gsl_vector, data->acc_v);
+		xfree_aligned_type(gsl_vector, data->pre_v);
+		xfree_aligned_type(gsl_vector, data->res_v);
 		break;
 	case AYLP_T_MATRIX:
-		xfree_type(gsl_matrix, data->acc_m);
-		xfree_type(gsl_matrix, data->pre_m);
-		xfree_type(gsl_matrix, data->res_m);
+		xfree_aligned_type(gsl_matrix, data->acc_m);
+		xfree_aligned_type(gsl_matrix, data->pre_m);
+		xfree_aligned_type(gsl_matrix, data->res_m);
+		break;
+	case AYLP_T_VECTOR_FLOAT:
+		xfree_aligned_type(gsl_vector_float, data->acc_vf);
+		xfree_aligned_type(gsl_vector_float, data->pre_vf);
+		xfree_aligned_type(gsl_vector_float, data->res_vf);
+		break;
+	case AYLP_T_MATRIX_FLOAT:
+		xfree_aligned_type(gsl_matrix_float, data->acc_mf);
+		xfree_aligned_type(gsl_matrix_float, data->pre_mf);
+		xfree_aligned_type(gsl_matrix_float, data->res_mf);
 		break;
 	}
 	xfree(data);
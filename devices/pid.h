@@ -1,11 +1,17 @@
 #ifndef AYLP_DEVICES_PID_H_
 #define AYLP_DEVICES_PID_H_
 
-#include <time.h>
 #include "anyloop.h"
+#include "pid_kernels.h"
+#include "thread_pool.h"
+
+// Contiguous inputs with at least this many elements are split between
+// threads, if there is a pool; below it, handing out the work costs more than
+// it saves.
+#define PID_PARALLEL_MIN 65536
 
 struct aylp_pid_data {
-	// param type in ["vector", "matrix"]
+	// param type in ["vector", "matrix", "vector_float", "matrix_float"]
 	aylp_type type;
 	// units to output
 	aylp_units units;
@@ -13,29 +19,93 @@ struct aylp_pid_data {
 	union {
 		gsl_vector *acc_v;
 		gsl_matrix *acc_m;
+		gsl_vector_float *acc_vf;
+		gsl_matrix_float *acc_mf;
 	};
 	// previous error
 	union {
 		gsl_vector *pre_v;
 		gsl_matrix *pre_m;
+		gsl_vector_float *pre_vf;
+		gsl_matrix_float *pre_mf;
 	};
 	// correction result
 	union {
 		gsl_vector *res_v;
 		gsl_matrix *res_m;
+		gsl_vector_float *res_vf;
+		gsl_matrix_float *res_mf;
 	};
-	// previous timestamp
-	struct timespec tp;
+	// timestamp of the previous frame, in ns (see aylp_header)
+	uint64_t t_prev;
+	// param; if positive, used as dt instead of the timestamps
+	double fixed_dt;
 	// pid params, clamp for maximum correction (by i term and in total)
 	double p, i, d, clamp;
+	// whether vectors come batched as the columns of a matrix, in which
+	// case acc and pre are vectors and res is a matrix
+	bool batched;
+	// kernels for contiguous input, picked for this CPU
+	pid_kernel kernel;
+	spid_kernel skernel;
+	// coefficients for the current proc
+	struct pid_coeffs k;
+	// param; set above 1 for a private pool instead of the shared one
+	size_t thread_count;
+	// pool we hand elements to (the shared one, or own_pool), if any
+	struct aylp_pool *pool;
+	// pool of thread_count-1 workers, if thread_count > 1
+	struct aylp_pool *own_pool;
+	// contiguous input, state, and result for the current proc, for the
+	// workers to read; double or float depending on type
+	const void *s;
+	void *a, *pre, *res;
 };
 
+// Seconds since the previous frame, from the loop's timestamp of this one
+// (updating *t_prev), or fixed_dt if that is positive. Shared with the fused
+// matmul_pid device.
+static inline double pid_dt(double fixed_dt, uint64_t timestamp,
+	uint64_t *t_prev
+){
+	if (fixed_dt > 0) return fixed_dt;
+	double dt = 1E-9 * (int64_t)(timestamp - *t_prev);
+	*t_prev = timestamp;
+	return dt;
+}
+
+// Apply PID control to one element with error s, updating its accumulated
+// error *a (clamped) and previous error *prev, and return the clamped
+// correction. Shared with the fused matmul_pid device.
+static inline double pid_step(double p, double i, double d, double clamp,
+	double dt, double s, double *a, double *prev
+){
+	// update accumulator and clamp if needed
+	*a += dt * s;
+	if (*a > clamp) *a = clamp;
+	else if (*a < -clamp) *a = -clamp;
+	// apply pid params to result
+	double r = - p * s - i * *a - d * (s - *prev) / dt;
+	// clamp result if needed
+	if (r > clamp) r = clamp;
+	else if (r < -clamp) r = -clamp;
+	// update previous
+	*prev = s;
+	return r;
+}
+
 // initialize pid device
 int pid_init(struct aylp_device *self);
 
+// allocate the pid state for the shape of its input
+int pid_shape(struct aylp_device *self, struct aylp_shape *shape);
+
 // process pid device once per loop
 int pid_proc(struct aylp_device *self, struct aylp_state *state);
 
+// process a batch of vectors, one per column of a matrix, once per loop
+int pid_proc_batch(struct aylp_device *self, struct aylp_state *state);
+
 // close pid device when loop exits
 int pid_fini(struct aylp_device *self);
 
@@ -0,0 +1,128 @@
+#include <stdbool.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PID_X86 1
+#endif
+
+#include "cpu.h"
+#include "pid_kernels.h"
+
+
+// Plain C kernels. The clamps are written so that the compiler turns them into
+// min and max instructions, which leaves the loop free of branches and lets it
+// be vectorized with whatever the baseline instruction set is.
+#define DEFINE_SCALAR(name, T) \
+static void name(const struct pid_coeffs *k, size_t n, const T *s, T *a, \
+	T *prev, T *r \
+){ \
+	const T p = k->p, i = k->i, d_dt = k->d_dt; \
+	const T dt = k->dt, hi = k->clamp, lo = -hi; \
+	for (size_t j = 0; j < n; j++) { \
+		T sj = s[j]; \
+		T aj = a[j] + dt * sj; \
+		aj = aj < lo ? lo : aj; \
+		aj = aj > hi ? hi : aj; \
+		T rj = - p * sj - i * aj - d_dt * (sj - prev[j]); \
+		rj = rj < lo ? lo : rj; \
+		rj = rj > hi ? hi : rj; \
+		a[j] = aj; \
+		prev[j] = sj; \
+		r[j] = rj; \
+	} \
+}
+DEFINE_SCALAR(pid_scalar, double)
+DEFINE_SCALAR(spid_scalar, float)
+#undef DEFINE_SCALAR
+
+
+#ifdef PID_X86
+
+__attribute__((target("avx2,fma")))
+static void pid_avx2(const struct pid_coeffs *k, size_t n, const double *s,
+	double *a, double *prev, double *r
+){
+	// negated, so the correction is a chain of fmas
+	const __m256d np = _mm256_set1_pd(-k->p);
+	const __m256d ni = _mm256_set1_pd(-k->i);
+	const __m256d nd = _mm256_set1_pd(-k->d_dt);
+	const __m256d dt = _mm256_set1_pd(k->dt);
+	const __m256d hi = _mm256_set1_pd(k->clamp);
+	const __m256d lo = _mm256_set1_pd(-k->clamp);
+	size_t j = 0;
+	for (; j + 4 <= n; j += 4) {
+		__m256d sj = _mm256_loadu_pd(s + j);
+		__m256d aj = _mm256_fmadd_pd(dt, sj, _mm256_loadu_pd(a + j));
+		aj = _mm256_min_pd(_mm256_max_pd(aj, lo), hi);
+		__m256d ds = _mm256_sub_pd(sj, _mm256_loadu_pd(prev + j));
+		__m256d rj = _mm256_mul_pd(nd, ds);
+		rj = _mm256_fmadd_pd(ni, aj, rj);
+		rj = _mm256_fmadd_pd(np, sj, rj);
+		rj = _mm256_min_pd(_mm256_max_pd(rj, lo), hi);
+		_mm256_storeu_pd(a + j, aj);
+		_mm256_storeu_pd(prev + j, sj);
+		_mm256_storeu_pd(r + j, rj);
+	}
+	pid_scalar(k, n - j, s + j, a + j, prev + j, r + j);
+}
+
+
+__attribute__((target("avx2,fma")))
+static void spid_avx2(const struct pid_coeffs *k, size_t n, const float *s,
+	float *a, float *prev, float *r
+){
+	const __m256 np = _mm256_set1_ps(-k->p);
+	const __m256 ni = _mm256_set1_ps(-k->i);
+	const __m256 nd = _mm256_set1_ps(-k->d_dt);
+	const __m256 dt = _mm256_set1_ps(k->dt);
+	const __m256 hi = _mm256_set1_ps(k->clamp);
+	const __m256 lo = _mm256_set1_ps(-k->clamp);
+	size_t j = 0;
+	for (; j + 8 <= n; j += 8) {
+		__m256 sj = _mm256_loadu_ps(s + j);
+		__m256 aj = _mm256_fmadd_ps(dt, sj, _mm256_loadu_ps(a + j));
+		aj = _mm256_min_ps(_mm256_max_ps(aj, lo), hi);
+		__m256 ds = _mm256_sub_ps(sj, _mm256_loadu_ps(prev + j));
+		__m256 rj = _mm256_mul_ps(nd, ds);
+		rj = _mm256_fmadd_ps(ni, aj, rj);
+		rj = _mm256_fmadd_ps(np, sj, rj);
+		rj = _mm256_min_ps(_mm256_max_ps(rj, lo), hi);
+		_mm256_storeu_ps(a + j, aj);
+		_mm256_storeu_ps(prev + j, sj);
+		_mm256_storeu_ps(r + j, rj);
+	}
+	spid_scalar(k, n - j, s + j, a + j, prev + j, r + j);
+}
+
+#endif
+
+
+pid_kernel pid_kernel_select(const char **name)
+{
+	const char *dummy;
+	if (!name) name = &dummy;
+#ifdef PID_X86
+	if (cpu_has_avx2_fma()) {
+		*name = "avx2";
+		return pid_avx2;
+	}
+#endif
+	*name = "scalar";
+	return pid_scalar;
+}
+
+
+spid_kernel spid_kernel_select(const char **name)
+{
+	const char *dummy;
+	if (!name) name = &dummy;
+#ifdef PID_X86
+	if (cpu_has_avx2_fma()) {
+		*name = "avx2";
+		return spid_avx2;
+	}
+#endif
+	*name = "scalar";
+	return spid_scalar;
+}
+
@@ -0,0 +1,36 @@
+#ifndef AYLP_DEVICES_PID_KERNELS_H_
+#define AYLP_DEVICES_PID_KERNELS_H_
+
+#include <stddef.h>
+
+/** PID coefficients for one proc, with the division by dt done up front. */
+struct pid_coeffs {
+	double p, i, clamp;
+	// time since the previous proc
+	double dt;
+	// d/dt, the coefficient of the change in error
+	double d_dt;
+};
+
+/** PID kernel for n contiguous elements. For each element j, it adds
+* dt*s[j] to the accumulated error a[j] and clamps it, writes the clamped
+* correction to r[j], and sets the previous error prev[j] to s[j], just like
+* pid_step. Clamps are done with min and max rather than branches. */
+typedef void (*pid_kernel)(const struct pid_coeffs *k, size_t n,
+	const double *s, double *a, double *prev, double *r
+);
+
+/** Single-precision version of pid_kernel. */
+typedef void (*spid_kernel)(const struct pid_coeffs *k, size_t n,
+	const float *s, float *a, float *prev, float *r
+);
+
+/** Pick the fastest pid kernel this CPU supports. Name is set to a short
+* description of the kernel (e.g. "avx2") if it is not null. */
+pid_kernel pid_kernel_select(const char **name);
+
+/** Pick the fastest spid kernel this CPU supports, as pid_kernel_select. */
+spid_kernel spid_kernel_select(const char **name);
+
+#endif
+
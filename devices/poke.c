@@ -11,6 +11,7 @@
 int poke_init(struct aylp_device *self)
 {
 	self->proc = &poke_proc;
+	self->shape = &poke_shape;
 	self->fini = &poke_fini;
 	self->device_data = xcalloc(1, sizeof(struct aylp_poke_data));
 	struct aylp_poke_data *data = self->device_data;
@@ -53,18 +54,37 @@ int poke_init(struct aylp_device *self)
 }
 
 
+// allocate the poke matrix for response vectors of size n
+static void poke_setup(struct aylp_poke_data *data, size_t n)
+{
+	xfree_type(gsl_matrix, data->poke_matrix);
+	xfree_type(gsl_vector, data->tmp);
+	data->poke_matrix = gsl_matrix_alloc(n, data->n_act);
+	data->tmp = gsl_vector_alloc(n);
+}
+
+
+int poke_shape(struct aylp_device *self, struct aylp_shape *shape)
+{
+	struct aylp_poke_data *data = self->device_data;
+	if (shape->y) poke_setup(data, shape->y * shape->x);
+	shape->y = data->n_act;
+	shape->x = 1;
+	return 0;
+}
+
+
 int poke_proc(struct aylp_device *self, struct aylp_state *state)
 {
 	struct aylp_poke_data *data = self->device_data;
 	int err;
 
 	if (data->iter == 0) {
-		// first iteration; determine error vector size and alloc
-		data->poke_matrix = gsl_matrix_alloc(
-			state->vector->size,
-			data->n_act
-		);
-		data->tmp = gsl_vector_alloc(state->vector->size);
+		// first iteration; alloc if the error vector size wasn't known
+		// at startup
+		if (UNLIKELY(!data->tmp
+		|| data->tmp->size != state->vector->size))
+			poke_setup(data, state->vector->size);
 	} else if (data->iter & 1) {
 		// odd iteration; set tmp to this and continue
 		err = gsl_vector_memcpy(data->tmp, state->vector);
@@ -26,6 +26,9 @@ struct aylp_poke_data {
 // initialize poke device
 int poke_init(struct aylp_device *self);
 
+// allocate for the shape of poke input, and declare its output
+int poke_shape(struct aylp_device *self, struct aylp_shape *shape);
+
 // process poke device once per loop
 int poke_proc(struct aylp_device *self, struct aylp_state *state);
 
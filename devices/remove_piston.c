@@ -41,13 +41,78 @@ int remove_piston_init(struct aylp_device *self)
 {
 	self->device_data = xcalloc(1, sizeof(struct aylp_remove_piston_data));
 	self->proc = &remove_piston_proc;
+	self->shape = &remove_piston_shape;
 	self->fini = &remove_piston_fini;
 
 	// set types and units
-	self->type_in = AYLP_T_MATRIX;
+	self->type_in = AYLP_T_MATRIX | AYLP_T_MATRIX_FLOAT;
 	self->units_in = AYLP_U_ANY;
 	self->type_out = AYLP_T_UNCHANGED;
 	self->units_out = AYLP_U_UNCHANGED;
+	self->scratch_out = true;
+
+	return 0;
+}
+
+
+int remove_piston_shape(struct aylp_device *self, struct aylp_shape *shape)
+{
+	struct aylp_remove_piston_data *data = self->device_data;
+	if (!shape->y) return 0;
+	// there's a result for each type we might get, in case the input isn't
+	// ours to overwrite
+	if (shape->type & AYLP_T_MATRIX) {
+		data->res_m = xmalloc_aligned_type(gsl_matrix,
+			shape->y, shape->x
+		);
+	}
+	if (shape->type & AYLP_T_MATRIX_FLOAT) {
+		data->res_mf = xmalloc_aligned_type(gsl_matrix_float,
+			shape->y, shape->x
+		);
+	}
+	return 0;
+}
+
+
+// single-precision version of remove_piston_proc; the sum is still accumulated
+// in double precision so large matrices don't lose the mean to rounding
+static int remove_piston_proc_float(
+	struct aylp_remove_piston_data *data, struct aylp_state *state
+){
+	gsl_matrix_float *m = state->matrix_float;
+	// overwrite the input if we may
+	gsl_matrix_float *res = m;
+	if (!(state->header.status & AYLP_MUTABLE)) {
+		if (UNLIKELY(!data->res_mf || data->res_mf->size1 != m->size1
+		|| data->res_mf->size2 != m->size2)) {
+			if (data->res_mf)
+				xfree_aligned_type(gsl_matrix_float,
+					data->res_mf
+				);
+			data->res_mf = xmalloc_aligned_type(gsl_matrix_float,
+				m->size1, m->size2
+			);
+		}
+		res = data->res_mf;
+	}
+
+	double sum = 0;
+	for (size_t i = 0; i < m->size1; i++) {
+		for (size_t j = 0; j < m->size2; j++) {
+			sum += m->data[i * m->tda + j];
+		}
+	}
+	float x = -sum / (m->size1 * m->size2);
+	for (size_t i = 0; i < m->size1; i++) {
+		for (size_t j = 0; j < m->size2; j++) {
+			res->data[i * res->tda + j] = x
+				+ m->data[i * m->tda + j];
+		}
+	}
+
+	// update pipeline state
+	state->matrix_float = res;
 
 	return 0;
 }
@@ -57,16 +122,28 @@ int remove_piston_proc(struct aylp_device *self, struct aylp_state *state)
 {
 	struct aylp_remove_piston_data *data = self->device_data;
 
+	if (state->header.type == AYLP_T_MATRIX_FLOAT)
+		return remove_piston_proc_float(data, state);
+
+	if (state->header.status & AYLP_MUTABLE) {
+		// no need for a copy
+		double x = -gsl_matrix_sum_elements(state->matrix);
+		x /= state->matrix->size1 * state->matrix->size2;
+		int err = gsl_matrix_add_constant(state->matrix, x);
+		if (err) return -1;
+		return 0;
+	}
+
 	if (UNLIKELY(!data->res_m)) {
 		// we have nowhere to put the result; let's allocate it
-		data->res_m = gsl_matrix_alloc(
+		data->res_m = xmalloc_aligned_type(gsl_matrix,
 			state->matrix->size1, state->matrix->size2
 		);
 	} else if (UNLIKELY(data->res_m->size1 != state->matrix->size1
 	|| data->res_m->size2 != state->matrix->size2)) {
 		// somehow the state matrix changed size >:(
-		xfree_type(gsl_matrix, data->res_m);
-		data->res_m = gsl_matrix_alloc(
+		xfree_aligned_type(gsl_matrix, data->res_m);
+		data->res_m = xmalloc_aligned_type(gsl_matrix,
 			state->matrix->size1, state->matrix->size2
 		);
 	}
@@ -86,7 +163,8 @@ int remove_piston_proc(struct aylp_device *self, struct aylp_state *state)
 int remove_piston_fini(struct aylp_device *self)
 {
 	struct aylp_remove_piston_data *data = self->device_data;
-	xfree_type(gsl_matrix, data->res_m);
+	xfree_aligned_type(gsl_matrix, data->res_m);
+	xfree_aligned_type(gsl_matrix_float, data->res_mf);
 	xfree(data);
 	return 0;
 }
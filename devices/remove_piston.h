@@ -7,11 +7,16 @@
 struct aylp_remove_piston_data {
 	// the result
 	gsl_matrix *res_m;
+	// the result, for single-precision input
+	gsl_matrix_float *res_mf;
 };
 
 // initialize remove_piston device
 int remove_piston_init(struct aylp_device *self);
 
+// allocate for the shape of remove_piston input
+int remove_piston_shape(struct aylp_device *self, struct aylp_shape *shape);
+
 // process remove_piston once per loop
 int remove_piston_proc(struct aylp_device *self, struct aylp_state *state);
 
@@ -40,7 +40,9 @@ int stop_after_count_init(struct aylp_device *self)
 int stop_after_count_proc(struct aylp_device *self, struct aylp_state *state)
 {
 	size_t *count = (size_t *)self->device_data;
-	*count -= 1;
+	// each proc carries a whole batch of frames
+	size_t frames = self->batch > 1 ? self->batch : 1;
+	*count = *count > frames ? *count - frames : 0;
 	if (*count == 0) state->header.status |= AYLP_DONE;
 	return 0;
 }
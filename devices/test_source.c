@@ -12,6 +12,7 @@ enum {KIND_CONSTANT=1, KIND_SINE=2};
 int test_source_init(struct aylp_device *self)
 {
 	self->proc = &test_source_proc;
+	self->shape = &test_source_shape;
 	self->fini = &test_source_fini;
 	self->device_data = xcalloc(1, sizeof(struct aylp_test_source_data));
 	struct aylp_test_source_data *data = self->device_data;
@@ -37,8 +38,14 @@ int test_source_init(struct aylp_device *self)
 				data->type = AYLP_T_MATRIX;
 			else if (!strcmp(s, "matrix_uchar"))
 				data->type = AYLP_T_MATRIX_UCHAR;
+			else if (!strcmp(s, "matrix_ushort"))
+				data->type = AYLP_T_MATRIX_USHORT;
+			else if (!strcmp(s, "vector_float"))
+				data->type = AYLP_T_VECTOR_FLOAT;
+			else if (!strcmp(s, "matrix_float"))
+				data->type = AYLP_T_MATRIX_FLOAT;
 			else log_error("Unrecognized type: %s", s);
-			log_trace("type = %s (0x%hhX)", s, data->type);
+			log_trace("type = %s (0x%hX)", s, data->type);
 		} else if (!strcmp(key, "kind")) {
 			const char *s = json_object_get_string(val);
 			// TODO: add KIND_NOISE?
@@ -78,26 +85,54 @@ int test_source_init(struct aylp_device *self)
 		log_error("You must provide a valid size1 param.");
 		return -1;
 	}
-	if (data->type & (AYLP_T_MATRIX|AYLP_T_MATRIX_UCHAR) && !data->size2) {
+	if (data->type & (AYLP_T_MATRIX|AYLP_T_MATRIX_UCHAR
+		|AYLP_T_MATRIX_USHORT|AYLP_T_MATRIX_FLOAT) && !data->size2
+	) {
 		log_error("You must provide a valid size2 param.");
 		return -1;
 	}
+	// in batch mode, vectors become the columns of a matrix
+	if (self->batch > 1
+	&& data->type & (AYLP_T_VECTOR|AYLP_T_VECTOR_FLOAT)) {
+		data->batched = true;
+		data->type = data->type == AYLP_T_VECTOR ?
+			AYLP_T_MATRIX : AYLP_T_MATRIX_FLOAT;
+		data->size2 = self->batch;
+		log_debug("Batching %zu vectors per proc", self->batch);
+	}
 	// warn about clipping
 	if (fabs(data->offset) + fabs(data->amplitude) > 1) {
 		log_warn("Note that output will be clipped to ±1.0, "
-			"or 0:255 for uchar types"
+			"or 0:255 for uchar types and 0:65535 for ushort types"
 		);
 	}
 
 	switch (data->type) {
 	case AYLP_T_VECTOR:
-		data->vector = gsl_vector_alloc(data->size1);
+		data->vector = xmalloc_aligned_type(gsl_vector, data->size1);
 		break;
 	case AYLP_T_MATRIX:
-		data->matrix = gsl_matrix_alloc(data->size1, data->size2);
+		data->matrix = xmalloc_aligned_type(gsl_matrix,
+			data->size1, data->size2
+		);
 		break;
 	case AYLP_T_MATRIX_UCHAR:
-		data->matrix_uchar = gsl_matrix_uchar_alloc(
+		data->matrix_uchar = xmalloc_aligned_type(gsl_matrix_uchar,
+			data->size1, data->size2
+		);
+		break;
+	case AYLP_T_MATRIX_USHORT:
+		data->matrix_ushort = xmalloc_aligned_type(gsl_matrix_ushort,
+			data->size1, data->size2
+		);
+		break;
+	case AYLP_T_VECTOR_FLOAT:
+		data->vector_float = xmalloc_aligned_type(gsl_vector_float,
+			data->size1
+		);
+		break;
+	case AYLP_T_MATRIX_FLOAT:
+		data->matrix_float = xmalloc_aligned_type(gsl_matrix_float,
 			data->size1, data->size2
 		);
 		break;
@@ -107,17 +142,30 @@ int test_source_init(struct aylp_device *self)
 	self->type_in = AYLP_T_ANY;
 	self->units_in = AYLP_U_ANY;
 	self->type_out = data->type;
-	if (data->type == AYLP_T_MATRIX_UCHAR) self->units_out = AYLP_U_COUNTS;
+	if (data->type & (AYLP_T_MATRIX_UCHAR|AYLP_T_MATRIX_USHORT))
+		self->units_out = AYLP_U_COUNTS;
 	else self->units_out = AYLP_U_MINMAX;
+	// every element is rewritten each proc
+	self->scratch_out = true;
 
 	return 0;
 }
 
 
-int test_source_proc(struct aylp_device *self, struct aylp_state *state)
+int test_source_shape(struct aylp_device *self, struct aylp_shape *shape)
 {
 	struct aylp_test_source_data *data = self->device_data;
+	// we ignore our input, and our output was allocated in init
+	shape->y = data->size1;
+	shape->x = data->type & (AYLP_T_VECTOR|AYLP_T_VECTOR_FLOAT) ?
+		1 : data->size2;
+	return 0;
+}
+
 
+// the value for the next frame
+static double next_value(struct aylp_test_source_data *data)
+{
 	double val = 0;
 	switch (data->kind) {
 	case KIND_CONSTANT:
@@ -132,6 +180,33 @@ int test_source_proc(struct aylp_device *self, struct aylp_state *state)
 	if (val > 1) val = 1;
 	else if (val < -1) val = -1;
 	data->acc += 1;
+	return val;
+}
+
+
+// fill each column of the matrix with the next frame
+static void proc_batched(struct aylp_test_source_data *data)
+{
+	for (size_t c = 0; c < data->size2; c++) {
+		double val = next_value(data);
+		for (size_t r = 0; r < data->size1; r++) {
+			if (data->type == AYLP_T_MATRIX)
+				gsl_matrix_set(data->matrix, r, c, val);
+			else gsl_matrix_float_set(data->matrix_float,
+				r, c, val
+			);
+		}
+	}
+}
+
+
+int test_source_proc(struct aylp_device *self, struct aylp_state *state)
+{
+	struct aylp_test_source_data *data = self->device_data;
+
+	double val = 0;
+	if (data->batched) proc_batched(data);
+	else val = next_value(data);
 
 	switch (data->type) {
 	case AYLP_T_VECTOR:
@@ -141,7 +216,7 @@ int test_source_proc(struct aylp_device *self, struct aylp_state *state)
 		state->header.log_dim.x = 1;
 		break;
 	case AYLP_T_MATRIX:
-		gsl_matrix_set_all(data->matrix, val);
+		if (!data->batched) gsl_matrix_set_all(data->matrix, val);
 		state->matrix = data->matrix;
 		state->header.type = self->type_out;
 		state->header.log_dim.y = data->matrix->size1;
@@ -156,6 +231,27 @@ int test_source_proc(struct aylp_device *self, struct aylp_state *state)
 		state->header.log_dim.y = data->matrix->size1;
 		state->header.log_dim.x = data->matrix->size2;
 		break;
+	case AYLP_T_MATRIX_USHORT:
+		gsl_matrix_ushort_set_all(data->matrix_ushort,
+			(val+1)/2 * USHRT_MAX
+		);
+		state->matrix_ushort = data->matrix_ushort;
+		state->header.log_dim.y = data->matrix_ushort->size1;
+		state->header.log_dim.x = data->matrix_ushort->size2;
+		break;
+	case AYLP_T_VECTOR_FLOAT:
+		gsl_vector_float_set_all(data->vector_float, val);
+		state->vector_float = data->vector_float;
+		state->header.log_dim.y = data->vector_float->size;
+		state->header.log_dim.x = 1;
+		break;
+	case AYLP_T_MATRIX_FLOAT:
+		if (!data->batched)
+			gsl_matrix_float_set_all(data->matrix_float, val);
+		state->matrix_float = data->matrix_float;
+		state->header.log_dim.y = data->matrix_float->size1;
+		state->header.log_dim.x = data->matrix_float->size2;
+		break;
 	}
 	state->header.type = self->type_out;
 	state->header.units = self->units_out;
@@ -169,10 +265,22 @@ int test_source_fini(struct aylp_device *self)
 	struct aylp_test_source_data *data = self->device_data;
 	switch (data->type) {
 	case AYLP_T_VECTOR:
-		xfree_type(gsl_vector, data->vector);
+		xfree_aligned_type(gsl_vector, data->vector);
 		break;
 	case AYLP_T_MATRIX:
-		xfree_type(gsl_matrix, data->matrix);
+		xfree_aligned_type(gsl_matrix, data->matrix);
+		break;
+	case AYLP_T_MATRIX_UCHAR:
+		xfree_aligned_type(gsl_matrix_uchar, data->matrix_uchar);
+		break;
+	case AYLP_T_MATRIX_USHORT:
+		xfree_aligned_type(gsl_matrix_ushort, data->matrix_ushort);
+		break;
+	case AYLP_T_VECTOR_FLOAT:
+		xfree_aligned_type(gsl_vector_float, data->vector_float);
+		break;
+	case AYLP_T_MATRIX_FLOAT:
+		xfree_aligned_type(gsl_matrix_float, data->matrix_float);
 		break;
 	}
 	xfree(data);
@@ -4,7 +4,8 @@
 #include "anyloop.h"
 
 struct aylp_test_source_data {
-	// one of ["vector", "matrix", "matrix_uchar"]
+	// one of ["vector", "matrix", "matrix_uchar", "matrix_ushort",
+	// "vector_float", "matrix_float"]
 	aylp_type type;
 	// one of ["constant", "sine"]
 	unsigned kind;
@@ -24,14 +25,22 @@ struct aylp_test_source_data {
 		gsl_vector *vector;
 		gsl_matrix *matrix;
 		gsl_matrix_uchar *matrix_uchar;
+		gsl_matrix_ushort *matrix_ushort;
+		gsl_vector_float *vector_float;
+		gsl_matrix_float *matrix_float;
 	};
 	// accumulator
 	size_t acc;
+	// whether we're batching vectors as the columns of a matrix
+	bool batched;
 };
 
 // initialize test_source device
 int test_source_init(struct aylp_device *self);
 
+// declare the shape of test_source output
+int test_source_shape(struct aylp_device *self, struct aylp_shape *shape);
+
 // process test_source device once per loop
 int test_source_proc(struct aylp_device *self, struct aylp_state *state);
 
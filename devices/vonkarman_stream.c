@@ -60,7 +60,7 @@ static int generate_phase_screen(struct aylp_device *self)
 	// We assume we're making a square phase screen; this is generally a
 	// good idea (see https://doi.org/10.1364/AO.37.004605), but this could
 	// be changed here if one wishes.
-	data->phase_screen = gsl_matrix_alloc(
+	data->phase_screen = xmalloc_aligned_type(gsl_matrix,
 		data->screen_size,
 		data->screen_size
 	);
@@ -159,6 +159,7 @@ static int generate_phase_screen(struct aylp_device *self)
 int vonkarman_stream_init(struct aylp_device *self)
 {
 	self->proc = &vonkarman_stream_proc;
+	self->shape = &vonkarman_stream_shape;
 	self->fini = &vonkarman_stream_fini;
 	self->device_data = xcalloc(1,
 		sizeof(struct aylp_vonkarman_stream_data)
@@ -286,6 +287,15 @@ int vonkarman_stream_init(struct aylp_device *self)
 }
 
 
+int vonkarman_stream_shape(struct aylp_device *self, struct aylp_shape *shape)
+{
+	struct aylp_vonkarman_stream_data *data = self->device_data;
+	shape->y = data->win_height;
+	shape->x = data->win_width;
+	return 0;
+}
+
+
 int vonkarman_stream_proc(struct aylp_device *self, struct aylp_state *state)
 {
 	// move along the screen, not calculating wind speed, just relying on
@@ -329,7 +339,7 @@ int vonkarman_stream_fini(struct aylp_device *self)
 {
 	struct aylp_vonkarman_stream_data *data = self->device_data;
 	xfree_type(gsl_rng, data->rng);
-	xfree_type(gsl_matrix, data->phase_screen);
+	xfree_aligned_type(gsl_matrix, data->phase_screen);
 	xfree(data);
 	return 0;
 }
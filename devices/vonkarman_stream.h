@@ -37,6 +37,9 @@ struct aylp_vonkarman_stream_data {
 // initialize vonkarman_stream device
 int vonkarman_stream_init(struct aylp_device *self);
 
+// declare the shape of vonkarman_stream output
+int vonkarman_stream_shape(struct aylp_device *self, struct aylp_shape *shape);
+
 // process vonkarman_stream device once per loop
 int vonkarman_stream_proc(struct aylp_device *self, struct aylp_state *state);
 
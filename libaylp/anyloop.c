@@ -9,7 +9,11 @@
 #include "logging.h"
 #include "config.h"
 #include "xalloc.h"
+#include "pacer.h"
 #include "profile.h"
+#include "realtime.h"
+#include "stages.h"
+#include "thread_pool.h"
 #include "../devices/device.h"
 
 const char *help_msg = "\nUsage: `anyloop [options] your_config_file.json`\n"
@@ -17,14 +21,17 @@ const char *help_msg = "\nUsage: `anyloop [options] your_config_file.json`\n"
 	"-h/--help               print this help message and exit\n"
 	"-l/--loglevel <level>   set log level\n"
 	"-p/--profile            enable profiling\n"
+	"-r/--realtime           use SCHED_FIFO, pin threads, and lock memory\n"
 	"Allowed log levels: TRACE, DEBUG, INFO, WARN, ERROR, FATAL\n"
 	"Example: `anyloop -pl TRACE contrib/conf_example1.json\n"
 ;
 
 struct aylp_state state = {0};
 struct aylp_conf conf = {0};
+// shared by all devices; see struct aylp_device
+static struct aylp_pool pool;
 
-static bool sigint_received = false;
+static volatile bool sigint_received = false;
 
 static void cleanup(void)
 {
@@ -42,7 +49,12 @@ static void cleanup(void)
 		}
 	}
 	conf.n_devices = 0;
+	pool_stop(&pool);
 	xfree(conf.devices);
+	xfree(conf.loop.stage_starts);
+	xfree(conf.loop.stage_shapes);
+	xfree(conf.realtime.cpus);
+	xfree(conf.pool.cpus);
 	// we actually *don't* want to free the state block/vector/matrix/etc,
 	// because it will never be the only pointer to that data, and will have
 	// been freed by whatever device really owns that data.
@@ -68,7 +80,7 @@ const char *aylp_type_to_string(aylp_type type)
 		break;
 	FOR_AYLP_TYPES(AYLP_TYPE_TO_STRING_MATCH_TYPE)
 	default:
-		log_error("Unknown type 0x%hhX", type);
+		log_error("Unknown type 0x%hX", type);
 		return "NONE";
 	}
 }
@@ -139,6 +151,7 @@ static bool check_opt(char **arg, char opt_short, char *opt_long,
 int main(int argc, char **argv)
 {
 	bool profile_mode = false;
+	bool realtime_mode = false;
 	int err;
 	// initialize logger with default level
 	log_init(LOG_INFO);
@@ -176,6 +189,9 @@ int main(int argc, char **argv)
 		if (check_opt(argv+i, 'p', "profile", 0, &remain)) {
 			profile_mode = true;
 		}
+		if (check_opt(argv+i, 'r', "realtime", 0, &remain)) {
+			realtime_mode = true;
+		}
 		// add more check_opt calls for new options
 
 		// if there are chars remaining that we didn't parse and they
@@ -200,6 +216,20 @@ int main(int argc, char **argv)
 		}
 	}
 
+	// set up realtime scheduling before devices start any threads
+	if (realtime_mode)
+		conf.realtime.enabled = true;
+	realtime_init(&conf.realtime);
+
+	// start the shared worker pool before devices want to use it
+	if (pool_start(&pool,
+		conf.pool.n_threads, conf.pool.cpus, conf.pool.n_cpus
+	)) {
+		log_fatal("Could not start worker threads.");
+		cleanup();
+		return EXIT_FAILURE;
+	}
+
 	struct sigaction signal_handler;
 	signal_handler.sa_flags = SA_SIGINFO;
 	sigemptyset(&signal_handler.sa_mask);
@@ -209,6 +239,9 @@ int main(int argc, char **argv)
 		return EXIT_FAILURE;
 	}
 
+	// devices allocate their buffers from init() on
+	if (conf.hugepages) xalloc_use_hugepages();
+
 	// initialize all devices
 	for (size_t idx=0; idx<conf.n_devices; idx++) {
 		if (!conf.devices[idx].uri) {
@@ -218,6 +251,8 @@ int main(int argc, char **argv)
 			);
 			return EXIT_FAILURE;
 		}
+		conf.devices[idx].pool = &pool;
+		conf.devices[idx].batch = conf.loop.batch;
 		if (init_device(&conf.devices[idx])) {
 			log_fatal("Could not initialize %s.",
 				conf.devices[idx].uri
@@ -229,22 +264,41 @@ int main(int argc, char **argv)
 		}
 	}
 
-	// typecheck the device pipeline
+	// typecheck the device pipeline, working out the shape of the data
+	// along the way so devices can allocate for it now
 	aylp_type type_cur = AYLP_T_NONE;
 	aylp_units units_cur = AYLP_U_NONE;
-	// first device must be compatible with _NONE and output of last device
-	type_cur |= conf.devices[conf.n_devices-1].type_out;
-	units_cur |= conf.devices[conf.n_devices-1].units_out;
+	if (conf.loop.n_stages == 1) {
+		// first device must be compatible with _NONE and output of
+		// last device
+		type_cur |= conf.devices[conf.n_devices-1].type_out;
+		units_cur |= conf.devices[conf.n_devices-1].units_out;
+	} else if (conf.devices[0].type_in != AYLP_T_ANY
+	|| conf.devices[0].type_out == AYLP_T_UNCHANGED) {
+		// the output of the last stage never comes back around, so
+		// nothing can be fed back to the first device
+		log_fatal("With pipeline stages, the first device must be a "
+			"source that ignores its input, but %s is not",
+			conf.devices[0].uri
+		);
+		cleanup();
+		return EXIT_FAILURE;
+	}
+	struct aylp_shape shape = {0};
+	conf.loop.stage_shapes = xcalloc(conf.loop.n_stages,
+		sizeof(struct aylp_shape)
+	);
+	size_t stage = 0;
 	for (size_t idx=0; idx<conf.n_devices; idx++) {
 		struct aylp_device d = conf.devices[idx];	// brevity
-		log_trace("type check: prev=0x%hhX, in=0x%hhX, out=0x%hhX",
+		log_trace("type check: prev=0x%hX, in=0x%hX, out=0x%hX",
 			type_cur, d.type_in, d.type_out
 		);
 		// typecheck fails if any of the bits set in type_cur are not
 		// set in type_in
 		if (type_cur & ~d.type_in) {
-			log_fatal("Device %s with input type 0x%hhX "
-				"is incompatible with previous type 0x%hhX",
+			log_fatal("Device %s with input type 0x%hX "
+				"is incompatible with previous type 0x%hX",
 				d.uri, d.type_in, type_cur
 			);
 			return EXIT_FAILURE;
@@ -259,45 +313,69 @@ int main(int argc, char **argv)
 			);
 			return EXIT_FAILURE;
 		}
+		shape.type = type_cur;
+		if (d.shape) {
+			struct aylp_shape in = shape;
+			if (d.shape(&conf.devices[idx], &shape)) {
+				log_fatal("Device %s is incompatible with "
+					"input of shape %zux%zu",
+					d.uri, in.y, in.x
+				);
+				cleanup();
+				return EXIT_FAILURE;
+			}
+		} else if (d.type_out) {
+			shape.y = 0;
+			shape.x = 0;
+		}
+		log_trace("shape check: out=%zux%zu", shape.y, shape.x);
 		if (d.type_out)
 			type_cur = d.type_out;
 		if (d.units_out)
 			units_cur = d.units_out;
+		if (stage < conf.loop.n_stages-1
+		&& idx+1 == conf.loop.stage_starts[stage]) {
+			conf.loop.stage_shapes[stage] = shape;
+			conf.loop.stage_shapes[stage++].type = type_cur;
+		}
 	}
 
 	struct profile profile = {0};
 	if (profile_mode)
 		profile = profile_new(&conf);
 
-	while (!sigint_received && state.header.status ^ AYLP_DONE) {
-		for (size_t d=0; !sigint_received && d<conf.n_devices; d++) {
-			struct aylp_device *dev = &conf.devices[d];
-			if (dev->proc) {
-				if (profile_mode)
-					profile_begin_for_device(&profile, d);
-				err = dev->proc(dev, &state);
-				if (profile_mode)
-					profile_end_for_device(&profile, d);
-
-				// errors are assumed recoverable (e.g. UDP
-				// fails to send) unless the device was supposed
-				// to change the type
-				if (err && dev->type_out
-				&& dev->type_out != dev->type_in) {
-					log_fatal("%s returned error %d but "
-						"was expected to change the "
-						"pipeline type. Exiting.",
-						dev->uri, err
-					);
-					cleanup();
-					return EXIT_FAILURE;
-				}
-				// this logging call could be too much overhead
-				// even when log level is above trace, but I
-				// doubt it
-				log_trace("Processed %s", dev->uri);
-			} else {
-				log_trace("Not processing %s", dev->uri);
+	struct pacer pacer = pacer_new(&conf);
+
+	// Only now that every worker thread has started: threads inherit the
+	// affinity and policy of whoever creates them, and workers without
+	// cpus of their own must not end up stuck on the loop cpu.
+	realtime_setup_loop_thread(0);
+	// last thing before the loop: no page faults from here on out
+	realtime_lock_memory();
+
+	struct profile *prof = profile_mode ? &profile : 0;
+	if (conf.loop.n_stages > 1) {
+		err = stages_run(&conf, &state, prof, &pacer,
+			&sigint_received
+		);
+		if (err) {
+			cleanup();
+			return EXIT_FAILURE;
+		}
+	} else {
+		// whatever gets reallocated in the loop comes from the heap,
+		// since the arena never gets anything back
+		xalloc_close_hugepages();
+		while (!sigint_received && !(state.header.status & AYLP_DONE)) {
+			if (pacer.enabled)
+				pacer_wait(&pacer);
+			pacer_stamp(&pacer, &state.header);
+			err = stage_proc(&conf, 0, conf.n_devices, &state,
+				prof, &sigint_received
+			);
+			if (err) {
+				cleanup();
+				return EXIT_FAILURE;
 			}
 		}
 	}
@@ -311,6 +389,7 @@ int main(int argc, char **argv)
 		profile_summary(&profile);
 		profile_free(&profile);
 	}
+	pacer_summary(&pacer);
 
 	cleanup();
 	log_info("Exiting now!");
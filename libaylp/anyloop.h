@@ -3,6 +3,7 @@
 
 #define _GNU_SOURCE
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -48,6 +49,12 @@ typedef uint8_t aylp_status;
 enum {
 	/** Signals that we are done with the loop. */
 	AYLP_DONE	= 1 << 0,
+	/** Signals that the pipeline data is scratch space: the device that
+	* made it rewrites all of it each iteration and never reads it back.
+	* The next device may then overwrite it in place, instead of copying it
+	* into a buffer of its own. The loop keeps this up to date after each
+	* device (see aylp_device.scratch_out), so devices only read it. */
+	AYLP_MUTABLE	= 1 << 1,
 	// add more as necessary
 };
 
@@ -57,7 +64,7 @@ enum {
  * inputting and the types they may output. Null is a special type that means
  * "unaltered" when set as a device output.
  */
-typedef uint8_t aylp_type;
+typedef uint16_t aylp_type;
 enum {
 	/** As device output, indicates that type is unchanged from before. */
 	AYLP_T_UNCHANGED	= 0,
@@ -75,10 +82,14 @@ enum {
 	AYLP_T_MATRIX_UCHAR	= 1 << 5,
 	/** For gsl_matrix_ushort. */
 	AYLP_T_MATRIX_USHORT	= 1 << 6,
+	/** For gsl_vector_float. */
+	AYLP_T_VECTOR_FLOAT	= 1 << 7,
+	/** For gsl_matrix_float. */
+	AYLP_T_MATRIX_FLOAT	= 1 << 8,
 	/** Used to signal compatibility with any (gsl) type.
 	* Devices must also set AYLP_U_ANY to be compatible with any aylp_type.
 	*/
-	AYLP_T_ANY	= 0xFF,
+	AYLP_T_ANY	= 0xFFFF,
 	// add more as necessary
 };
 // https://en.wikipedia.org/wiki/X_macro
@@ -90,6 +101,9 @@ enum {
 	DO(AYLP_T_MATRIX, matrix) \
 	DO(AYLP_T_BLOCK_UCHAR, block_uchar) \
 	DO(AYLP_T_MATRIX_UCHAR, matrix_uchar) \
+	DO(AYLP_T_MATRIX_USHORT, matrix_ushort) \
+	DO(AYLP_T_VECTOR_FLOAT, vector_float) \
+	DO(AYLP_T_MATRIX_FLOAT, matrix_float) \
 	DO(AYLP_T_ANY, any)
 
 
@@ -129,8 +143,11 @@ enum {
 /** Little-endian representation of "AYLP" as a magic number. */
 #define AYLP_MAGIC 0x504C5941
 
-/** Schema version (null means unstable). */
-#define AYLP_SCHEMA_VERSION 0
+/** Schema version. Bumped whenever the layout of aylp_header changes, so that
+* files written with another layout are rejected instead of misread.
+* 0: the original 40-byte header, with an 8-bit type.
+* 1: 64 bytes, with a 16-bit type, padding, and the frame and timestamp. */
+#define AYLP_SCHEMA_VERSION 1
 
 /**
  * Status of loop and header for saved data files.
@@ -145,9 +162,14 @@ struct aylp_header {
 	/** Schema version, status flags, and type of data. */
 	uint8_t version;
 	aylp_status status;	// uint8_t
-	aylp_type type;		// uint8_t
+	aylp_type type;		// uint16_t
 	aylp_units units;	// uint8_t
 
+	/** Unused. Pads the header to a multiple of 8 bytes, so that the data
+	* after it in a file is aligned, and can be used in place when
+	* mapped. */
+	uint8_t reserved[7];
+
 	/** Logical dimensions (like the size of a matrix).
 	* For example, commands to a DM might usually be seen as vectors, but
 	* in reality have some logical x,y dimensions, which can be important.
@@ -164,7 +186,19 @@ struct aylp_header {
 		double y;
 		double x;
 	} pitch;
+
+	/** Iteration this frame came from, counting from 0, and when that
+	* iteration started (CLOCK_MONOTONIC, in nanoseconds). Both are set by
+	* the loop before the first device runs. Devices that need the time
+	* should use this rather than reading the clock themselves, so that
+	* they all agree on it and the loop makes one syscall, not one per
+	* device. */
+	uint64_t frame;
+	uint64_t timestamp;
 }__attribute__((packed));
+_Static_assert(sizeof(struct aylp_header) % 8 == 0,
+	"aylp_header must keep file data 8-byte aligned"
+);
 
 
 /** State of the system.
@@ -190,10 +224,33 @@ struct aylp_state {
 		gsl_matrix *matrix;
 		gsl_block_uchar *block_uchar;
 		gsl_matrix_uchar *matrix_uchar;
+		gsl_matrix_ushort *matrix_ushort;
+		gsl_vector_float *vector_float;
+		gsl_matrix_float *matrix_float;
 	};
 };
 
 
+// see thread_pool.h
+struct aylp_pool;
+
+
+/** Shape of the pipeline data between two devices, as worked out at startup.
+ * The typecheck walks the pipeline with one of these, so that devices can
+ * allocate for the data they will get before the loop starts (see shape() in
+ * aylp_device).
+ */
+struct aylp_shape {
+	/** Type of the data, as far as the typecheck knows. */
+	aylp_type type;
+	/** Logical dimensions of the data, as in aylp_header.log_dim; vectors
+	* and blocks have y*x elements. Zero if they can't be known until the
+	* data arrives. */
+	size_t y;
+	size_t x;
+};
+
+
 /** Device struct.
  * How this is interpreted is up to the specific device. Devices are expected to
  * attach their proc() and fini() functions upon initialization, if such
@@ -244,6 +301,110 @@ struct aylp_device {
 
 	/** Optional pointer to allow devices to store private data. */
 	void *device_data;
+
+	/** Worker pool shared by all devices, set before init() is called.
+	* Devices can spread work over it with aylp_parallel_for() (see
+	* thread_pool.h) instead of starting threads of their own. It has no
+	* workers unless the top-level "threads" config is set, in which case
+	* aylp_parallel_for() just runs everything on the calling thread. */
+	struct aylp_pool *pool;
+
+	/** Frames per loop iteration (see aylp_loop_conf), set before init()
+	* is called. Above 1, devices that support batching take or give a
+	* T_MATRIX (or T_MATRIX_FLOAT) with one frame per column wherever they
+	* would otherwise take or give a T_VECTOR (or T_VECTOR_FLOAT). */
+	size_t batch;
+
+	/** Whether the buffers this device points the pipeline data at are
+	* scratch space (see AYLP_MUTABLE), set in init(). After each proc(),
+	* if the device repointed the pipeline data, the loop sets AYLP_MUTABLE
+	* to this; if it didn't (e.g. it only read the data, or overwrote it in
+	* place), the flag is left as it was. */
+	bool scratch_out;
+
+	/** Shape function.
+	* Called once per device in pipeline order during the typecheck, after
+	* every device has been initialized, with the shape of the data coming
+	* in (unknown for the first device). The device should check it,
+	* allocate whatever it needs to process data of that shape, and
+	* overwrite y and x with the shape of its output (the type is updated
+	* by the loop). Returns nonzero if the device can't take the shape.
+	* Can be null, in which case the shape is passed through if type_out is
+	* AYLP_T_UNCHANGED, and is unknown after the device otherwise. Devices
+	* must still cope with sizes they haven't seen in proc(), as the shape
+	* may have been unknown. */
+	int (*shape)(struct aylp_device *self, struct aylp_shape *shape);
+};
+
+
+/** Loop timing configuration.
+ * Parsed from the optional top-level "loop" object of the config file.
+ */
+struct aylp_loop_conf {
+	/** Target loop rate in Hz. Zero means run as fast as possible. */
+	double rate_hz;
+
+	/** How long to busy-wait before each deadline, in nanoseconds.
+	* We sleep with clock_nanosleep() until this long before the deadline,
+	* then spin on the clock for the rest, trading CPU time for jitter. */
+	long spin_ns;
+
+	/** Number of pipeline stages; 1 means run everything sequentially.
+	* With more than one stage, each stage runs on its own thread and hands
+	* frames to the next through a ring of ring_slots state slots. */
+	size_t n_stages;
+
+	/** Index of the first device of each stage after the first.
+	* Has n_stages-1 elements, in strictly increasing order. */
+	size_t *stage_starts;
+
+	/** Number of slots in the ring between each pair of stages. */
+	size_t ring_slots;
+
+	/** Shape of the data going into each stage after the first, as worked
+	* out by the typecheck, so the rings can allocate their slots before
+	* the loop starts. Has n_stages-1 elements. */
+	struct aylp_shape *stage_shapes;
+
+	/** Number of frames each iteration processes at once; 1 by default.
+	* For offline runs, where latency doesn't matter, batching lets e.g.
+	* matrix-vector products become faster matrix-matrix products. */
+	size_t batch;
+};
+
+
+/** Realtime configuration.
+ * Parsed from the optional top-level "realtime" object of the config file.
+ */
+struct aylp_rt_conf {
+	/** Whether to do any of this; also set by -r/--realtime. */
+	bool enabled;
+
+	/** SCHED_FIFO priority for the loop threads and worker threads. */
+	int priority;
+
+	/** CPUs to pin loop threads to (the main thread gets cpus[0], and
+	* pipeline stage i gets cpus[i % n_cpus]). Unpinned if n_cpus is 0. */
+	size_t n_cpus;
+	int *cpus;
+
+	/** Whether to mlockall() and prefault before the first iteration. */
+	bool lock_memory;
+};
+
+
+/** Shared worker pool configuration.
+ * Parsed from the optional top-level "threads" and "cpus" config keys.
+ */
+struct aylp_pool_conf {
+	/** Number of worker threads to start, in addition to the loop threads.
+	* Zero means devices do all their work on the loop threads. */
+	size_t n_threads;
+
+	/** CPUs to pin the worker threads to, round-robin. Unpinned if n_cpus
+	* is 0. */
+	size_t n_cpus;
+	int *cpus;
 };
 
 
@@ -256,6 +417,19 @@ struct aylp_conf {
 
 	/** Array of aylp_device objects. */
 	struct aylp_device *devices;
+
+	/** Loop timing. */
+	struct aylp_loop_conf loop;
+
+	/** Realtime scheduling and memory settings. */
+	struct aylp_rt_conf realtime;
+
+	/** Shared worker pool. */
+	struct aylp_pool_conf pool;
+
+	/** Whether pipeline buffers go in hugepages (see xalloc.h). Parsed
+	* from the optional top-level "hugepages" config key. */
+	bool hugepages;
 };
 
 
@@ -105,8 +105,80 @@ int get_contiguous_bytes(gsl_block_uchar *bytes, struct aylp_state *state)
 			return 1;
 		}
 	}
+	case AYLP_T_MATRIX_USHORT: {
+		gsl_matrix_ushort *m = state->matrix_ushort;
+		size_t row_size = sizeof(unsigned short) * m->size2;
+		bytes->size = row_size * m->size1;
+		if (LIKELY(m->tda == m->size2)) {
+			// rows are contiguous
+			bytes->data = (unsigned char *)m->data;
+			log_trace("got contiguous matrix of %zu by %zu ushorts",
+				m->size1, m->size2
+			);
+			return 0;
+		} else {
+			// rows are not contiguous
+			bytes->data = xmalloc(bytes->size);
+			log_trace("got non-contiguous matrix of %zu by %zu "
+				"ushorts", m->size1, m->size2
+			);
+			for (size_t i = 0; i < m->size1; i++) {
+				memcpy(bytes->data + i*row_size,
+					m->data + i*m->tda, row_size
+				);
+			}
+			return 1;
+		}
+	}
+	case AYLP_T_VECTOR_FLOAT: {
+		gsl_vector_float *v = state->vector_float;
+		bytes->size = sizeof(float) * v->size;
+		if (LIKELY(v->stride == 1)) {
+			bytes->data = (unsigned char *)v->data;
+			log_trace("got contiguous vector of %zu floats",
+				v->size
+			);
+			return 0;
+		} else {
+			bytes->data = xmalloc(bytes->size);
+			for (size_t i = 0; i < v->size; i++) {
+				memcpy(bytes->data + i*sizeof(float),
+					v->data + i*v->stride, sizeof(float)
+				);
+			}
+			log_trace("got non-contiguous vector of %zu floats",
+				v->size
+			);
+			return 1;
+		}
+	}
+	case AYLP_T_MATRIX_FLOAT: {
+		gsl_matrix_float *m = state->matrix_float;
+		size_t row_size = sizeof(float) * m->size2;
+		bytes->size = row_size * m->size1;
+		if (LIKELY(m->tda == m->size2)) {
+			// rows are contiguous
+			bytes->data = (unsigned char *)m->data;
+			log_trace("got contiguous matrix of %zu by %zu floats",
+				m->size1, m->size2
+			);
+			return 0;
+		} else {
+			// rows are not contiguous
+			bytes->data = xmalloc(bytes->size);
+			log_trace("got non-contiguous matrix of %zu by %zu "
+				"floats", m->size1, m->size2
+			);
+			for (size_t i = 0; i < m->size1; i++) {
+				memcpy(bytes->data + i*row_size,
+					m->data + i*m->tda, row_size
+				);
+			}
+			return 1;
+		}
+	}
 	default: {
-		log_fatal("Bug: unsupported type 0x%hhX", state->header.type);
+		log_fatal("Bug: unsupported type 0x%hX", state->header.type);
 		exit(EXIT_FAILURE);
 		return -1;
 	}
@@ -6,9 +6,113 @@
 #include "xalloc.h"
 
 
+static void parse_loop(struct aylp_loop_conf *loop, json_object *jobj)
+{
+	if (!json_object_is_type(jobj, json_type_object)) {
+		log_fatal("Loop object must be object");
+		exit(1);
+	}
+	json_object_object_foreach(jobj, key, val) {
+		if (key[0] == '_') {
+			// it's a comment
+		} else if (!strcmp(key, "rate_hz")) {
+			loop->rate_hz = json_object_get_double(val);
+			log_info("Loop rate: %G Hz", loop->rate_hz);
+			// anything faster would make the period round to 0 ns
+			if (!(loop->rate_hz >= 0 && loop->rate_hz <= 1E9)) {
+				log_fatal(
+					"Loop rate must be between 0 and 1E9 Hz"
+				);
+				exit(1);
+			}
+		} else if (!strcmp(key, "spin_ns")) {
+			loop->spin_ns = json_object_get_int64(val);
+			log_info("Loop spin time: %ld ns", loop->spin_ns);
+			if (loop->spin_ns < 0) {
+				log_fatal(
+					"Loop spin time must not be negative"
+				);
+				exit(1);
+			}
+		} else if (!strcmp(key, "stages")) {
+			if (!json_object_is_type(val, json_type_array)) {
+				log_fatal("Stages object must be array");
+				exit(1);
+			}
+			size_t n = json_object_array_length(val);
+			loop->n_stages = n + 1;
+			loop->stage_starts = xcalloc(n + 1, sizeof(size_t));
+			for (size_t i = 0; i < n; i++) {
+				loop->stage_starts[i] = json_object_get_uint64(
+					json_object_array_get_idx(val, i)
+				);
+			}
+			log_info("Loop stages: %zu", loop->n_stages);
+		} else if (!strcmp(key, "ring_slots")) {
+			loop->ring_slots = json_object_get_uint64(val);
+			log_info("Loop ring slots: %zu", loop->ring_slots);
+		} else if (!strcmp(key, "batch")) {
+			loop->batch = json_object_get_uint64(val);
+			log_info("Loop batch: %zu frames", loop->batch);
+		} else {
+			log_warn("Unknown loop key: \"%s\"", key);
+		}
+	}
+}
+
+
+// parse a json array of integers into a newly allocated array
+static size_t parse_int_array(int **arr, json_object *jobj)
+{
+	if (!json_object_is_type(jobj, json_type_array)) {
+		log_fatal("Expected an array of integers");
+		exit(1);
+	}
+	size_t n = json_object_array_length(jobj);
+	*arr = xcalloc(n + 1, sizeof(int));
+	for (size_t i = 0; i < n; i++) {
+		(*arr)[i] = json_object_get_int(
+			json_object_array_get_idx(jobj, i)
+		);
+	}
+	return n;
+}
+
+
+static void parse_realtime(struct aylp_rt_conf *rt, json_object *jobj)
+{
+	if (!json_object_is_type(jobj, json_type_object)) {
+		log_fatal("Realtime object must be object");
+		exit(1);
+	}
+	json_object_object_foreach(jobj, key, val) {
+		if (key[0] == '_') {
+			// it's a comment
+		} else if (!strcmp(key, "enabled")) {
+			rt->enabled = json_object_get_boolean(val);
+			log_info("Realtime enabled: %d", rt->enabled);
+		} else if (!strcmp(key, "priority")) {
+			rt->priority = json_object_get_int(val);
+			log_info("Realtime priority: %d", rt->priority);
+		} else if (!strcmp(key, "cpus")) {
+			rt->n_cpus = parse_int_array(&rt->cpus, val);
+			log_info("Realtime loop cpus: %zu", rt->n_cpus);
+		} else if (!strcmp(key, "lock_memory")) {
+			rt->lock_memory = json_object_get_boolean(val);
+			log_info("Realtime lock memory: %d", rt->lock_memory);
+		} else {
+			log_warn("Unknown realtime key: \"%s\"", key);
+		}
+	}
+}
+
+
 struct aylp_conf read_config(const char *file)
 {
 	struct aylp_conf ret = {0};
+	// defaults that aren't zero
+	ret.realtime.priority = 50;
+	ret.realtime.lock_memory = true;
 
 	log_info("Opening config file \"%s\"", file);
 	struct json_object *jobj = json_object_from_file(file);
@@ -66,11 +170,45 @@ struct aylp_conf read_config(const char *file)
 					}
 				}
 			}
+		} else if (!strcmp(tlkey, "loop")) {
+			// parse loop timing and staging settings
+			parse_loop(&ret.loop, sub1);
+		} else if (!strcmp(tlkey, "realtime")) {
+			// parse realtime scheduling settings
+			parse_realtime(&ret.realtime, sub1);
+		} else if (!strcmp(tlkey, "threads")) {
+			// size of the shared worker pool
+			ret.pool.n_threads = json_object_get_uint64(sub1);
+			log_info("Worker threads: %zu", ret.pool.n_threads);
+		} else if (!strcmp(tlkey, "cpus")) {
+			// where to pin the shared worker pool
+			ret.pool.n_cpus = parse_int_array(&ret.pool.cpus, sub1);
+			log_info("Worker cpus: %zu", ret.pool.n_cpus);
+		} else if (!strcmp(tlkey, "hugepages")) {
+			// where to put pipeline buffers
+			ret.hugepages = json_object_get_boolean(sub1);
+			log_info("Hugepages: %d", ret.hugepages);
 		} else {
 			log_warn("Unknown config key: \"%s\"", tlkey);
 		}
 	}
 
+	// check stage boundaries now that we know how many devices there are
+	if (!ret.loop.n_stages) ret.loop.n_stages = 1;
+	if (!ret.loop.ring_slots) ret.loop.ring_slots = 2;
+	if (!ret.loop.batch) ret.loop.batch = 1;
+	for (size_t i = 0; i < ret.loop.n_stages - 1; i++) {
+		size_t start = ret.loop.stage_starts[i];
+		size_t prev = i ? ret.loop.stage_starts[i-1] : 0;
+		if (start <= prev || start >= ret.n_devices) {
+			log_fatal("Stage %zu starts at device %zu, but stages "
+				"must start in increasing order at devices "
+				"1 through %zu", i+1, start, ret.n_devices-1
+			);
+			exit(1);
+		}
+	}
+
 	log_info("Config file parsed");
 
 	// cleanup
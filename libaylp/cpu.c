@@ -0,0 +1,15 @@
+#include <stdbool.h>
+
+#include "cpu.h"
+
+
+// AVX2 chips without FMA don't exist in practice, but check both anyway
+bool cpu_has_avx2_fma(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+	return false;
+#endif
+}
@@ -0,0 +1,11 @@
+#ifndef AYLP_CPU_H_
+#define AYLP_CPU_H_
+
+#include <stdbool.h>
+
+/** Whether this CPU can run the AVX2 and FMA kernels that the *_kernels.c
+* files build with __attribute__((target("avx2,fma"))). Always false when not
+* building for x86. */
+bool cpu_has_avx2_fma(void);
+
+#endif
@@ -0,0 +1,358 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <gsl/gsl_errno.h>
+#include <gsl/gsl_matrix.h>
+#include <json-c/json.h>
+
+#include "anyloop.h"
+#include "load.h"
+#include "logging.h"
+#include "xalloc.h"
+
+
+// check the magic number and schema version of a header
+static int check_header(const struct aylp_header *head)
+{
+	if (head->magic != AYLP_MAGIC) {
+		log_error("File provided is not an AYLP file.");
+		return -1;
+	} else if (head->version != AYLP_SCHEMA_VERSION) {
+		log_error("File provided has different AYLP_SCHEMA_VERSION "
+			"(we are %hhX, file is %hhX)",
+			AYLP_SCHEMA_VERSION, head->version
+		);
+		return -1;
+	}
+	return 0;
+}
+
+
+// open an AYLP file and read its header, leaving fp at the start of the data
+static FILE *open_aylp_file(const char *filename, struct aylp_header *head)
+{
+	// open input file
+	FILE *fp = fopen(filename, "r");
+	if (!fp) {
+		log_error("Couldn't open file %s: %s",
+			filename, strerror(errno)
+		);
+		return 0;
+	}
+	// grab header
+	size_t n = fread(head, 1, sizeof(struct aylp_header), fp);
+	if (n < sizeof(struct aylp_header)) {
+		log_error("Short read: %zu of %zu",
+			n, sizeof(struct aylp_header)
+		);
+		fclose(fp);
+		return 0;
+	}
+	// check header
+	if (check_header(head)) {
+		fclose(fp);
+		return 0;
+	}
+	return fp;
+}
+
+
+int load_matrix_from_file(gsl_matrix **mat, const char *filename)
+{
+	int err;
+	struct aylp_header head = {0};
+	FILE *fp = open_aylp_file(filename, &head);
+	if (!fp) return -1;
+	if (head.type != AYLP_T_MATRIX) {
+		log_error("Data in file is not of type AYLP_T_MATRIX.");
+		fclose(fp);
+		return -1;
+	}
+	// allocate and grab data
+	*mat = gsl_matrix_alloc(head.log_dim.y, head.log_dim.x);
+	err = gsl_matrix_fread(fp, *mat);
+	// close input file
+	fclose(fp);
+	if (err) {
+		log_error("Error in reading matrix: %s", gsl_strerror(err));
+		return -1;
+	}
+	return 0;
+}
+
+
+int load_matrix_from_json(gsl_matrix **mat, json_object *json_mat)
+{
+	errno = 0;
+	if (!json_object_is_type(json_mat, json_type_array)) {
+		log_error("Matrix passed in json must be a json array");
+		return -1;
+	}
+
+	size_t M = json_object_array_length(json_mat);
+	size_t N = 0;
+
+	json_object *row;
+	json_object *element;
+	for (size_t i = 0; i < M; i++) {
+		row = json_object_array_get_idx(json_mat, i);
+		if (!json_object_is_type(row, json_type_array)) {
+			log_error("Row %zu of matrix is not an array", i);
+			return -1;
+		}
+		size_t N_this = json_object_array_length(row);
+		if (!N) {
+			N = N_this;
+			*mat = gsl_matrix_alloc(M, N);
+			log_trace("Matrix is %zu by %zu", M, N);
+		} else if (N_this != N) {
+			log_error("Row %zu of matrix has length %zu, "
+				"but previous rows had length %zu", i, N_this, N
+			);
+			return -1;
+		}
+		for (size_t j = 0; j < N; j++) {
+			element = json_object_array_get_idx(row, j);
+			double x = json_object_get_double(element);
+			if (x != x) {
+				log_error("Found NaN at %zu,%zu", i, j);
+				if (errno) {
+					log_error("(errno was %d: %s)",
+						errno, strerror(errno)
+					);
+				}
+				return -1;
+			}
+			gsl_matrix_set(*mat, i, j, x);
+		}
+	}
+
+	return 0;
+}
+
+
+// Read an integer matrix from an AYLP file: either of the same type, or an
+// AYLP_T_MATRIX that we round and clamp to 0:max.
+#define DEFINE_LOAD_INT(sfx, SFX, max) \
+int load_matrix_##sfx##_from_file(gsl_matrix_##sfx **mat, \
+	const char *filename \
+){ \
+	int err; \
+	struct aylp_header head = {0}; \
+	FILE *fp = open_aylp_file(filename, &head); \
+	if (!fp) return -1; \
+	if (head.type == AYLP_T_MATRIX_##SFX) { \
+		*mat = gsl_matrix_##sfx##_alloc( \
+			head.log_dim.y, head.log_dim.x \
+		); \
+		err = gsl_matrix_##sfx##_fread(fp, *mat); \
+		fclose(fp); \
+		if (err) { \
+			log_error("Error in reading matrix: %s", \
+				gsl_strerror(err) \
+			); \
+			return -1; \
+		} \
+		return 0; \
+	} else if (head.type == AYLP_T_MATRIX) { \
+		gsl_matrix *m = gsl_matrix_alloc( \
+			head.log_dim.y, head.log_dim.x \
+		); \
+		err = gsl_matrix_fread(fp, m); \
+		fclose(fp); \
+		if (err) { \
+			log_error("Error in reading matrix: %s", \
+				gsl_strerror(err) \
+			); \
+			xfree_type(gsl_matrix, m); \
+			return -1; \
+		} \
+		*mat = gsl_matrix_##sfx##_alloc(m->size1, m->size2); \
+		for (size_t i = 0; i < m->size1; i++) { \
+			for (size_t j = 0; j < m->size2; j++) { \
+				double x = round(gsl_matrix_get(m, i, j)); \
+				if (!(x > 0)) x = 0; \
+				if (x > max) x = max; \
+				gsl_matrix_##sfx##_set(*mat, i, j, x); \
+			} \
+		} \
+		xfree_type(gsl_matrix, m); \
+		return 0; \
+	} \
+	log_error("Data in file is not of type AYLP_T_MATRIX_" #SFX \
+		" or AYLP_T_MATRIX." \
+	); \
+	fclose(fp); \
+	return -1; \
+}
+DEFINE_LOAD_INT(uchar, UCHAR, UCHAR_MAX)
+DEFINE_LOAD_INT(ushort, USHORT, USHRT_MAX)
+#undef DEFINE_LOAD_INT
+
+
+
+// Copy the data of a mapped file into anonymous memory for LOAD_MAP_HUGEPAGE.
+static void *copy_to_hugepages(const void *src, size_t size, size_t *len)
+{
+	void *p = map_hugepages(size, len);
+	if (p) memcpy(p, src, size);
+	return p;
+}
+
+
+int load_matrix_map(gsl_matrix **mat, struct load_map *map,
+	const char *filename, enum load_map_mode mode
+){
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		log_error("Couldn't open file %s: %s",
+			filename, strerror(errno)
+		);
+		return -1;
+	}
+	struct stat st;
+	if (fstat(fd, &st)) {
+		log_error("Couldn't stat file %s: %s",
+			filename, strerror(errno)
+		);
+		close(fd);
+		return -1;
+	}
+	size_t file_len = st.st_size;
+	if (file_len < sizeof(struct aylp_header)) {
+		log_error("Short file: %zu of %zu",
+			file_len, sizeof(struct aylp_header)
+		);
+		close(fd);
+		return -1;
+	}
+	// populate now, so that startup pays for the page faults, not the loop
+	char *file = mmap(0, file_len, PROT_READ, MAP_SHARED|MAP_POPULATE,
+		fd, 0
+	);
+	// the mapping holds its own reference to the file
+	close(fd);
+	if (file == MAP_FAILED) {
+		log_error("Couldn't map file %s: %s",
+			filename, strerror(errno)
+		);
+		return -1;
+	}
+
+	struct aylp_header head;
+	memcpy(&head, file, sizeof(head));
+	if (check_header(&head)) {
+		munmap(file, file_len);
+		return -1;
+	}
+	if (head.type != AYLP_T_MATRIX) {
+		log_error("Data in file is not of type AYLP_T_MATRIX.");
+		munmap(file, file_len);
+		return -1;
+	}
+	size_t size = head.log_dim.y * head.log_dim.x * sizeof(double);
+	if (!size || file_len - sizeof(head) < size) {
+		log_error("File %s is too short for a %llux%llu matrix",
+			filename, head.log_dim.y, head.log_dim.x
+		);
+		munmap(file, file_len);
+		return -1;
+	}
+	char *data = file + sizeof(head);
+
+	if (mode == LOAD_MAP_SHARED) {
+		madvise(file, file_len, MADV_WILLNEED);
+		map->addr = file;
+		map->len = file_len;
+	} else {
+		map->addr = copy_to_hugepages(data, size, &map->len);
+		munmap(file, file_len);
+		if (!map->addr) return -1;
+		data = map->addr;
+	}
+
+	// a view, so gsl doesn't try to free the data itself
+	*mat = xmalloc(sizeof(gsl_matrix));
+	**mat = (gsl_matrix){
+		.size1 = head.log_dim.y,
+		.size2 = head.log_dim.x,
+		.tda = head.log_dim.x,
+		.data = (double *)data,
+		.block = 0,
+		.owner = 0,
+	};
+	log_debug("Mapped %llux%llu matrix from %s",
+		head.log_dim.y, head.log_dim.x, filename
+	);
+	return 0;
+}
+
+
+void unload_matrix_map(gsl_matrix **mat, struct load_map *map)
+{
+	if (map->addr) munmap(map->addr, map->len);
+	map->addr = 0;
+	map->len = 0;
+	xfree(*mat);
+}
+
+
+
+int load_matrix_param(gsl_matrix **mat, struct load_map *map,
+	json_object *params
+){
+	// json array for matrix passed in config file
+	json_object *json_mat = 0;
+	// or, filename for aylp file
+	const char *filename = 0;
+	// how to load it: read it (-1), or map it in one of the load_map_modes
+	int map_mode = -1;
+
+	json_object_object_foreach(params, key, val) {
+		if (!strcmp(key, "matrix")) {
+			json_mat = val;
+		} else if (!strcmp(key, "filename")) {
+			filename = json_object_get_string(val);
+			log_trace("filename = %s", filename);
+		} else if (!strcmp(key, "load")) {
+			const char *s = json_object_get_string(val);
+			if (!strcmp(s, "read")) map_mode = -1;
+			else if (!strcmp(s, "mmap")) map_mode = LOAD_MAP_SHARED;
+			else if (!strcmp(s, "hugepage"))
+				map_mode = LOAD_MAP_HUGEPAGE;
+			else {
+				log_error("Unrecognized load: %s", s);
+				return -1;
+			}
+			log_trace("load = %s", s);
+		}
+	}
+
+	if (filename && json_mat) {
+		log_error(
+			"Provide only one of the filename and matrix params."
+		);
+		return -1;
+	} else if (json_mat) {
+		if (load_matrix_from_json(mat, json_mat)) return -1;
+		log_trace("Read matrix from json");
+	} else if (filename && map_mode < 0) {
+		if (load_matrix_from_file(mat, filename)) return -1;
+	} else if (filename) {
+		if (load_matrix_map(mat, map, filename, map_mode)) return -1;
+	} else {
+		log_error(
+			"No matrix provided. Check filename and matrix params."
+		);
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,61 @@
+#ifndef AYLP_LOAD_H_
+#define AYLP_LOAD_H_
+
+#include <gsl/gsl_matrix.h>
+#include <json-c/json.h>
+
+// Helpers for devices that take a matrix as a parameter, either inline in the
+// config file or as the filename of an AYLP file (e.g. from file_sink). They
+// allocate *mat, and return -1 on error after logging it.
+
+// read an AYLP_T_MATRIX from an AYLP file
+int load_matrix_from_file(gsl_matrix **mat, const char *filename);
+
+// read a matrix from a json array of arrays of numbers
+int load_matrix_from_json(gsl_matrix **mat, json_object *json_mat);
+
+// read an AYLP_T_MATRIX_UCHAR or AYLP_T_MATRIX_USHORT from an AYLP file; an
+// AYLP_T_MATRIX is accepted too, and is rounded and clamped to 0:255 or 0:65535
+int load_matrix_uchar_from_file(gsl_matrix_uchar **mat, const char *filename);
+int load_matrix_ushort_from_file(gsl_matrix_ushort **mat,
+	const char *filename
+);
+
+// How load_matrix_map should get a matrix file into memory.
+enum load_map_mode {
+	// Map the file itself, read-only and shared. Startup only has to fault
+	// the pages in, and processes using the same file share them.
+	LOAD_MAP_SHARED,
+	// Copy the data into private anonymous memory, aligned to and advised
+	// for (transparent) hugepages, to cut down on TLB misses.
+	LOAD_MAP_HUGEPAGE,
+};
+
+// A memory mapping made by load_matrix_map.
+struct load_map {
+	void *addr;
+	size_t len;
+};
+
+// Like load_matrix_from_file, but *mat is a view into a memory mapping, which
+// is recorded in *map. The matrix must not be written to in LOAD_MAP_SHARED
+// mode. Free it with unload_matrix_map, not gsl_matrix_free.
+int load_matrix_map(gsl_matrix **mat, struct load_map *map,
+	const char *filename, enum load_map_mode mode
+);
+
+// free a matrix from load_matrix_map, and unmap its memory
+void unload_matrix_map(gsl_matrix **mat, struct load_map *map);
+
+// Load the matrix a device's params ask for: either inline as "matrix", or
+// from the AYLP file "filename", read or mapped as "load" says ("read",
+// "mmap", or "hugepage"; see load_map_mode). Exactly one of matrix and
+// filename must be given. map is only used if the file is mapped, and then
+// the matrix must be freed with unload_matrix_map. The device should skip
+// these three keys when it parses the rest of its params.
+int load_matrix_param(gsl_matrix **mat, struct load_map *map,
+	json_object *params
+);
+
+#endif
+
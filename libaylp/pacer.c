@@ -0,0 +1,135 @@
+#include "pacer.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include "anyloop.h"
+#include "logging.h"
+
+#define NSEC_PER_SEC 1000000000L
+
+
+static void ts_add_ns(struct timespec *ts, long ns)
+{
+	ts->tv_nsec += ns;
+	while (ts->tv_nsec >= NSEC_PER_SEC) {
+		ts->tv_nsec -= NSEC_PER_SEC;
+		ts->tv_sec += 1;
+	}
+	while (ts->tv_nsec < 0) {
+		ts->tv_nsec += NSEC_PER_SEC;
+		ts->tv_sec -= 1;
+	}
+}
+
+
+// a minus b, in nanoseconds
+static long long ts_diff_ns(struct timespec *a, struct timespec *b)
+{
+	return (long long)(a->tv_sec - b->tv_sec) * NSEC_PER_SEC
+		+ (a->tv_nsec - b->tv_nsec)
+	;
+}
+
+
+static void get_time(struct timespec *ts)
+{
+	if (clock_gettime(CLOCK_MONOTONIC, ts) == -1) {
+		log_fatal("Failed to get clock time for pacing: %s",
+			strerror(errno)
+		);
+		exit(EXIT_FAILURE);
+	}
+}
+
+
+struct pacer pacer_new(struct aylp_conf *conf)
+{
+	struct pacer p = {0};
+	if (conf->loop.rate_hz <= 0)
+		return p;
+	p.enabled = true;
+	p.period_ns = (long)(1E9 / conf->loop.rate_hz);
+	p.spin_ns = conf->loop.spin_ns;
+	if (p.spin_ns > p.period_ns) {
+		log_warn("Spin time %ld ns exceeds loop period %ld ns; "
+			"we will busy-wait for the whole period",
+			p.spin_ns, p.period_ns
+		);
+		p.spin_ns = p.period_ns;
+	}
+	log_info("Pacing loop at %G Hz (period %ld ns, spin %ld ns)",
+		conf->loop.rate_hz, p.period_ns, p.spin_ns
+	);
+	return p;
+}
+
+
+void pacer_wait(struct pacer *p)
+{
+	struct timespec *now = &p->now;
+	if (UNLIKELY(!p->iterations++)) {
+		// first iteration; deadlines are measured from here
+		get_time(&p->next);
+		*now = p->next;
+		return;
+	}
+	ts_add_ns(&p->next, p->period_ns);
+	get_time(now);
+
+	long long late = ts_diff_ns(now, &p->next);
+	if (UNLIKELY(late > 0)) {
+		// We blew through the deadline. Start right away, but stay on
+		// the original grid of deadlines (skipping whichever periods we
+		// missed completely) so that overruns don't turn into drift.
+		p->overruns += 1;
+		if (late / 1E6 > p->max_late) p->max_late = late / 1E6;
+		long long skip = late / p->period_ns;
+		p->missed_periods += skip;
+		ts_add_ns(&p->next, skip * p->period_ns);
+		log_trace("Overran deadline by %lld ns", late);
+		return;
+	}
+
+	// sleep until spin_ns before the deadline, then spin the rest
+	struct timespec wake = p->next;
+	ts_add_ns(&wake, -p->spin_ns);
+	if (ts_diff_ns(&wake, now) > 0) {
+		int err = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+			&wake, 0
+		);
+		// on EINTR (e.g. SIGINT), just let the main loop decide
+		if (err && err != EINTR) {
+			log_error("clock_nanosleep failed: %s", strerror(err));
+		}
+	}
+	if (p->spin_ns) {
+		do get_time(now);
+		while (ts_diff_ns(now, &p->next) < 0);
+	} else {
+		// when we actually woke up, late or early (on EINTR), so that
+		// the frame's timestamp shows it
+		get_time(now);
+	}
+}
+
+
+void pacer_stamp(struct pacer *p, struct aylp_header *header)
+{
+	// pacer_wait already read the clock for this iteration
+	if (!p->enabled) get_time(&p->now);
+	header->frame = p->frames++;
+	header->timestamp = (uint64_t)p->now.tv_sec * NSEC_PER_SEC
+		+ p->now.tv_nsec;
+}
+
+
+void pacer_summary(struct pacer *p)
+{
+	if (!p->enabled) return;
+	log_info("Pacer: %zu iterations, %zu overruns, %zu missed periods, "
+		"worst overrun %.4f ms",
+		p->iterations, p->overruns, p->missed_periods, p->max_late
+	);
+}
+
@@ -0,0 +1,44 @@
+#ifndef AYLP_PACER_H_
+#define AYLP_PACER_H_
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "anyloop.h"
+
+struct pacer {
+	// whether we are pacing at all (i.e. rate_hz was set)
+	bool enabled;
+	// loop period and how long before each deadline to start spinning
+	long period_ns;
+	long spin_ns;
+	// absolute deadline of the next iteration (CLOCK_MONOTONIC)
+	struct timespec next;
+	// when the current iteration started, as last read from the clock
+	struct timespec now;
+	// statistics
+	size_t iterations;
+	size_t overruns;
+	size_t missed_periods;
+	// worst lateness seen on an overrun, in milliseconds
+	double max_late;
+	// frames stamped so far
+	uint64_t frames;
+};
+
+struct pacer pacer_new(struct aylp_conf *conf);
+
+// Block until the start of the next loop period. Returns immediately on the
+// first call, which sets the time origin for all later deadlines.
+void pacer_wait(struct pacer *p);
+
+// Set the frame counter and timestamp in the header of a new frame. Called at
+// the start of every iteration, whether or not we are pacing; when we are, it
+// uses the time pacer_wait left behind instead of reading the clock again.
+void pacer_stamp(struct pacer *p, struct aylp_header *header);
+
+void pacer_summary(struct pacer *p);
+
+#endif
+
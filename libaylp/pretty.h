@@ -8,6 +8,9 @@
 void pretty_vector(gsl_vector *v);
 void pretty_matrix(gsl_matrix *m);
 void pretty_matrix_uchar(gsl_matrix_uchar *m);
+void pretty_matrix_ushort(gsl_matrix_ushort *m);
+void pretty_vector_float(gsl_vector_float *v);
+void pretty_matrix_float(gsl_matrix_float *m);
 
 #endif
 
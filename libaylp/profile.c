@@ -1,7 +1,6 @@
 #include "profile.h"
 
 #include <string.h>
-#include <assert.h>
 #include <float.h>
 
 #include "anyloop.h"
@@ -12,7 +11,6 @@ struct profile profile_new(struct aylp_conf *conf)
 {
 	struct profile p;
 	p.conf = conf;
-	p.current_device_id = -1;
 
 	p.device_profiles = xcalloc(conf->n_devices,
 		sizeof(struct device_profile)
@@ -20,6 +18,9 @@ struct profile profile_new(struct aylp_conf *conf)
 	for (size_t i=0; i<conf->n_devices; i++) {
 		p.device_profiles[i].min = DBL_MAX;
 	}
+	p.stage_profiles = xcalloc(conf->loop.n_stages,
+		sizeof(struct stage_profile)
+	);
 
 	return p;
 }
@@ -27,12 +28,13 @@ struct profile profile_new(struct aylp_conf *conf)
 void profile_free(struct profile *p)
 {
 	xfree(p->device_profiles);
+	xfree(p->stage_profiles);
 }
 
 void profile_begin_for_device(struct profile *p, size_t device_id)
 {
-	p->current_device_id = device_id;
-	if (clock_gettime(CLOCK_MONOTONIC, &p->start_time) == -1) {
+	struct device_profile *dp = &p->device_profiles[device_id];
+	if (clock_gettime(CLOCK_MONOTONIC, &dp->start_time) == -1) {
 		log_error("Failed to get clock time for profiling: %s",
 			strerror(errno)
 		);
@@ -42,8 +44,7 @@ void profile_begin_for_device(struct profile *p, size_t device_id)
 
 void profile_end_for_device(struct profile *p, size_t device_id)
 {
-	assert(p->current_device_id == (ssize_t) device_id);
-
+	struct device_profile *dp = &p->device_profiles[device_id];
 	struct timespec end_time;
 	if (clock_gettime(CLOCK_MONOTONIC, &end_time) == -1) {
 		log_error("Failed to get clock time for profiling: %s",
@@ -53,14 +54,13 @@ void profile_end_for_device(struct profile *p, size_t device_id)
 	}
 
 	// calculate duration
-	time_t duration_sec = end_time.tv_sec - p->start_time.tv_sec;
-	long duration_nsec = end_time.tv_nsec - p->start_time.tv_nsec;
+	time_t duration_sec = end_time.tv_sec - dp->start_time.tv_sec;
+	long duration_nsec = end_time.tv_nsec - dp->start_time.tv_nsec;
 
 	// milliseconds
 	double duration = duration_sec*1000.f + (duration_nsec/1000000.f);
 
 	// update statistics
-	struct device_profile *dp = &p->device_profiles[device_id];
 	dp->sample_count++;
 
 	if (duration < dp->min) dp->min = duration;
@@ -69,9 +69,6 @@ void profile_end_for_device(struct profile *p, size_t device_id)
 	// welford's online algorithm is used to perform an online mean and
 	// variance calculation
 	dp->mean += (duration - dp->mean)/dp->sample_count;
-
-	// we are no longer profiling a device
-	p->current_device_id = -1;
 }
 
 void profile_summary(struct profile *p)
@@ -93,4 +90,26 @@ void profile_summary(struct profile *p)
 			max_uri_len + 1, p->conf->devices[i].uri, dp->mean,
 			dp->min, dp->max);
 	}
+
+	if (p->conf->loop.n_stages < 2) return;
+
+	log_info("%5s | %7s | %9s | %6s | %7s | %7s | %9s",
+		"stage", "devices", "frames", "busy", "starved", "blocked",
+		"queue"
+	);
+	for (size_t s=0; s<p->conf->loop.n_stages; s++) {
+		struct stage_profile *sp = &p->stage_profiles[s];
+		double total = sp->busy + sp->starved + sp->blocked;
+		if (total <= 0) total = 1;
+		size_t first = s ? p->conf->loop.stage_starts[s-1] : 0;
+		size_t last = s < p->conf->loop.n_stages-1 ?
+			p->conf->loop.stage_starts[s] : p->conf->n_devices;
+		log_info("%5zu | %3zu-%-3zu | %9zu | %5.1f%% | %6.1f%% | "
+			"%6.1f%% | %9.3f",
+			s, first, last-1, sp->frames,
+			100*sp->busy/total, 100*sp->starved/total,
+			100*sp->blocked/total,
+			sp->frames ? (double)sp->occupancy_sum/sp->frames : 0.0
+		);
+	}
 }
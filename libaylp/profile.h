@@ -12,15 +12,29 @@ struct device_profile {
 	double min;
 	double mean;
 	size_t sample_count;
+
+	// transient profiling state; per-device so that devices running on
+	// different pipeline stages can be profiled concurrently
+	struct timespec start_time;
+};
+
+struct stage_profile {
+	// total time spent in milliseconds running devices, waiting for a frame
+	// from the previous stage, and waiting for a free slot in the next one
+	double busy;
+	double starved;
+	double blocked;
+	// frames processed, and sum of input ring fill levels seen (so the mean
+	// depth of the input queue is occupancy_sum/frames)
+	size_t frames;
+	size_t occupancy_sum;
 };
 
 struct profile {
 	struct aylp_conf *conf;
 	struct device_profile *device_profiles;
-
-	// transient per-device profiling state
-	struct timespec start_time;
-	ssize_t current_device_id;
+	// one per pipeline stage; only filled in when running pipelined
+	struct stage_profile *stage_profiles;
 };
 
 struct profile profile_new(struct aylp_conf *conf);
@@ -0,0 +1,112 @@
+#include "anyloop.h"
+
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "logging.h"
+#include "realtime.h"
+
+// how much stack to fault in before the loop starts
+#define PREFAULT_STACK_SIZE (512*1024)
+
+static struct aylp_rt_conf *rt_conf;
+
+
+void realtime_init(struct aylp_rt_conf *rt)
+{
+	rt_conf = rt;
+	if (!rt->enabled) return;
+	log_info("Realtime mode: SCHED_FIFO priority %d, %zu loop cpu(s), "
+		"%s memory",
+		rt->priority, rt->n_cpus,
+		rt->lock_memory ? "locking" : "not locking"
+	);
+}
+
+
+int pin_thread(pthread_t thread, int cpu)
+{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	int err = pthread_setaffinity_np(thread, sizeof(set), &set);
+	if (err) {
+		log_warn("Couldn't pin thread to cpu %d: %s",
+			cpu, strerror(err)
+		);
+		return -1;
+	}
+	log_debug("Pinned thread to cpu %d", cpu);
+	return 0;
+}
+
+
+static int set_fifo(pthread_t thread)
+{
+	struct sched_param param = { .sched_priority = rt_conf->priority };
+	int err = pthread_setschedparam(thread, SCHED_FIFO, &param);
+	if (err) {
+		log_warn("Couldn't set SCHED_FIFO priority %d: %s",
+			rt_conf->priority, strerror(err)
+		);
+		return -1;
+	}
+	return 0;
+}
+
+
+int realtime_setup_loop_thread(size_t index)
+{
+	int ret = 0;
+	if (!rt_conf || !rt_conf->enabled) return 0;
+	if (rt_conf->n_cpus) {
+		ret |= pin_thread(pthread_self(),
+			rt_conf->cpus[index % rt_conf->n_cpus]
+		);
+	}
+	ret |= set_fifo(pthread_self());
+	return ret;
+}
+
+
+int realtime_setup_worker(pthread_t thread)
+{
+	if (!rt_conf || !rt_conf->enabled) return 0;
+	return set_fifo(thread);
+}
+
+
+// noinline so that the compiler can't skip touching the stack
+static void __attribute__((noinline)) prefault_stack(void)
+{
+	volatile unsigned char buf[PREFAULT_STACK_SIZE];
+	memset((unsigned char *)buf, 0, sizeof(buf));
+}
+
+
+int realtime_lock_memory(void)
+{
+	if (!rt_conf || !rt_conf->enabled || !rt_conf->lock_memory) return 0;
+	// Keep freed memory in the (locked) heap instead of handing it back to
+	// the kernel, and don't use mmap for big allocations, so that buffers
+	// a device (re)allocates later come from pages that are already locked.
+	mallopt(M_TRIM_THRESHOLD, -1);
+	mallopt(M_MMAP_MAX, 0);
+	// MCL_CURRENT faults in and locks every page we have mapped already,
+	// which includes all the buffers devices allocated in init(); with
+	// MCL_FUTURE, anything mapped later is faulted in when it's mapped.
+	if (mlockall(MCL_CURRENT | MCL_FUTURE)) {
+		log_warn("Couldn't lock memory: %s", strerror(errno));
+		return -1;
+	}
+	prefault_stack();
+	log_info("Locked memory and prefaulted %d KiB of stack",
+		PREFAULT_STACK_SIZE / 1024
+	);
+	return 0;
+}
+
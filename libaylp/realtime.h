@@ -0,0 +1,36 @@
+#ifndef AYLP_REALTIME_H_
+#define AYLP_REALTIME_H_
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "anyloop.h"
+
+/** Remember the realtime settings for later calls in this file, and log what
+* we're going to do. Must be called before any devices are initialized, since
+* they may start worker threads. */
+void realtime_init(struct aylp_rt_conf *rt);
+
+/** Pin the calling thread to the index-th of the loop cpus and give it
+* SCHED_FIFO priority. The main thread is index 0; pipeline stage threads use
+* their stage number. Call it only after all worker threads have been started,
+* since they would inherit the pinning and priority. Does nothing unless
+* realtime mode is enabled. Returns nonzero if any of it failed, in which case
+* we carry on without it. */
+int realtime_setup_loop_thread(size_t index);
+
+/** Give a worker thread (see thread_pool.h) SCHED_FIFO priority. Workers are
+* pinned by the pool that starts them, in realtime mode or not. Does nothing
+* unless realtime mode is enabled. */
+int realtime_setup_worker(pthread_t thread);
+
+/** Pin a thread to one cpu. Returns nonzero (after warning) on failure. */
+int pin_thread(pthread_t thread, int cpu);
+
+/** Lock all current and future memory into RAM and fault in some stack, so
+* that we don't take page faults in the loop. Call this after all devices are
+* initialized and before the first iteration. */
+int realtime_lock_memory(void);
+
+#endif
+
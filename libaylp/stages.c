@@ -0,0 +1,550 @@
+#include "stages.h"
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <string.h>
+
+#include "anyloop.h"
+#include "logging.h"
+#include "realtime.h"
+#include "xalloc.h"
+
+
+/** Pipeline stage and everything its thread needs to know. */
+struct stage {
+	size_t id;
+	// devices conf->devices[first:last] belong to this stage
+	size_t first;
+	size_t last;
+	struct aylp_conf *conf;
+	struct profile *profile;
+	// only the first stage is paced
+	struct pacer *pacer;
+	volatile bool *interrupted;
+	// set by any stage that sees AYLP_DONE or a fatal error
+	atomic_bool *stop;
+	// ring from the previous stage (null for the first stage) and ring to
+	// the next stage (null for the last stage)
+	struct aylp_ring *in;
+	struct aylp_ring *out;
+	// persistent state for the first stage; other stages get theirs from
+	// their input ring
+	struct aylp_state *state;
+	pthread_t thread;
+	// nonzero if a device failed fatally
+	int err;
+};
+
+
+static void throw(int err)
+{
+	log_fatal("pthread error %d: %s", err, strerror(err));
+	abort();
+}
+
+
+static double now_ms(void)
+{
+	struct timespec ts;
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1) {
+		log_error("Failed to get clock time for profiling: %s",
+			strerror(errno)
+		);
+		exit(EXIT_FAILURE);
+	}
+	return ts.tv_sec*1000.0 + ts.tv_nsec/1000000.0;
+}
+
+
+/** Allocate storage in slot for data of the given shape, if it's known. */
+static void slot_alloc(struct aylp_slot *slot, const struct aylp_shape *s)
+{
+	size_t n = s->y * s->x;
+	if (!n) return;
+	switch (s->type) {
+	case AYLP_T_BLOCK:
+		slot->block = xmalloc_aligned_type(gsl_block, n);
+		break;
+	case AYLP_T_VECTOR:
+		slot->vector = xmalloc_aligned_type(gsl_vector, n);
+		break;
+	case AYLP_T_MATRIX:
+		slot->matrix = xmalloc_aligned_type(gsl_matrix, s->y, s->x);
+		break;
+	case AYLP_T_BLOCK_UCHAR:
+		slot->block_uchar = xmalloc_aligned_type(gsl_block_uchar, n);
+		break;
+	case AYLP_T_MATRIX_UCHAR:
+		slot->matrix_uchar = xmalloc_aligned_type(gsl_matrix_uchar,
+			s->y, s->x
+		);
+		break;
+	case AYLP_T_MATRIX_USHORT:
+		slot->matrix_ushort = xmalloc_aligned_type(gsl_matrix_ushort,
+			s->y, s->x
+		);
+		break;
+	case AYLP_T_VECTOR_FLOAT:
+		slot->vector_float = xmalloc_aligned_type(gsl_vector_float, n);
+		break;
+	case AYLP_T_MATRIX_FLOAT:
+		slot->matrix_float = xmalloc_aligned_type(gsl_matrix_float,
+			s->y, s->x
+		);
+		break;
+	default:
+		// unknown or more than one possible type; slot_fill will
+		// allocate once it sees the data
+		break;
+	}
+}
+
+
+static void ring_init(struct aylp_ring *r, size_t n_slots,
+	const struct aylp_shape *shape
+){
+	int err;
+	r->slots = xcalloc(n_slots, sizeof(struct aylp_slot));
+	r->n_slots = n_slots;
+	for (size_t i = 0; i < n_slots; i++)
+		slot_alloc(&r->slots[i], shape);
+	err = pthread_mutex_init(&r->mutex, 0);
+	if (err) throw(err);
+	err = pthread_cond_init(&r->not_empty, 0);
+	if (err) throw(err);
+	err = pthread_cond_init(&r->not_full, 0);
+	if (err) throw(err);
+}
+
+
+static void ring_free(struct aylp_ring *r)
+{
+	for (size_t i = 0; i < r->n_slots; i++) {
+		struct aylp_slot *slot = &r->slots[i];
+		xfree_aligned_type(gsl_block, slot->block);
+		xfree_aligned_type(gsl_vector, slot->vector);
+		xfree_aligned_type(gsl_matrix, slot->matrix);
+		xfree_aligned_type(gsl_block_uchar, slot->block_uchar);
+		xfree_aligned_type(gsl_matrix_uchar, slot->matrix_uchar);
+		xfree_aligned_type(gsl_matrix_ushort, slot->matrix_ushort);
+		xfree_aligned_type(gsl_vector_float, slot->vector_float);
+		xfree_aligned_type(gsl_matrix_float, slot->matrix_float);
+	}
+	xfree(r->slots);
+	pthread_mutex_destroy(&r->mutex);
+	pthread_cond_destroy(&r->not_empty);
+	pthread_cond_destroy(&r->not_full);
+}
+
+
+/** Wait for an empty slot to write to. Returns null if the ring was closed. */
+static struct aylp_slot *ring_acquire(struct aylp_ring *r)
+{
+	int err;
+	struct aylp_slot *ret = 0;
+	err = pthread_mutex_lock(&r->mutex);
+	if (err) throw(err);
+	while (r->count == r->n_slots && !r->closed) {
+		err = pthread_cond_wait(&r->not_full, &r->mutex);
+		if (err) throw(err);
+	}
+	if (!r->closed) ret = &r->slots[r->tail];
+	err = pthread_mutex_unlock(&r->mutex);
+	if (err) throw(err);
+	return ret;
+}
+
+
+/** Hand the slot returned by ring_acquire() to the consumer. */
+static void ring_publish(struct aylp_ring *r)
+{
+	int err;
+	err = pthread_mutex_lock(&r->mutex);
+	if (err) throw(err);
+	r->tail = (r->tail + 1) % r->n_slots;
+	r->count += 1;
+	err = pthread_cond_signal(&r->not_empty);
+	if (err) throw(err);
+	err = pthread_mutex_unlock(&r->mutex);
+	if (err) throw(err);
+}
+
+
+/** Wait for a filled slot to read from, and put the number of filled slots in
+* *depth. Returns null if the ring was closed and there is nothing left. */
+static struct aylp_slot *ring_peek(struct aylp_ring *r, size_t *depth)
+{
+	int err;
+	struct aylp_slot *ret = 0;
+	err = pthread_mutex_lock(&r->mutex);
+	if (err) throw(err);
+	while (!r->count && !r->closed) {
+		err = pthread_cond_wait(&r->not_empty, &r->mutex);
+		if (err) throw(err);
+	}
+	if (r->count) ret = &r->slots[r->head];
+	*depth = r->count;
+	err = pthread_mutex_unlock(&r->mutex);
+	if (err) throw(err);
+	return ret;
+}
+
+
+/** Give the slot returned by ring_peek() back to the producer. */
+static void ring_release(struct aylp_ring *r)
+{
+	int err;
+	err = pthread_mutex_lock(&r->mutex);
+	if (err) throw(err);
+	r->head = (r->head + 1) % r->n_slots;
+	r->count -= 1;
+	err = pthread_cond_signal(&r->not_full);
+	if (err) throw(err);
+	err = pthread_mutex_unlock(&r->mutex);
+	if (err) throw(err);
+}
+
+
+/** Wake up and stop whoever is on the other side of the ring. */
+static void ring_close(struct aylp_ring *r)
+{
+	int err;
+	err = pthread_mutex_lock(&r->mutex);
+	if (err) throw(err);
+	r->closed = true;
+	pthread_cond_broadcast(&r->not_empty);
+	pthread_cond_broadcast(&r->not_full);
+	err = pthread_mutex_unlock(&r->mutex);
+	if (err) throw(err);
+}
+
+
+/** Deep-copy the pipeline data in src into slot-owned storage. */
+static void slot_fill(struct aylp_slot *slot, struct aylp_state *src)
+{
+	slot->state.header = src->header;
+	switch (src->header.type) {
+	case AYLP_T_BLOCK: {
+		gsl_block *b = src->block;
+		if (UNLIKELY(!slot->block || slot->block->size != b->size)) {
+			xfree_aligned_type(gsl_block, slot->block);
+			slot->block = xmalloc_aligned_type(gsl_block, b->size);
+		}
+		memcpy(slot->block->data, b->data, sizeof(double) * b->size);
+		slot->state.block = slot->block;
+		break;
+	}
+	case AYLP_T_VECTOR: {
+		gsl_vector *v = src->vector;
+		if (UNLIKELY(!slot->vector || slot->vector->size != v->size)) {
+			xfree_aligned_type(gsl_vector, slot->vector);
+			slot->vector = xmalloc_aligned_type(gsl_vector,
+				v->size
+			);
+		}
+		gsl_vector_memcpy(slot->vector, v);
+		slot->state.vector = slot->vector;
+		break;
+	}
+	case AYLP_T_MATRIX: {
+		gsl_matrix *m = src->matrix;
+		if (UNLIKELY(!slot->matrix || slot->matrix->size1 != m->size1
+		|| slot->matrix->size2 != m->size2)) {
+			xfree_aligned_type(gsl_matrix, slot->matrix);
+			slot->matrix = xmalloc_aligned_type(gsl_matrix,
+				m->size1, m->size2
+			);
+		}
+		gsl_matrix_memcpy(slot->matrix, m);
+		slot->state.matrix = slot->matrix;
+		break;
+	}
+	case AYLP_T_BLOCK_UCHAR: {
+		gsl_block_uchar *b = src->block_uchar;
+		if (UNLIKELY(!slot->block_uchar
+		|| slot->block_uchar->size != b->size)) {
+			xfree_aligned_type(gsl_block_uchar, slot->block_uchar);
+			slot->block_uchar = xmalloc_aligned_type(
+				gsl_block_uchar, b->size
+			);
+		}
+		memcpy(slot->block_uchar->data, b->data, b->size);
+		slot->state.block_uchar = slot->block_uchar;
+		break;
+	}
+	case AYLP_T_MATRIX_UCHAR: {
+		gsl_matrix_uchar *m = src->matrix_uchar;
+		if (UNLIKELY(!slot->matrix_uchar
+		|| slot->matrix_uchar->size1 != m->size1
+		|| slot->matrix_uchar->size2 != m->size2)) {
+			xfree_aligned_type(gsl_matrix_uchar,
+				slot->matrix_uchar
+			);
+			slot->matrix_uchar = xmalloc_aligned_type(
+				gsl_matrix_uchar, m->size1, m->size2
+			);
+		}
+		gsl_matrix_uchar_memcpy(slot->matrix_uchar, m);
+		slot->state.matrix_uchar = slot->matrix_uchar;
+		break;
+	}
+	case AYLP_T_MATRIX_USHORT: {
+		gsl_matrix_ushort *m = src->matrix_ushort;
+		if (UNLIKELY(!slot->matrix_ushort
+		|| slot->matrix_ushort->size1 != m->size1
+		|| slot->matrix_ushort->size2 != m->size2)) {
+			xfree_aligned_type(gsl_matrix_ushort,
+				slot->matrix_ushort
+			);
+			slot->matrix_ushort = xmalloc_aligned_type(
+				gsl_matrix_ushort, m->size1, m->size2
+			);
+		}
+		gsl_matrix_ushort_memcpy(slot->matrix_ushort, m);
+		slot->state.matrix_ushort = slot->matrix_ushort;
+		break;
+	}
+	case AYLP_T_VECTOR_FLOAT: {
+		gsl_vector_float *v = src->vector_float;
+		if (UNLIKELY(!slot->vector_float
+		|| slot->vector_float->size != v->size)) {
+			xfree_aligned_type(gsl_vector_float,
+				slot->vector_float
+			);
+			slot->vector_float = xmalloc_aligned_type(
+				gsl_vector_float, v->size
+			);
+		}
+		gsl_vector_float_memcpy(slot->vector_float, v);
+		slot->state.vector_float = slot->vector_float;
+		break;
+	}
+	case AYLP_T_MATRIX_FLOAT: {
+		gsl_matrix_float *m = src->matrix_float;
+		if (UNLIKELY(!slot->matrix_float
+		|| slot->matrix_float->size1 != m->size1
+		|| slot->matrix_float->size2 != m->size2)) {
+			xfree_aligned_type(gsl_matrix_float,
+				slot->matrix_float
+			);
+			slot->matrix_float = xmalloc_aligned_type(
+				gsl_matrix_float, m->size1, m->size2
+			);
+		}
+		gsl_matrix_float_memcpy(slot->matrix_float, m);
+		slot->state.matrix_float = slot->matrix_float;
+		break;
+	}
+	default:
+		// nothing we know how to copy (e.g. AYLP_T_NONE), so just pass
+		// the pointer along
+		slot->state.block = src->block;
+		break;
+	}
+}
+
+
+int stage_proc(struct aylp_conf *conf, size_t first, size_t last,
+	struct aylp_state *state, struct profile *profile,
+	volatile bool *interrupted
+){
+	int err;
+	for (size_t d=first; !*interrupted && d<last; d++) {
+		struct aylp_device *dev = &conf->devices[d];
+		if (dev->proc) {
+			const void *data = state->block;
+			if (profile)
+				profile_begin_for_device(profile, d);
+			err = dev->proc(dev, state);
+			if (profile)
+				profile_end_for_device(profile, d);
+			// see AYLP_MUTABLE
+			if (state->block != data && dev->scratch_out)
+				state->header.status |= AYLP_MUTABLE;
+			else if (state->block != data)
+				state->header.status &= ~AYLP_MUTABLE;
+
+			// errors are assumed recoverable (e.g. UDP fails to
+			// send) unless the device was supposed to change the
+			// type
+			if (err && dev->type_out
+			&& dev->type_out != dev->type_in) {
+				log_fatal("%s returned error %d but was "
+					"expected to change the pipeline type. "
+					"Exiting.", dev->uri, err
+				);
+				return err;
+			}
+			// this logging call could be too much overhead even
+			// when log level is above trace, but I doubt it
+			log_trace("Processed %s", dev->uri);
+		} else {
+			log_trace("Not processing %s", dev->uri);
+		}
+	}
+	return 0;
+}
+
+
+static void *stage_runner(void *arg)
+{
+	struct stage *s = arg;
+	struct stage_profile *sp = 0;
+	if (s->profile)
+		sp = &s->profile->stage_profiles[s->id];
+	// for stages other than the first, a shallow copy of the input slot's
+	// state, so devices can repoint it without touching the slot
+	struct aylp_state in_state;
+	struct aylp_state *state = s->state;
+	double t0 = 0, t1 = 0;
+
+	// the main thread (stage 0) was already set up in main()
+	if (s->id)
+		realtime_setup_loop_thread(s->id);
+
+	while (1) {
+		struct aylp_slot *in_slot = 0;
+		size_t depth = 0;
+		if (sp) t0 = now_ms();
+		if (!s->in) {
+			// we're the source of frames for everyone else
+			if (*s->interrupted || atomic_load(s->stop))
+				break;
+			if (s->pacer && s->pacer->enabled)
+				pacer_wait(s->pacer);
+			pacer_stamp(s->pacer, &state->header);
+		} else {
+			in_slot = ring_peek(s->in, &depth);
+			if (!in_slot) break;
+			in_state = in_slot->state;
+			state = &in_state;
+			// the slot's copy is ours until we release it
+			state->header.status |= AYLP_MUTABLE;
+		}
+		if (sp) {
+			t1 = now_ms();
+			sp->starved += t1 - t0;
+			t0 = t1;
+		}
+
+		s->err = stage_proc(s->conf, s->first, s->last, state,
+			s->profile, s->interrupted
+		);
+		if (s->err) {
+			atomic_store(s->stop, true);
+			break;
+		}
+		// don't pass on a half-processed frame
+		if (*s->interrupted) break;
+		if (sp) {
+			t1 = now_ms();
+			sp->busy += t1 - t0;
+			t0 = t1;
+		}
+
+		if (s->out) {
+			struct aylp_slot *out_slot = ring_acquire(s->out);
+			if (!out_slot) break;
+			if (sp) {
+				t1 = now_ms();
+				sp->blocked += t1 - t0;
+				t0 = t1;
+			}
+			slot_fill(out_slot, state);
+			ring_publish(s->out);
+			if (sp) sp->busy += now_ms() - t0;
+		}
+		if (in_slot)
+			ring_release(s->in);
+		if (sp) {
+			sp->frames += 1;
+			sp->occupancy_sum += depth;
+		}
+
+		if (state->header.status & AYLP_DONE) {
+			// frames already downstream of us still get finished
+			atomic_store(s->stop, true);
+			break;
+		}
+	}
+
+	if (s->in) ring_close(s->in);
+	if (s->out) ring_close(s->out);
+	log_trace("Stage %zu exiting", s->id);
+	return 0;
+}
+
+
+int stages_run(struct aylp_conf *conf, struct aylp_state *state,
+	struct profile *profile, struct pacer *pacer,
+	volatile bool *interrupted
+){
+	int err;
+	int ret = 0;
+	size_t n = conf->loop.n_stages;
+	atomic_bool stop = false;
+	struct stage *stages = xcalloc(n, sizeof(struct stage));
+	struct aylp_ring *rings = xcalloc(n-1, sizeof(struct aylp_ring));
+
+	for (size_t r = 0; r < n-1; r++) {
+		ring_init(&rings[r], conf->loop.ring_slots,
+			&conf->loop.stage_shapes[r]
+		);
+	}
+	// the slots were the last buffers to allocate before the loop, and
+	// whatever gets reallocated in it comes from the heap
+	xalloc_close_hugepages();
+	for (size_t i = 0; i < n; i++) {
+		stages[i] = (struct stage){
+			.id = i,
+			.first = i ? conf->loop.stage_starts[i-1] : 0,
+			.last = i < n-1 ?
+				conf->loop.stage_starts[i] : conf->n_devices,
+			.conf = conf,
+			.profile = profile,
+			.pacer = i ? 0 : pacer,
+			.interrupted = interrupted,
+			.stop = &stop,
+			.in = i ? &rings[i-1] : 0,
+			.out = i < n-1 ? &rings[i] : 0,
+			.state = state,
+		};
+		log_debug("Stage %zu runs devices %zu through %zu",
+			i, stages[i].first, stages[i].last - 1
+		);
+	}
+
+	// the first stage runs on this thread
+	size_t started = 1;
+	for (; started < n; started++) {
+		err = pthread_create(&stages[started].thread, 0,
+			stage_runner, &stages[started]
+		);
+		if (err) {
+			log_fatal("Couldn't create pthread: %s", strerror(err));
+			for (size_t r = 0; r < n-1; r++) ring_close(&rings[r]);
+			ret = -1;
+			break;
+		}
+	}
+	if (!ret) {
+		log_info("Running pipeline in %zu stages with %zu slots "
+			"between each", n, conf->loop.ring_slots
+		);
+		stage_runner(&stages[0]);
+	}
+
+	for (size_t i = 1; i < started; i++) {
+		pthread_join(stages[i].thread, 0);
+	}
+	for (size_t i = 0; i < n; i++) {
+		if (stages[i].err) ret = stages[i].err;
+	}
+	for (size_t r = 0; r < n-1; r++) {
+		ring_free(&rings[r]);
+	}
+	xfree(rings);
+	xfree(stages);
+	return ret;
+}
+
@@ -0,0 +1,67 @@
+#ifndef AYLP_STAGES_H_
+#define AYLP_STAGES_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+
+#include "anyloop.h"
+#include "pacer.h"
+#include "profile.h"
+
+/** A slot in a ring between pipeline stages.
+* The state in a slot always points at data owned by the slot itself, never at a
+* device's buffer, because the device that produced the data will overwrite it
+* on its next proc() while the next stage is still reading the slot. */
+struct aylp_slot {
+	// what the next stage will see
+	struct aylp_state state;
+	// storage for a copy of the pipeline data, (re)allocated as needed
+	gsl_block *block;
+	gsl_vector *vector;
+	gsl_matrix *matrix;
+	gsl_block_uchar *block_uchar;
+	gsl_matrix_uchar *matrix_uchar;
+	gsl_matrix_ushort *matrix_ushort;
+	gsl_vector_float *vector_float;
+	gsl_matrix_float *matrix_float;
+};
+
+/** Bounded ring of slots handed from one stage to the next.
+* The producer fills the slot at `tail` without holding the mutex, and the
+* consumer reads the slot at `head` without holding the mutex; the mutex only
+* guards the indices. */
+struct aylp_ring {
+	struct aylp_slot *slots;
+	size_t n_slots;
+	// next slot to read, next slot to write, and number of filled slots
+	size_t head;
+	size_t tail;
+	size_t count;
+	// set when either side exits, to wake up and stop the other side
+	bool closed;
+	pthread_mutex_t mutex;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+};
+
+/** Run the devices conf->devices[first:last] once on state.
+* This is the body of the main loop; in sequential mode it runs over the whole
+* pipeline, and in pipelined mode each stage runs it over its own devices.
+* Profiling is skipped if profile is null. Stops early if *interrupted is set.
+* Returns nonzero on fatal error. */
+int stage_proc(struct aylp_conf *conf, size_t first, size_t last,
+	struct aylp_state *state, struct profile *profile,
+	volatile bool *interrupted
+);
+
+/** Run the pipeline split into conf->loop.n_stages stages, each on its own
+* thread, until AYLP_DONE is set or *interrupted is set. The calling thread runs
+* the first stage, which is the only one that is paced. Returns nonzero on fatal
+* error. */
+int stages_run(struct aylp_conf *conf, struct aylp_state *state,
+	struct profile *profile, struct pacer *pacer,
+	volatile bool *interrupted
+);
+
+#endif
+
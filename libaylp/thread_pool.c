@@ -1,85 +1,402 @@
-#include <errno.h>
-#include <stdlib.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdint.h>
 #include <string.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
 
+#include "anyloop.h"
 #include "thread_pool.h"
 #include "logging.h"
+#include "realtime.h"
+#include "xalloc.h"
 
+#define QUEUE_MASK (AYLP_QUEUE_SIZE - 1)
+_Static_assert((AYLP_QUEUE_SIZE & QUEUE_MASK) == 0,
+	"AYLP_QUEUE_SIZE must be a power of two");
 
-static void throw(int err)
+
+static inline void cpu_relax(void)
 {
-	log_fatal("pthread error %d: %s", err, strerror(err));
-	abort();
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield");
+#endif
 }
 
 
-void task_enqueue(struct aylp_queue *queue, struct aylp_task *task)
+static void futex_wait(atomic_uint *addr, unsigned val)
 {
-	int err;
-	err = pthread_mutex_lock(&queue->mutex);
-	if (err) throw(err);
-	// mutex grabbed
-	{
-		// add this task as oldest if there is no oldest task
-		if (!queue->oldest_task) queue->oldest_task = task;
-		// make the old newest_task point to this one as the next task,
-		// as long as it's not the same as the current task
-		if (queue->newest_task && queue->newest_task != task)
-			queue->newest_task->next_task = task;
-		// make the new newest_task this task
-		queue->newest_task = task;
+	// returns immediately (EAGAIN) if *addr != val, which is what we want
+	syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, 0, 0, 0);
+}
+
+
+// returns the number of threads woken
+static long futex_wake(atomic_uint *addr, int n)
+{
+	return syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, n, 0, 0, 0);
+}
+
+
+// This is Dmitry Vyukov's bounded MPMC queue. Each cell has a sequence number;
+// a cell at position pos is free for a producer when its sequence is pos, and
+// holds a task for a consumer when its sequence is pos+1. Dequeueing bumps it
+// to pos+AYLP_QUEUE_SIZE, ready for the producer that comes around next time.
+// Cell i should start with sequence i, so we store sequences minus the index of
+// the cell, which lets a zeroed queue be valid.
+static inline size_t cell_seq(struct aylp_queue_cell *cell, size_t idx)
+{
+	return atomic_load_explicit(&cell->seq, memory_order_acquire) + idx;
+}
+
+static inline void cell_set_seq(struct aylp_queue_cell *cell, size_t idx,
+	size_t seq
+){
+	atomic_store_explicit(&cell->seq, seq - idx, memory_order_release);
+}
+
+
+static bool try_enqueue(struct aylp_queue *q, struct aylp_task *task)
+{
+	size_t pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+	struct aylp_queue_cell *cell;
+	while (1) {
+		cell = &q->cells[pos & QUEUE_MASK];
+		intptr_t dif = (intptr_t)cell_seq(cell, pos & QUEUE_MASK)
+			- (intptr_t)pos;
+		if (dif == 0) {
+			// cell is free; try to claim it
+			if (atomic_compare_exchange_weak_explicit(&q->tail,
+				&pos, pos + 1,
+				memory_order_relaxed, memory_order_relaxed
+			)) break;
+		} else if (dif < 0) {
+			// queue is full
+			return false;
+		} else {
+			// another producer got here first
+			pos = atomic_load_explicit(&q->tail,
+				memory_order_relaxed
+			);
+		}
 	}
-	// release mutex
-	err = pthread_mutex_unlock(&queue->mutex);
-	if (err) throw(err);
-	// tell threads that a task is ready
-	err = pthread_cond_signal(&queue->ready);
-	if (err) throw(err);
+	cell->task = task;
+	cell_set_seq(cell, pos & QUEUE_MASK, pos + 1);
+	return true;
 }
 
 
-struct aylp_task *task_dequeue(struct aylp_queue *queue)
+static struct aylp_task *try_dequeue(struct aylp_queue *q)
+{
+	size_t pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+	struct aylp_queue_cell *cell;
+	while (1) {
+		cell = &q->cells[pos & QUEUE_MASK];
+		intptr_t dif = (intptr_t)cell_seq(cell, pos & QUEUE_MASK)
+			- (intptr_t)(pos + 1);
+		if (dif == 0) {
+			// cell has a task; try to claim it
+			if (atomic_compare_exchange_weak_explicit(&q->head,
+				&pos, pos + 1,
+				memory_order_relaxed, memory_order_relaxed
+			)) break;
+		} else if (dif < 0) {
+			// queue is empty
+			return 0;
+		} else {
+			// another consumer got here first
+			pos = atomic_load_explicit(&q->head,
+				memory_order_relaxed
+			);
+		}
+	}
+	struct aylp_task *ret = cell->task;
+	cell_set_seq(cell, pos & QUEUE_MASK, pos + AYLP_QUEUE_SIZE);
+	return ret;
+}
+
+
+// Wake a sleeping worker, unless there are none or one is already on its way.
+// A woken worker calls this again if it leaves tasks behind, so a burst of
+// tasks wakes workers one after another instead of costing a syscall per task.
+static void wake_one(struct aylp_queue *queue)
+{
+	// Pairs with the fence in dequeue(): either the worker sees our task
+	// when it checks one last time, or we see that it's sleeping.
+	atomic_thread_fence(memory_order_seq_cst);
+	if (!atomic_load_explicit(&queue->n_sleepers, memory_order_relaxed))
+		return;
+	if (atomic_exchange(&queue->waking, true))
+		return;
+	atomic_fetch_add(&queue->wake_seq, 1);
+	if (futex_wake(&queue->wake_seq, 1) < 1) {
+		// whoever we meant to wake got up by itself
+		atomic_store(&queue->waking, false);
+	}
+}
+
+
+static inline bool queue_empty(struct aylp_queue *queue)
+{
+	return atomic_load_explicit(&queue->head, memory_order_relaxed)
+		== atomic_load_explicit(&queue->tail, memory_order_relaxed);
+}
+
+
+// enqueue the same task `count` times, waking only one worker (which wakes the
+// next and so on)
+static void enqueue_n(struct aylp_queue *queue, struct aylp_task *task,
+	size_t count
+){
+	// count the task before anyone can run it, so that tasks_processing
+	// can't drop to zero while this task is still waiting
+	atomic_fetch_add(&queue->tasks_processing, count);
+	for (size_t i = 0; i < count; i++) {
+		while (!try_enqueue(queue, task)) {
+			wake_one(queue);
+			sched_yield();
+		}
+	}
+	wake_one(queue);
+}
+
+
+void task_enqueue(struct aylp_queue *queue, struct aylp_task *task)
+{
+	enqueue_n(queue, task, 1);
+}
+
+
+// spinning only helps if the producer can run while we spin
+static unsigned spin_count(void)
+{
+	return sysconf(_SC_NPROCESSORS_ONLN) > 1 ? AYLP_QUEUE_SPIN : 0;
+}
+
+
+static struct aylp_task *dequeue(struct aylp_queue *queue, unsigned spin)
 {
-	int err;
 	struct aylp_task *ret;
-	err = pthread_mutex_lock(&queue->mutex);
-	if (err) throw(err);
-	// mutex grabbed
-	{
-		// if queue is empty, wait for a task
-		while (!queue->oldest_task) {
-			err = pthread_cond_wait(&queue->ready, &queue->mutex);
-			if (err) throw(err);
-			if (queue->exit) {
-				err = pthread_mutex_unlock(&queue->mutex);
-				if (err) throw(err);
+	while (1) {
+		// spin and then yield for a bit in case a task turns up soon
+		for (unsigned i = 0; i < spin + AYLP_QUEUE_YIELD; i++) {
+			ret = try_dequeue(queue);
+			if (ret) {
+				if (!queue_empty(queue)) wake_one(queue);
+				return ret;
+			}
+			if (atomic_load_explicit(&queue->exit,
+				memory_order_relaxed
+			)) {
 				log_trace("Thread exiting");
 				return 0;
 			}
+			if (i < spin) cpu_relax();
+			else sched_yield();
+		}
+		// nothing yet, so go to sleep until there's a new task
+		unsigned seq = atomic_load(&queue->wake_seq);
+		atomic_fetch_add(&queue->n_sleepers, 1);
+		atomic_thread_fence(memory_order_seq_cst);
+		ret = try_dequeue(queue);
+		if (!ret && !atomic_load(&queue->exit))
+			futex_wait(&queue->wake_seq, seq);
+		atomic_fetch_sub(&queue->n_sleepers, 1);
+		atomic_store(&queue->waking, false);
+		atomic_thread_fence(memory_order_seq_cst);
+		if (ret) {
+			if (!queue_empty(queue)) wake_one(queue);
+			return ret;
+		}
+		if (atomic_load(&queue->exit)) {
+			log_trace("Thread exiting");
+			return 0;
 		}
-		// grab oldest task and remove it from the queue
-		ret = queue->oldest_task;
-		queue->oldest_task = ret->next_task;
-		// can technically overflow at SIZE_MAX; but is that really
-		// worth checking?
-		queue->tasks_processing += 1;
 	}
-	// release mutex
-	err = pthread_mutex_unlock(&queue->mutex);
-	if (err) throw(err);
-	return ret;
+}
+
+
+struct aylp_task *task_dequeue(struct aylp_queue *queue)
+{
+	return dequeue(queue, spin_count());
 }
 
 
 void *task_runner(void *queue)
 {
 	struct aylp_queue *q = queue;
+	unsigned spin = spin_count();
 	while (1) {
-		struct aylp_task *task = task_dequeue(q);
-		if (q->exit) return 0;
+		struct aylp_task *task = dequeue(q, spin);
+		if (!task) return 0;
 		task->func(task->src, task->dst);
-		q->tasks_processing -= 1;
+		atomic_fetch_sub_explicit(&q->tasks_processing, 1,
+			memory_order_release
+		);
 	}
 	return 0;
 }
 
+
+void shut_queue(struct aylp_queue *queue)
+{
+	atomic_store(&queue->exit, true);
+	atomic_fetch_add(&queue->wake_seq, 1);
+	futex_wake(&queue->wake_seq, INT_MAX);
+}
+
+
+int pool_start(struct aylp_pool *pool, size_t n_threads, int *cpus,
+	size_t n_cpus
+){
+	int err;
+	pool->spin = spin_count();
+	pool->cpus = cpus;
+	pool->n_cpus = n_cpus;
+	if (!n_threads) return 0;
+	pool->threads = xcalloc(n_threads, sizeof(pthread_t));
+	for (size_t t = 0; t < n_threads; t++) {
+		err = pthread_create(&pool->threads[t],
+			0, task_runner, &pool->queue
+		);
+		if (err) {
+			log_error("Couldn't create pthread: %s", strerror(err));
+			return -1;
+		}
+		pool->n_threads = t + 1;
+		if (n_cpus) pin_thread(pool->threads[t], cpus[t % n_cpus]);
+		realtime_setup_worker(pool->threads[t]);
+	}
+	log_info("Started %zu threads", pool->n_threads);
+	return 0;
+}
+
+
+void pool_stop(struct aylp_pool *pool)
+{
+	shut_queue(&pool->queue);
+	for (size_t t = 0; t < pool->n_threads; t++) {
+		pthread_join(pool->threads[t], 0);
+	}
+	xfree(pool->threads);
+	pool->n_threads = 0;
+}
+
+
+int pool_for_device(struct aylp_device *self, size_t thread_count,
+	struct aylp_pool **pool, struct aylp_pool **own_pool
+){
+	if (thread_count > 1) {
+		// pinned like the shared workers, off the loop cpus
+		int *cpus = self->pool ? self->pool->cpus : 0;
+		size_t n_cpus = self->pool ? self->pool->n_cpus : 0;
+		*own_pool = xcalloc(1, sizeof(struct aylp_pool));
+		if (pool_start(*own_pool, thread_count - 1, cpus, n_cpus))
+			return -1;
+		*pool = *own_pool;
+	} else if (self->pool && self->pool->n_threads) {
+		*pool = self->pool;
+	}
+	return 0;
+}
+
+
+void pool_release(struct aylp_pool **own_pool)
+{
+	if (!*own_pool) return;
+	pool_stop(*own_pool);
+	xfree(*own_pool);
+}
+
+
+// set in parallel_job.active while the caller is asleep waiting on it
+#define JOB_WAITING (1U << 31)
+
+/** A range of indices being worked on by aylp_parallel_for. */
+struct parallel_job {
+	void (*fn)(void *ctx, size_t start, size_t end);
+	void *ctx;
+	size_t n;
+	size_t chunk;
+	// start of the next chunk to be handed out
+	atomic_size_t next;
+	// number of helper tasks not yet done, plus JOB_WAITING (futex word)
+	atomic_uint active;
+	// task enqueued once for each worker that helps out
+	struct aylp_task task;
+};
+
+
+static void run_chunks(struct parallel_job *job)
+{
+	while (1) {
+		size_t start = atomic_fetch_add_explicit(&job->next, job->chunk,
+			memory_order_relaxed
+		);
+		if (start >= job->n) return;
+		size_t end = job->n - start > job->chunk ?
+			start + job->chunk : job->n;
+		job->fn(job->ctx, start, end);
+	}
+}
+
+
+static void parallel_helper(void *src, void *dst)
+{
+	UNUSED(dst);
+	struct parallel_job *job = src;
+	run_chunks(job);
+	// as soon as this lands, the job can go out of scope, so only use its
+	// address from here on (a stray futex wake is harmless)
+	unsigned old = atomic_fetch_sub_explicit(&job->active, 1,
+		memory_order_release
+	);
+	if (old == (JOB_WAITING | 1)) futex_wake(&job->active, 1);
+}
+
+
+void aylp_parallel_for(struct aylp_pool *pool, size_t n, size_t chunk,
+	void (*fn)(void *ctx, size_t start, size_t end), void *ctx
+){
+	if (!n) return;
+	if (!chunk) chunk = 1;
+	size_t n_chunks = (n - 1) / chunk + 1;
+	// no point in waking more workers than there are chunks for them
+	size_t n_helpers = pool ? pool->n_threads : 0;
+	if (n_helpers > n_chunks - 1) n_helpers = n_chunks - 1;
+	struct parallel_job job = {
+		.fn = fn,
+		.ctx = ctx,
+		.n = n,
+		.chunk = chunk,
+		.active = n_helpers,
+		.task = {.func = parallel_helper, .src = &job},
+	};
+	if (n_helpers) enqueue_n(&pool->queue, &job.task, n_helpers);
+	run_chunks(&job);
+	if (!n_helpers) return;
+
+	// wait for the helpers, first spinning, then sleeping
+	unsigned active = atomic_load_explicit(&job.active,
+		memory_order_acquire
+	);
+	for (unsigned i = 0; active && i < pool->spin + AYLP_QUEUE_YIELD; i++) {
+		if (i < pool->spin) cpu_relax();
+		else sched_yield();
+		active = atomic_load_explicit(&job.active,
+			memory_order_acquire
+		);
+	}
+	if (!active) return;
+	active = atomic_fetch_or(&job.active, JOB_WAITING) | JOB_WAITING;
+	while (active != JOB_WAITING) {
+		futex_wait(&job.active, active);
+		active = atomic_load_explicit(&job.active,
+			memory_order_acquire
+		);
+	}
+}
+
@@ -4,41 +4,72 @@
 #include <pthread.h>
 #include <stdatomic.h>
 #include <stdbool.h>
+#include <stddef.h>
 
-/** Task object to be put in queues. Essentially forms a singly linked list. */
+/** Maximum number of tasks waiting in a queue; must be a power of two.
+* Enqueueing onto a full queue yields until a worker makes room. */
+#define AYLP_QUEUE_SIZE 1024
+
+/** Number of times a worker polls an empty queue before yielding its CPU.
+* Workers skip this on single-CPU machines. */
+#define AYLP_QUEUE_SPIN 512
+
+/** Number of times a worker yields its CPU before sleeping on a futex. */
+#define AYLP_QUEUE_YIELD 16
+
+// to keep the producer and consumer ends of a queue on separate cache lines
+#define AYLP_CACHE_LINE 64
+
+/** Task object to be put in queues. */
 struct aylp_task {
 	void (*func)(void *src, void *dst);	// the function to call
 	void *src;				// where to read input from
 	void *dst;				// where to put output
-	struct aylp_task *next_task;		// older task on queue, if any
+};
+
+/** Cell in the ring buffer of a queue. */
+struct aylp_queue_cell {
+	// sequence number, stored relative to the index of the cell so that
+	// a zeroed cell is a valid empty cell (see thread_pool.c)
+	atomic_size_t seq;
+	struct aylp_task *task;
 };
 
 /** Queue object for thread pool.
-* The managing process should use task_enqueue and task_dequeue to add and
-* remove tasks to this queue, and should check if tasks_processing is zero to
-* decide if all tasks are done in the queue. The process should also call
-* shut_queue to make all threads waiting on the queue to exit. */
+* This is a bounded, lock-free, multi-producer multi-consumer queue. A queue
+* that is all zeros (e.g. from calloc) is empty and ready to use. The managing
+* process should use task_enqueue and task_dequeue to add and remove tasks to
+* this queue, and should check if tasks_processing is zero to decide if all
+* tasks are done in the queue. The process should also call shut_queue to make
+* all threads waiting on the queue to exit. */
 struct aylp_queue {
-	// mutex for queue writes to prevent race conditions
-	pthread_mutex_t mutex;
-	// condition to signal that there is a task ready
-	pthread_cond_t ready;
-	// the oldest task in the queue, which will be processed next
-	struct aylp_task *oldest_task;
-	// the task most recently added to the queue (it may be completed!)
-	struct aylp_task *newest_task;
+	// position at which the next task will be enqueued
+	atomic_size_t tail;
+	char pad_tail[AYLP_CACHE_LINE - sizeof(atomic_size_t)];
+	// position from which the next task will be dequeued
+	atomic_size_t head;
+	char pad_head[AYLP_CACHE_LINE - sizeof(atomic_size_t)];
+	// futex word, bumped to wake up sleeping workers
+	atomic_uint wake_seq;
+	// number of workers sleeping (or about to sleep) on wake_seq
+	atomic_uint n_sleepers;
+	// true while a woken worker has yet to start looking for tasks
+	atomic_bool waking;
 	// true when threads should exit
-	bool exit;
-	// count of tasks that are not done; safe to read/write without mutex
+	atomic_bool exit;
+	// count of tasks that have been enqueued but are not done yet
 	atomic_size_t tasks_processing;
+	char pad_state[AYLP_CACHE_LINE];
+	// the ring buffer itself
+	struct aylp_queue_cell cells[AYLP_QUEUE_SIZE];
 };
 
-/** Add a new task to the queue. This call blocks. */
+/** Add a new task to the queue. Only blocks if the queue is full. */
 void task_enqueue(struct aylp_queue *queue, struct aylp_task *task);
 
 /** Grab the oldest task (if any), or wait for a new one if there are no tasks.
-* This call blocks. Returns a pointer to the oldest task and removes it from the
-* queue. */
+* Waiting spins for a while and then sleeps. Returns a pointer to the oldest
+* task and removes it from the queue, or returns null if the queue was shut. */
 struct aylp_task *task_dequeue(struct aylp_queue *queue);
 
 /** Start running tasks on the queue.
@@ -47,10 +78,61 @@ struct aylp_task *task_dequeue(struct aylp_queue *queue);
 void *task_runner(void *queue);
 
 /** Shut down queue, telling threads to exit. */
-static inline void shut_queue(struct aylp_queue *queue) {
-	queue->exit = true;
-	pthread_cond_broadcast(&queue->ready);
-}
+void shut_queue(struct aylp_queue *queue);
+
+/** Thread pool object: a queue and the worker threads that run its tasks.
+* Start it on a zeroed struct with pool_start and stop it with pool_stop. */
+struct aylp_pool {
+	// queue that the workers take tasks from
+	struct aylp_queue queue;
+	// array of worker threads
+	pthread_t *threads;
+	// number of worker threads
+	size_t n_threads;
+	// how long callers spin before sleeping (see AYLP_QUEUE_SPIN)
+	unsigned spin;
+	// cpus the workers were pinned to, round-robin, if n_cpus isn't 0; for
+	// the shared pool, private pools from pool_for_device use them too
+	int *cpus;
+	size_t n_cpus;
+};
+
+/** Start n_threads workers on a zeroed pool, pinning them round-robin to the
+* n_cpus cpus (if any). In realtime mode, they are also set up with
+* realtime_setup_worker. Returns 0 on success, or -1 on failure. */
+int pool_start(struct aylp_pool *pool, size_t n_threads, int *cpus,
+	size_t n_cpus
+);
+
+/** Tell the workers of a pool to exit, and wait for them to do so. */
+void pool_stop(struct aylp_pool *pool);
+
+// see anyloop.h
+struct aylp_device;
+
+/** Work out which pool a device should hand its work to. If thread_count is
+* above 1, start a private pool of thread_count - 1 workers (the loop thread
+* does a share of the work too), pinned to the same cpus as the shared pool's
+* workers, and return it in both *pool and *own_pool.
+* Otherwise, borrow the shared pool if it has any workers, or leave *pool
+* null. Returns 0 on success, or -1 if the private pool couldn't be started.
+* Give back the private pool (if any) in fini with pool_release. */
+int pool_for_device(struct aylp_device *self, size_t thread_count,
+	struct aylp_pool **pool, struct aylp_pool **own_pool
+);
+
+/** Stop and free a private pool from pool_for_device, if there is one. */
+void pool_release(struct aylp_pool **own_pool);
+
+/** Call fn(ctx, start, end) over the index range [0, n), in chunks of at most
+* `chunk` indices. The whole range is published to the pool at once, and then
+* the workers and the calling thread all take chunks until none are left. This
+* returns when every chunk is done. Chunks may run concurrently and in any
+* order. If pool is null or has no workers, everything runs on the calling
+* thread. Don't call this from inside fn. */
+void aylp_parallel_for(struct aylp_pool *pool, size_t n, size_t chunk,
+	void (*fn)(void *ctx, size_t start, size_t end), void *ctx
+);
 
 #endif
 
@@ -1,9 +1,30 @@
 #include "xalloc.h"
 
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include "logging.h"
 
+// hugepage arena that xmalloc_aligned carves buffers out of, if enabled
+static struct {
+	bool enabled;
+	pthread_mutex_t lock;
+	// the mapping we're carving from, and how much of it is taken
+	char *base;
+	size_t len;
+	size_t used;
+	// every mapping so far, so that xfree_aligned can tell arena memory
+	// from heap memory
+	struct arena_map {
+		char *base;
+		size_t len;
+	} *maps;
+	size_t n_maps;
+} arena = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
 void *xmalloc(size_t size)
 {
 	void *ptr = malloc(size);
@@ -43,3 +64,212 @@ void *alloc_check(void *ptr)
 	return ptr;
 }
 
+void *map_hugepages(size_t size, size_t *len)
+{
+	// explicit hugepages have to be reserved by the admin, so we usually
+	// end up asking for transparent ones
+	*len = (size + XALLOC_HUGEPAGE_SIZE - 1) / XALLOC_HUGEPAGE_SIZE
+		* XALLOC_HUGEPAGE_SIZE;
+	char *p = mmap(0, *len, PROT_READ|PROT_WRITE,
+		MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB|MAP_POPULATE, -1, 0
+	);
+	if (p != MAP_FAILED) {
+		log_debug("Got %zu explicit hugepages",
+			*len / XALLOC_HUGEPAGE_SIZE
+		);
+		return p;
+	}
+	// map an extra hugepage, so we can trim it down to an aligned start
+	char *raw = mmap(0, *len + XALLOC_HUGEPAGE_SIZE, PROT_READ|PROT_WRITE,
+		MAP_PRIVATE|MAP_ANONYMOUS, -1, 0
+	);
+	if (raw == MAP_FAILED) {
+		log_error("Couldn't map %zu bytes: %s", *len, strerror(errno));
+		return 0;
+	}
+	size_t head = (XALLOC_HUGEPAGE_SIZE
+		- (uintptr_t)raw % XALLOC_HUGEPAGE_SIZE) % XALLOC_HUGEPAGE_SIZE;
+	if (head) munmap(raw, head);
+	munmap(raw + head + *len, XALLOC_HUGEPAGE_SIZE - head);
+	p = raw + head;
+	if (madvise(p, *len, MADV_HUGEPAGE)) {
+		log_warn("Couldn't advise hugepages: %s", strerror(errno));
+	}
+	// fault them in now that we've asked for hugepages, rather than in the
+	// loop
+	for (size_t off = 0; off < *len; off += XALLOC_HUGEPAGE_SIZE)
+		p[off] = 0;
+	return p;
+}
+
+void xalloc_use_hugepages(void)
+{
+	arena.enabled = true;
+	log_info("Pipeline buffers will be allocated in hugepages");
+}
+
+void xalloc_close_hugepages(void)
+{
+	pthread_mutex_lock(&arena.lock);
+	if (arena.enabled) {
+		log_debug("Done with hugepages, %zu bytes of the last mapping "
+			"unused", arena.len - arena.used
+		);
+	}
+	arena.enabled = false;
+	pthread_mutex_unlock(&arena.lock);
+}
+
+// Take size bytes from the arena, mapping more of it if needed. Returns null
+// if we couldn't, in which case the arena is turned off.
+static void *arena_alloc(size_t size)
+{
+	size = (size + XALLOC_ALIGN - 1) / XALLOC_ALIGN * XALLOC_ALIGN;
+	pthread_mutex_lock(&arena.lock);
+	// check again, now that we hold the lock
+	if (!arena.enabled) {
+		pthread_mutex_unlock(&arena.lock);
+		return 0;
+	}
+	void *ret;
+	if (arena.base && arena.len - arena.used >= size) {
+		ret = arena.base + arena.used;
+		arena.used += size;
+	} else {
+		size_t len;
+		char *p = map_hugepages(size, &len);
+		if (!p) {
+			log_warn(
+				"Falling back to the heap for pipeline buffers"
+			);
+			arena.enabled = false;
+			pthread_mutex_unlock(&arena.lock);
+			return 0;
+		}
+		arena.maps = xrealloc(arena.maps,
+			(arena.n_maps + 1) * sizeof(struct arena_map)
+		);
+		arena.maps[arena.n_maps++] = (struct arena_map){p, len};
+		ret = p;
+		// keep carving from whichever mapping has more room left, so a
+		// big buffer doesn't throw away the rest of the old one
+		if (!arena.base || len - size > arena.len - arena.used) {
+			arena.base = p;
+			arena.len = len;
+			arena.used = size;
+		}
+	}
+	pthread_mutex_unlock(&arena.lock);
+	return ret;
+}
+
+static bool in_arena(const void *ptr)
+{
+	const char *p = ptr;
+	bool ret = false;
+	pthread_mutex_lock(&arena.lock);
+	for (size_t i = 0; i < arena.n_maps && !ret; i++) {
+		struct arena_map *m = &arena.maps[i];
+		ret = m->base <= p && p < m->base + m->len;
+	}
+	pthread_mutex_unlock(&arena.lock);
+	return ret;
+}
+
+void *xmalloc_aligned(size_t size)
+{
+	if (arena.enabled) {
+		void *ptr = arena_alloc(size);
+		if (ptr) return ptr;
+	}
+	void *ptr;
+	// ask for at least a byte, so we never get a null pointer back
+	if (posix_memalign(&ptr, XALLOC_ALIGN, size ? size : 1)) ptr = NULL;
+	return alloc_check(ptr);
+}
+
+void *xcalloc_aligned(size_t nelem, size_t elsize)
+{
+	size_t size = nelem * elsize;
+	if (elsize && size / elsize != nelem) {
+		log_fatal("Failed to allocate memory");
+		abort();
+	}
+	void *ptr = xmalloc_aligned(size);
+	memset(ptr, 0, size);
+	return ptr;
+}
+
+void xfree_aligned_impl(void **ptr)
+{
+	// arena memory is only given back when we exit
+	if (*ptr && !in_arena(*ptr)) free(*ptr);
+	*ptr = NULL;
+}
+
+// Size of the gsl structs at the start of an aligned gsl allocation, rounded
+// up so that the data after them is aligned too.
+static size_t head_size(size_t structs)
+{
+	return (structs + XALLOC_ALIGN - 1) / XALLOC_ALIGN * XALLOC_ALIGN;
+}
+
+#define DEFINE_ALIGNED_BLOCK(btype, elem) \
+btype *aligned_##btype##_alloc(bool zero, size_t n) \
+{ \
+	size_t head = head_size(sizeof(btype)); \
+	size_t size = head + n * sizeof(elem); \
+	char *p = zero ? xcalloc_aligned(1, size) : xmalloc_aligned(size); \
+	btype *b = (btype *)p; \
+	b->size = n; \
+	b->data = (elem *)(p + head); \
+	return b; \
+}
+#define DEFINE_ALIGNED_VECTOR(vtype, btype, elem) \
+vtype *aligned_##vtype##_alloc(bool zero, size_t n) \
+{ \
+	size_t head = head_size(sizeof(vtype) + sizeof(btype)); \
+	size_t size = head + n * sizeof(elem); \
+	char *p = zero ? xcalloc_aligned(1, size) : xmalloc_aligned(size); \
+	vtype *v = (vtype *)p; \
+	btype *b = (btype *)(p + sizeof(vtype)); \
+	b->size = n; \
+	b->data = (elem *)(p + head); \
+	v->size = n; \
+	v->stride = 1; \
+	v->data = b->data; \
+	v->block = b; \
+	/* so that gsl never tries to free the block itself */ \
+	v->owner = 0; \
+	return v; \
+}
+#define DEFINE_ALIGNED_MATRIX(mtype, btype, elem) \
+mtype *aligned_##mtype##_alloc(bool zero, size_t n1, size_t n2) \
+{ \
+	size_t head = head_size(sizeof(mtype) + sizeof(btype)); \
+	size_t size = head + n1 * n2 * sizeof(elem); \
+	char *p = zero ? xcalloc_aligned(1, size) : xmalloc_aligned(size); \
+	mtype *m = (mtype *)p; \
+	btype *b = (btype *)(p + sizeof(mtype)); \
+	b->size = n1 * n2; \
+	b->data = (elem *)(p + head); \
+	m->size1 = n1; \
+	m->size2 = n2; \
+	m->tda = n2; \
+	m->data = b->data; \
+	m->block = b; \
+	m->owner = 0; \
+	return m; \
+}
+DEFINE_ALIGNED_BLOCK(gsl_block, double)
+DEFINE_ALIGNED_VECTOR(gsl_vector, gsl_block, double)
+DEFINE_ALIGNED_MATRIX(gsl_matrix, gsl_block, double)
+DEFINE_ALIGNED_BLOCK(gsl_block_uchar, unsigned char)
+DEFINE_ALIGNED_MATRIX(gsl_matrix_uchar, gsl_block_uchar, unsigned char)
+DEFINE_ALIGNED_MATRIX(gsl_matrix_ushort, gsl_block_ushort, unsigned short)
+DEFINE_ALIGNED_VECTOR(gsl_vector_float, gsl_block_float, float)
+DEFINE_ALIGNED_MATRIX(gsl_matrix_float, gsl_block_float, float)
+#undef DEFINE_ALIGNED_BLOCK
+#undef DEFINE_ALIGNED_VECTOR
+#undef DEFINE_ALIGNED_MATRIX
+
@@ -2,7 +2,9 @@
 #define AYLP_XALLOC_H_
 
 #include <stdarg.h>
+#include <stdbool.h>
 #include <stdlib.h>
+#include <gsl/gsl_matrix.h>
 
 // x*alloc functions behave identically to their normal *alloc counterparts
 // except that they abort the program on memory allocation failure
@@ -23,5 +25,63 @@ void *alloc_check(void *ptr);
 
 char *xstrdup(const char *str);
 
+// alignment of everything from the *_aligned functions: a cache line, so that
+// buffers don't share lines with each other and SIMD loads from their start
+// don't straddle two
+#define XALLOC_ALIGN 64
+// size of a (transparent) hugepage
+#define XALLOC_HUGEPAGE_SIZE (2UL << 20)
+
+// Like xmalloc and xcalloc, but XALLOC_ALIGN-aligned, and carved out of
+// hugepages between xalloc_use_hugepages() and xalloc_close_hugepages().
+// Memory from these must be freed with xfree_aligned (which, for hugepages,
+// only gives it back to the arena when the program exits, so they're meant
+// for buffers that live as long as the device does).
+void *xmalloc_aligned(size_t size);
+void *xcalloc_aligned(size_t nelem, size_t elsize);
+#define xfree_aligned(x) xfree_aligned_impl((void **) &x)
+void xfree_aligned_impl(void **ptr);
+
+// Make xmalloc_aligned and friends hand out hugepages from now on. Only meant
+// to be called once, before any devices are initialized.
+void xalloc_use_hugepages(void);
+
+// Go back to the heap for xmalloc_aligned and friends. Called right before the
+// loop starts, so that buffers a device reallocates when its input changes size
+// don't keep eating hugepages that can't be given back.
+void xalloc_close_hugepages(void);
+
+// Map at least size bytes of anonymous memory in hugepages, explicit ones
+// (MAP_HUGETLB) if the admin reserved any and transparent ones otherwise, all
+// faulted in already. Sets *len to the length to munmap(). Returns null (after
+// logging) on failure.
+void *map_hugepages(size_t size, size_t *len);
+
+// Versions of xmalloc_type, xcalloc_type, and xfree_type for gsl blocks,
+// vectors, and matrices whose data is XALLOC_ALIGN-aligned, e.g.
+// `xmalloc_aligned_type(gsl_vector, 5)`. The gsl struct, its block, and its
+// data share one allocation from xmalloc_aligned, so they must be freed with
+// xfree_aligned_type (whose type is only there to match xfree_type), never
+// with the gsl_*_free functions.
+#define xmalloc_aligned_type(type, ...) \
+	aligned_##type##_alloc(false, __VA_ARGS__)
+#define xcalloc_aligned_type(type, ...) \
+	aligned_##type##_alloc(true, __VA_ARGS__)
+#define xfree_aligned_type(type, ptr) xfree_aligned(ptr)
+gsl_block *aligned_gsl_block_alloc(bool zero, size_t n);
+gsl_vector *aligned_gsl_vector_alloc(bool zero, size_t n);
+gsl_matrix *aligned_gsl_matrix_alloc(bool zero, size_t n1, size_t n2);
+gsl_block_uchar *aligned_gsl_block_uchar_alloc(bool zero, size_t n);
+gsl_matrix_uchar *aligned_gsl_matrix_uchar_alloc(bool zero,
+	size_t n1, size_t n2
+);
+gsl_matrix_ushort *aligned_gsl_matrix_ushort_alloc(bool zero,
+	size_t n1, size_t n2
+);
+gsl_vector_float *aligned_gsl_vector_float_alloc(bool zero, size_t n);
+gsl_matrix_float *aligned_gsl_matrix_float_alloc(bool zero,
+	size_t n1, size_t n2
+);
+
 #endif
 
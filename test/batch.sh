@@ -0,0 +1,101 @@
+#!/bin/sh
+set -e
+
+if [ -z "$TMP_DIR" ]; then
+	echo "TMP_DIR not set"
+	exit 1
+fi
+if [ -z "$BUILD_DIR" ]; then
+	echo "BUILD_DIR not set"
+	exit 1
+fi
+
+# for the helpers in test.sh
+AYLP_TEST_HELPERS=1 . "$(dirname "$0")/test.sh"
+
+# $1 is the number of frames per iteration
+write_conf() {
+pipeline_conf 12 "\"loop\": {\"batch\": $1}" <<EOF
+	{
+		"uri": "anyloop:test_source",
+			"params": {
+				"type": "vector",
+				"size1": 8,
+				"kind": "sine",
+				"frequency": 0.7,
+				"amplitude": 0.9
+			}
+	},
+	{
+		"uri": "anyloop:matmul",
+		"params": {
+			"type": "vector",
+			"matrix": [[0.5, 0.25, 0, 0, 0, 0, 0, 0.25],
+				[0, 0.5, 0.5, 0.5, 0, 0, 0, 0],
+				[0, 0, 0, 0, 1, 1, 0, 0],
+				[-0.25, -0.25, 0, 0, 0, 0, 0, 1]]
+		}
+	},
+	{
+		"uri": "anyloop:pid",
+		"params": {
+			"type": "vector",
+			"p": 0.5,
+			"i": 2,
+			"fixed_dt": 0.1
+		}
+	},
+	{
+		"uri": "anyloop:iir",
+		"params": {
+			"coefficients": [[0.1, 0.05, 0, 1, -0.8, 0.02]]
+		}
+	},
+	{
+		"uri": "anyloop:clamp",
+		"params": {
+			"type": "vector",
+			"min": -0.3,
+			"max": 0.4
+		}
+	}
+EOF
+}
+
+write_conf 1 > "$TMP_DIR/batch_1.json"
+single=$(logged "$TMP_DIR/batch_1.json")
+
+# 12 frames in 3 iterations, each logged as a matrix with one frame per
+# column, which we turn back into one line per frame
+write_conf 4 > "$TMP_DIR/batch_4.json"
+batched=$( \
+	"$BUILD_DIR"/anyloop -l INFO "$TMP_DIR/batch_4.json" 2>&1 \
+	| awk '
+		/Seeing matrix/ { reading = 1; rows = 0; next }
+		reading && /^\[/ { next }
+		reading && /^\]/ {
+			for (c = 1; c <= cols; c++) {
+				line = "["
+				for (r = 1; r <= rows; r++)
+					line = line (r > 1 ? ", " : "") m[r, c]
+				print line "]"
+			}
+			reading = 0; next
+		}
+		reading {
+			rows++; cols = split($0, f, ", *")
+			# the last field is empty, after the trailing comma
+			cols--
+			for (c = 1; c <= cols; c++) {
+				gsub(/ /, "", f[c]); m[rows, c] = f[c]
+			}
+		}
+	' \
+)
+
+if [ "$(echo "$single" | wc -l)" != "12" ] || [ "$batched" != "$single" ]; then
+	echo "batch FAIL"
+	exit 1
+fi
+
+echo "batch PASS"
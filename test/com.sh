@@ -10,6 +10,9 @@ if [ -z "$BUILD_DIR" ]; then
 	exit 1
 fi
 
+# for the helpers in test.sh
+AYLP_TEST_HELPERS=1 . "$(dirname "$0")/test.sh"
+
 cat > "$TMP_DIR/com.json" <<EOF
 {
 	"pipeline": [
@@ -53,4 +56,149 @@ if [ $res != "8" ]; then
 	exit 1
 fi
 
+# a dark frame that varies from row to row, so that preprocessed regions have
+# centroids off the middle (see pool.sh)
+column=$(awk 'BEGIN {
+	for (y = 0; y < 256; y++) printf "%s[%d]", y ? ", " : "", y * y * 7 % 61
+}')
+cat > "$TMP_DIR/com_dark.json" <<EOF
+{
+	"pipeline": [
+	{
+		"uri": "anyloop:test_source",
+			"params": {
+				"type": "matrix",
+				"kind": "constant",
+				"offset": 1,
+				"size1": 1,
+				"size2": 256
+			}
+	},
+	{
+		"uri": "anyloop:matmul",
+		"params": {
+			"type": "matrix",
+			"matrix": [$column]
+		}
+	},
+	{
+		"uri": "anyloop:file_sink",
+		"params": {
+			"filename": "$TMP_DIR/com_dark.aylp"
+		}
+	},
+	{
+		"uri": "anyloop:stop_after_count",
+		"params": {
+			"count": 1
+		}
+	}
+	]
+}
+EOF
+rm -f "$TMP_DIR/com_dark.aylp"
+"$BUILD_DIR"/anyloop "$TMP_DIR/com_dark.json" >/dev/null 2>&1
+
+# $1 is the input type, $2 the mode, $3 the threshold, and $4 any other params
+write_conf() {
+pipeline_conf 1 <<EOF
+	{
+		"uri": "anyloop:test_source",
+			"params": {
+				"type": "$1",
+				"kind": "constant",
+				"offset": 1,
+				"size1": 256,
+				"size2": 256
+			}
+	},
+	{
+		"uri": "anyloop:center_of_mass",
+		"params": {
+			$4
+			"region_height": 64,
+			"region_width": 64,
+			"type": "$1",
+			"mode": "$2",
+			"dark": "$TMP_DIR/com_dark.aylp",
+			"threshold": $3
+		}
+	}
+EOF
+}
+
+# print the centroids of a flat image of value $1, in mode $2 with threshold
+# $3, worked out by hand; wcog weights are rounded to 1/128 as in the device
+expected() {
+	awk -v max="$1" -v mode="$2" -v thr="$3" 'BEGIN {
+		k = 4 * log(2) / (64 * 64)
+		for (r = 0; r < 4; r++) {
+			s = 0; ys = 0
+			for (yl = 0; yl < 64; yl++) {
+				y = r * 64 + yl
+				p = max - y * y * 7 % 61 - thr
+				if (p < 0) p = 0
+				w = 64
+				if (mode == "wcog") {
+					w = 0
+					for (j = 0; j < 64; j++) w += int(128 * exp(-k \
+						* ((yl - 31.5)^2 + (j - 31.5)^2)) + 0.5)
+				}
+				s += p * w; ys += p * w * yl
+			}
+			for (i = 0; i < 4; i++) print -1 + 2 * ys / (s * 63) "\n" 0
+		}
+	}'
+}
+
+# succeed if the lists of numbers in files $1 and $2 match to 5 digits
+same() {
+	[ "$(wc -l < "$1")" = "$(wc -l < "$2")" ] \
+	&& paste "$1" "$2" | awk '{
+		d = $1 - $2; if (d < 0) d = -d
+		if (d > 1e-5) exit 1
+	}'
+}
+
+for mode in tcog wcog; do
+	write_conf matrix_uchar $mode 100 > "$TMP_DIR/com_$mode.json"
+	logged_elements "$TMP_DIR/com_$mode.json" > "$TMP_DIR/com_$mode.txt"
+	expected 255 $mode 100 > "$TMP_DIR/com_expected.txt"
+	if ! same "$TMP_DIR/com_$mode.txt" "$TMP_DIR/com_expected.txt"; then
+		echo "com FAIL"
+		exit 1
+	fi
+	# ushort images are summed in wider lanes, but should agree
+	write_conf matrix_ushort $mode 65400 > "$TMP_DIR/com_ushort.json"
+	logged_elements "$TMP_DIR/com_ushort.json" > "$TMP_DIR/com_ushort.txt"
+	expected 65535 $mode 65400 > "$TMP_DIR/com_expected.txt"
+	if ! same "$TMP_DIR/com_ushort.txt" "$TMP_DIR/com_expected.txt"; then
+		echo "com FAIL"
+		exit 1
+	fi
+done
+
+# with nothing left above the threshold, every region counts as centered
+write_conf matrix_uchar tcog 255 > "$TMP_DIR/com_dark_out.json"
+logged_elements "$TMP_DIR/com_dark_out.json" > "$TMP_DIR/com_dark_out.txt"
+if [ "$(wc -l < "$TMP_DIR/com_dark_out.txt")" != "32" ] \
+|| grep -qv "^-*0$" "$TMP_DIR/com_dark_out.txt"; then
+	echo "com FAIL"
+	exit 1
+fi
+
+# only the regions in the mask are processed, in the same order
+mask="[[0, 1, 1, 0], [1, 1, 1, 1], [1, 1, 1, 1], [0, 1, 1, 0]]"
+write_conf matrix_uchar tcog 100 "\"valid_mask\": $mask," \
+	> "$TMP_DIR/com_mask.json"
+logged_elements "$TMP_DIR/com_mask.json" > "$TMP_DIR/com_mask.txt"
+echo "$mask" | tr -d '[], ' | fold -w1 | awk '{ print; print }' \
+	| paste - "$TMP_DIR/com_tcog.txt" | awk '$1 == 1 { print $2 }' \
+	> "$TMP_DIR/com_expected.txt"
+if [ "$(wc -l < "$TMP_DIR/com_mask.txt")" != "24" ] \
+|| ! same "$TMP_DIR/com_mask.txt" "$TMP_DIR/com_expected.txt"; then
+	echo "com FAIL"
+	exit 1
+fi
+
 echo "com PASS"
@@ -0,0 +1,72 @@
+#!/bin/sh
+set -e
+
+if [ -z "$TMP_DIR" ]; then
+	echo "TMP_DIR not set"
+	exit 1
+fi
+if [ -z "$BUILD_DIR" ]; then
+	echo "BUILD_DIR not set"
+	exit 1
+fi
+
+# for the helpers in test.sh
+AYLP_TEST_HELPERS=1 . "$(dirname "$0")/test.sh"
+
+# $1 is whether to use hugepages; with stages, so that the rings between them
+# get their slots from the arena too
+write_conf() {
+pipeline_conf 12 "\"hugepages\": $1" "\"loop\": {\"stages\": [2, 4]}" <<EOF
+	{
+		"uri": "anyloop:test_source",
+			"params": {
+				"type": "vector",
+				"size1": 8,
+				"kind": "sine",
+				"frequency": 0.7,
+				"amplitude": 0.9
+			}
+	},
+	{
+		"uri": "anyloop:matmul",
+		"params": {
+			"type": "vector",
+			"matrix": [[0.5, 0.25, 0, 0, 0, 0, 0, 0.25],
+				[0, 0.5, 0.5, 0.5, 0, 0, 0, 0],
+				[0, 0, 0, 0, 1, 1, 0, 0],
+				[-0.25, -0.25, 0, 0, 0, 0, 0, 1]]
+		}
+	},
+	{
+		"uri": "anyloop:pid",
+		"params": {
+			"type": "vector",
+			"p": 0.5,
+			"i": 2,
+			"fixed_dt": 0.1
+		}
+	},
+	{
+		"uri": "anyloop:clamp",
+		"params": {
+			"type": "vector",
+			"min": -0.3,
+			"max": 0.4
+		}
+	}
+EOF
+}
+
+write_conf false > "$TMP_DIR/hugepages_off.json"
+write_conf true > "$TMP_DIR/hugepages_on.json"
+heap=$(logged "$TMP_DIR/hugepages_off.json")
+
+if [ "$(echo "$heap" | sort -u | wc -l)" -lt 8 ] \
+|| ! "$BUILD_DIR"/anyloop -l INFO "$TMP_DIR/hugepages_on.json" 2>&1 \
+| grep -qF "allocated in hugepages" \
+|| [ "$(logged "$TMP_DIR/hugepages_on.json")" != "$heap" ]; then
+	echo "hugepages FAIL"
+	exit 1
+fi
+
+echo "hugepages PASS"
@@ -0,0 +1,97 @@
+#!/bin/sh
+set -e
+
+if [ -z "$TMP_DIR" ]; then
+	echo "TMP_DIR not set"
+	exit 1
+fi
+if [ -z "$BUILD_DIR" ]; then
+	echo "BUILD_DIR not set"
+	exit 1
+fi
+
+# for the helpers in test.sh
+AYLP_TEST_HELPERS=1 . "$(dirname "$0")/test.sh"
+
+# two sections per element, with a0 of the second one not 1 so that the
+# normalization counts; either one row shared by all 11 elements, or one
+# that differs per element
+awk 'BEGIN {
+	print 0.1, 0.05, 0, 1, -0.8, 0.02, 1, -0.5, 0.25, 2, -0.2, 0.1
+}' > "$TMP_DIR/iir_shared.txt"
+awk 'BEGIN {
+	for (j = 0; j < 11; j++) print 0.1 + 0.01 * j, 0.05, 0, 1, \
+		-0.8 + 0.02 * j, 0.02, 1, -0.5, 0.25, 2, -0.2 + 0.01 * j, 0.1
+}' > "$TMP_DIR/iir_each.txt"
+
+# $1 is the file of coefficients; the matmul scales the one-element source
+# to 11 elements (more than a whole number of SIMD lanes) that differ
+write_conf() {
+pipeline_conf 12 <<EOF
+	{
+		"uri": "anyloop:test_source",
+			"params": {
+				"type": "vector",
+				"size1": 1,
+				"kind": "sine",
+				"frequency": 0.7,
+				"amplitude": 0.9
+			}
+	},
+	{
+		"uri": "anyloop:matmul",
+		"params": {
+			"type": "vector",
+			"matrix": [[-1], [-0.8], [-0.6], [-0.4], [-0.2], [0], [0.2],
+				[0.4], [0.6], [0.8], [1]]
+		}
+	},
+	{
+		"uri": "anyloop:iir",
+		"params": {
+			"coefficients": [$(sed 's/ /, /g; s/.*/[&]/' "$1" | paste -s -d, -)]
+		}
+	}
+EOF
+}
+
+# the output for coefficients file $1, worked out by hand, one per line
+expected() {
+	awk '{ for (c = 1; c <= NF; c++) k[NR - 1, c - 1] = $c; rows = NR }
+	END {
+		for (t = 0; t < 12; t++) {
+			x = 0.9 * sin(0.7 * t)
+			for (j = 0; j < 11; j++) {
+				row = rows == 1 ? 0 : j
+				v = x * (0.2 * j - 1)
+				for (s = 0; s < 2; s++) {
+					b0 = k[row, 6*s]; b1 = k[row, 6*s + 1]
+					b2 = k[row, 6*s + 2]; a0 = k[row, 6*s + 3]
+					a1 = k[row, 6*s + 4]; a2 = k[row, 6*s + 5]
+					y = (b0 * v + b1 * x1[j, s] + b2 * x2[j, s] \
+						- a1 * y1[j, s] - a2 * y2[j, s]) / a0
+					x2[j, s] = x1[j, s]; x1[j, s] = v
+					y2[j, s] = y1[j, s]; y1[j, s] = y
+					v = y
+				}
+				print v
+			}
+		}
+	}' "$1"
+}
+
+for coeffs in shared each; do
+	write_conf "$TMP_DIR/iir_$coeffs.txt" > "$TMP_DIR/iir.json"
+	expected "$TMP_DIR/iir_$coeffs.txt" > "$TMP_DIR/iir_expected.txt"
+	logged_elements "$TMP_DIR/iir.json" > "$TMP_DIR/iir.txt"
+	if [ "$(wc -l < "$TMP_DIR/iir.txt")" != "132" ] \
+	|| ! paste "$TMP_DIR/iir.txt" "$TMP_DIR/iir_expected.txt" | awk '{
+		e = $1 - $2; if (e < 0) e = -e
+		if (e > 1e-5) exit 1
+	}'; then
+		echo "iir FAIL"
+		exit 1
+	fi
+done
+
+echo "iir PASS"
@@ -0,0 +1,109 @@
+#!/bin/sh
+set -e
+
+if [ -z "$TMP_DIR" ]; then
+	echo "TMP_DIR not set"
+	exit 1
+fi
+if [ -z "$BUILD_DIR" ]; then
+	echo "BUILD_DIR not set"
+	exit 1
+fi
+
+# Every device after test_source here has scratch output, so each one works
+# in place on the buffer of the one before; the first logger only reads the
+# data, so clamp should still get to overwrite it.
+cat > "$TMP_DIR/inplace.json" <<EOF
+{
+	"pipeline": [
+	{
+		"uri": "anyloop:test_source",
+			"params": {
+				"type": "matrix",
+				"size1": 1,
+				"size2": 1,
+				"kind": "sine",
+				"frequency": 0.7,
+				"amplitude": 0.9
+			}
+	},
+	{
+		"uri": "anyloop:matmul",
+		"params": {
+			"type": "matrix",
+			"matrix": [[-0.6], [-0.4], [-0.2], [0], [0.2], [0.4], [0.6],
+				[0.8], [1], [1.2], [1.4]]
+		}
+	},
+	{
+		"uri": "anyloop:remove_piston"
+	},
+	{
+		"uri": "anyloop:logger"
+	},
+	{
+		"uri": "anyloop:clamp",
+		"params": {
+			"type": "matrix",
+			"min": -0.3,
+			"max": 0.4
+		}
+	},
+	{
+		"uri": "anyloop:pid",
+		"params": {
+			"type": "matrix",
+			"p": 0.5,
+			"i": 2,
+			"fixed_dt": 0.1
+		}
+	},
+	{
+		"uri": "anyloop:logger"
+	},
+	{
+		"uri": "anyloop:stop_after_count",
+		"params": {
+			"count": 12
+		}
+	}
+	]
+}
+EOF
+
+# what both loggers should see, worked out by hand, one element per line
+awk 'BEGIN {
+	for (t = 0; t < 12; t++) {
+		x = 0.9 * sin(0.7 * t)
+		# the scales average to 0.4
+		for (j = 0; j < 11; j++) print x * (0.2 * j - 1)
+		for (j = 0; j < 11; j++) {
+			s = x * (0.2 * j - 1)
+			if (s < -0.3) s = -0.3
+			if (s > 0.4) s = 0.4
+			a[j] += 0.1 * s
+			if (a[j] < -1) a[j] = -1
+			if (a[j] > 1) a[j] = 1
+			r = - 0.5 * s - 2 * a[j]
+			if (r < -1) r = -1
+			if (r > 1) r = 1
+			print r
+		}
+	}
+}' > "$TMP_DIR/inplace_expected.txt"
+
+# the loggers print matrices one row per line, with a trailing comma
+"$BUILD_DIR"/anyloop -l INFO "$TMP_DIR/inplace.json" 2>&1 \
+| awk '/logger.c/ { logged = 1 } /^\]/ { logged = 0 } logged && /^  /' \
+| tr -d ', ' > "$TMP_DIR/inplace.txt"
+
+if [ "$(wc -l < "$TMP_DIR/inplace.txt")" != "264" ] \
+|| ! paste "$TMP_DIR/inplace.txt" "$TMP_DIR/inplace_expected.txt" | awk '{
+	e = $1 - $2; if (e < 0) e = -e
+	if (e > 1e-5) exit 1
+}'; then
+	echo "inplace FAIL"
+	exit 1
+fi
+
+echo "inplace PASS"
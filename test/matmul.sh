@@ -10,6 +10,9 @@ if [ -z "$BUILD_DIR" ]; then
 	exit 1
 fi
 
+# for the helpers in test.sh
+AYLP_TEST_HELPERS=1 . "$(dirname "$0")/test.sh"
+
 cat > "$TMP_DIR/matmul_0.json" <<EOF
 {
 	"pipeline": [
@@ -104,6 +107,73 @@ cat > "$TMP_DIR/matmul_2.json" <<EOF
 }
 EOF
 
+cat > "$TMP_DIR/matmul_3.json" <<EOF
+{
+	"pipeline": [
+	{
+		"uri": "anyloop:test_source",
+			"params": {
+				"type": "vector_float",
+				"size1": 8,
+				"kind": "constant",
+				"offset": 4
+			}
+	},
+	{
+		"uri": "anyloop:matmul",
+		"params": {
+			"filename": "${TMP_DIR}/matmul_0.aylp",
+			"type": "vector",
+			"precision": "float"
+		}
+	},
+	{
+		"uri": "anyloop:logger"
+	},
+	{
+		"uri": "anyloop:stop_after_count",
+		"params": {
+			"count": 1
+		}
+	}
+	]
+}
+EOF
+
+cat > "$TMP_DIR/matmul_4.json" <<EOF
+{
+	"pipeline": [
+	{
+		"uri": "anyloop:test_source",
+			"params": {
+				"type": "matrix_float",
+				"size1": 8,
+				"size2": 8,
+				"kind": "constant",
+				"offset": 4
+			}
+	},
+	{
+		"uri": "anyloop:matmul",
+		"params": {
+			"filename": "${TMP_DIR}/matmul_0.aylp",
+			"type": "matrix",
+			"precision": "float"
+		}
+	},
+	{
+		"uri": "anyloop:logger"
+	},
+	{
+		"uri": "anyloop:stop_after_count",
+		"params": {
+			"count": 1
+		}
+	}
+	]
+}
+EOF
+
 "$BUILD_DIR"/anyloop -pl TRACE "$TMP_DIR/matmul_0.json" 2>/dev/null
 
 res=$( \
@@ -126,5 +196,94 @@ if [ $res != "4" ]; then
 	exit 1
 fi
 
+# single precision gives the same products
+res=$( \
+	"$BUILD_DIR"/anyloop -pl TRACE "$TMP_DIR/matmul_3.json" 2>&1 \
+	| grep -F "[2, 2, 2, 2]" | wc -l \
+)
+
+if [ $res != "1" ]; then
+	echo "matmul FAIL"
+	exit 1
+fi
+
+res=$( \
+	"$BUILD_DIR"/anyloop -pl TRACE "$TMP_DIR/matmul_4.json" 2>&1 \
+	| grep -F "2, 2, 2, 2, 2, 2, 2, 2" | wc -l \
+)
+
+if [ $res != "4" ]; then
+	echo "matmul FAIL"
+	exit 1
+fi
+
+# $1 is the params for matmul, besides its type
+vector_conf() {
+pipeline_conf 1 <<EOF
+	{
+		"uri": "anyloop:test_source",
+			"params": {
+				"type": "vector",
+				"size1": 8,
+				"kind": "constant",
+				"offset": 4
+			}
+	},
+	{
+		"uri": "anyloop:matmul",
+		"params": {
+			$1,
+			"type": "vector"
+		}
+	}
+EOF
+}
+
+file="\"filename\": \"$TMP_DIR/matmul_0.aylp\""
+
+# mapping the file or copying it into hugepages gives the same product
+for load in mmap hugepage; do
+	vector_conf "$file, \"load\": \"$load\"" > "$TMP_DIR/matmul_load.json"
+	if [ "$(logged "$TMP_DIR/matmul_load.json")" != "[2, 2, 2, 2]" ]; then
+		echo "matmul FAIL"
+		exit 1
+	fi
+done
+
+# so does storing it sparsely
+vector_conf "$file, \"sparse\": true" > "$TMP_DIR/matmul_sparse.json"
+if [ "$(logged "$TMP_DIR/matmul_sparse.json")" != "[2, 2, 2, 2]" ]; then
+	echo "matmul FAIL"
+	exit 1
+fi
+
+# a mostly-zero matrix, which "auto" stores sparsely, with and without
+# splitting its rows over threads
+blocks="\"matrix\": [[1, 2, 0, 0, 0, 0, 0, 0], [0, 0, 3, 0, 0, 0, 0, 0],
+	[0, 0, 0, 0, 5, 0, 0, 0], [0, 0, 0, 0, 0, 0, 7, 8]]"
+for params in "" ", \"sparse\": \"auto\"" \
+", \"sparse\": \"auto\", \"thread_count\": 3"; do
+	vector_conf "$blocks$params" > "$TMP_DIR/matmul_sparse.json"
+	if [ "$(logged "$TMP_DIR/matmul_sparse.json")" != "[3, 3, 5, 15]" ]; then
+		echo "matmul FAIL"
+		exit 1
+	fi
+done
+
+# the matmul.sh matrix only has rank 1, so keeping its largest singular value
+# gives the same product; so does keeping both of a rank-2 matrix's
+vector_conf "$file, \"rank\": 1" > "$TMP_DIR/matmul_rank.json"
+if [ "$(logged "$TMP_DIR/matmul_rank.json")" != "[2, 2, 2, 2]" ]; then
+	echo "matmul FAIL"
+	exit 1
+fi
+vector_conf "\"matrix\": [[1, 1, 1, 1, 0, 0, 0, 0], [0, 0, 0, 0, 1, 1, 1, 1],
+	[1, 1, 1, 1, 1, 1, 1, 1], [2, 2, 2, 2, 1, 1, 1, 1]], \"rank\": 2" \
+	> "$TMP_DIR/matmul_rank.json"
+if [ "$(logged "$TMP_DIR/matmul_rank.json")" != "[4, 4, 8, 12]" ]; then
+	echo "matmul FAIL"
+	exit 1
+fi
+
 echo "matmul PASS"
 
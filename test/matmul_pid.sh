@@ -0,0 +1,83 @@
+#!/bin/sh
+set -e
+
+if [ -z "$TMP_DIR" ]; then
+	echo "TMP_DIR not set"
+	exit 1
+fi
+if [ -z "$BUILD_DIR" ]; then
+	echo "BUILD_DIR not set"
+	exit 1
+fi
+
+# for the helpers in test.sh
+AYLP_TEST_HELPERS=1 . "$(dirname "$0")/test.sh"
+
+matrix="[[0.5, 0.25, 0, 0, 0, 0, 0, 0.25], [0, 0.5, 0.5, 0.5, 0, 0, 0, 0],
+	[0, 0, 0, 0, 1, 1, 0, 0], [-0.25, -0.25, 0, 0, 0, 0, 0, 1]]"
+control="\"p\": 0.5, \"i\": 2, \"d\": 0.01, \"clamp\": 0.8, \"fixed_dt\": 0.1"
+limits="\"min\": -0.3, \"max\": 0.4"
+
+# $1 is the devices that go between the source and the logger
+write_conf() {
+pipeline_conf 12 <<EOF
+	{
+		"uri": "anyloop:test_source",
+			"params": {
+				"type": "vector",
+				"size1": 8,
+				"kind": "sine",
+				"frequency": 0.7,
+				"amplitude": 0.9
+			}
+	},
+	$1
+EOF
+}
+
+write_conf "{
+		\"uri\": \"anyloop:matmul\",
+		\"params\": {
+			\"type\": \"vector\",
+			\"matrix\": $matrix
+		}
+	},
+	{
+		\"uri\": \"anyloop:pid\",
+		\"params\": {
+			\"type\": \"vector\",
+			$control
+		}
+	},
+	{
+		\"uri\": \"anyloop:clamp\",
+		\"params\": {
+			\"type\": \"vector\",
+			$limits
+		}
+	}" > "$TMP_DIR/matmul_pid_chain.json"
+chain=$(logged "$TMP_DIR/matmul_pid_chain.json")
+
+# the frames should vary, and hit both limits, for this to mean much
+if [ "$(echo "$chain" | sort -u | wc -l)" -lt 8 ] \
+|| ! echo "$chain" | grep -qF -- "-0.3" \
+|| ! echo "$chain" | grep -qF "0.4"; then
+	echo "matmul_pid FAIL"
+	exit 1
+fi
+
+write_conf "{
+		\"uri\": \"anyloop:matmul_pid\",
+		\"params\": {
+			\"matrix\": $matrix,
+			$control,
+			$limits
+		}
+	}" > "$TMP_DIR/matmul_pid.json"
+
+if [ "$(logged "$TMP_DIR/matmul_pid.json")" != "$chain" ]; then
+	echo "matmul_pid FAIL"
+	exit 1
+fi
+
+echo "matmul_pid PASS"
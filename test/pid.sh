@@ -0,0 +1,85 @@
+#!/bin/sh
+set -e
+
+if [ -z "$TMP_DIR" ]; then
+	echo "TMP_DIR not set"
+	exit 1
+fi
+if [ -z "$BUILD_DIR" ]; then
+	echo "BUILD_DIR not set"
+	exit 1
+fi
+
+# for the helpers in test.sh
+AYLP_TEST_HELPERS=1 . "$(dirname "$0")/test.sh"
+
+# $1 is the type of the pipeline vectors; the matmul scales the one-element
+# source to 11 elements (more than a whole number of SIMD lanes) that differ
+write_conf() {
+pipeline_conf 12 <<EOF
+	{
+		"uri": "anyloop:test_source",
+			"params": {
+				"type": "$1",
+				"size1": 1,
+				"kind": "sine",
+				"frequency": 0.7,
+				"amplitude": 0.9
+			}
+	},
+	{
+		"uri": "anyloop:matmul",
+		"params": {
+			"type": "vector",
+			"precision": "$([ "$1" = vector ] && echo double || echo float)",
+			"matrix": [[-1], [-0.8], [-0.6], [-0.4], [-0.2], [0], [0.2],
+				[0.4], [0.6], [0.8], [1]]
+		}
+	},
+	{
+		"uri": "anyloop:pid",
+		"params": {
+			"type": "$1",
+			"p": 0.5,
+			"i": 2,
+			"d": 0.01,
+			"clamp": 0.8,
+			"fixed_dt": 0.1
+		}
+	}
+EOF
+}
+
+# the corrections for the above, worked out by hand, one per line
+awk 'BEGIN {
+	p = 0.5; i = 2; d = 0.01; lim = 0.8; dt = 0.1
+	for (t = 0; t < 12; t++) {
+		x = 0.9 * sin(0.7 * t)
+		for (j = 0; j < 11; j++) {
+			s = x * (0.2 * j - 1)
+			a[j] += dt * s
+			if (a[j] < -lim) a[j] = -lim
+			if (a[j] > lim) a[j] = lim
+			r = - p * s - i * a[j] - d / dt * (s - prev[j])
+			if (r < -lim) r = -lim
+			if (r > lim) r = lim
+			prev[j] = s
+			print r
+		}
+	}
+}' > "$TMP_DIR/pid_expected.txt"
+
+for type in vector vector_float; do
+	write_conf $type > "$TMP_DIR/pid.json"
+	logged_elements "$TMP_DIR/pid.json" > "$TMP_DIR/pid.txt"
+	if [ "$(wc -l < "$TMP_DIR/pid.txt")" != "132" ] \
+	|| ! paste "$TMP_DIR/pid.txt" "$TMP_DIR/pid_expected.txt" | awk '{
+		e = $1 - $2; if (e < 0) e = -e
+		if (e > 1e-5) exit 1
+	}'; then
+		echo "pid FAIL"
+		exit 1
+	fi
+done
+
+echo "pid PASS"
@@ -0,0 +1,104 @@
+#!/bin/sh
+set -e
+
+if [ -z "$TMP_DIR" ]; then
+	echo "TMP_DIR not set"
+	exit 1
+fi
+if [ -z "$BUILD_DIR" ]; then
+	echo "BUILD_DIR not set"
+	exit 1
+fi
+
+# for the helpers in test.sh
+AYLP_TEST_HELPERS=1 . "$(dirname "$0")/test.sh"
+
+# a dark frame that varies from row to row, so that each row of regions has a
+# different centroid
+column=$(awk 'BEGIN {
+	for (y = 0; y < 256; y++) printf "%s[%d]", y ? ", " : "", y * y * 7 % 61
+}')
+cat > "$TMP_DIR/pool_dark.json" <<EOF
+{
+	"pipeline": [
+	{
+		"uri": "anyloop:test_source",
+			"params": {
+				"type": "matrix",
+				"kind": "constant",
+				"offset": 1,
+				"size1": 1,
+				"size2": 256
+			}
+	},
+	{
+		"uri": "anyloop:matmul",
+		"params": {
+			"type": "matrix",
+			"matrix": [$column]
+		}
+	},
+	{
+		"uri": "anyloop:file_sink",
+		"params": {
+			"filename": "$TMP_DIR/pool_dark.aylp"
+		}
+	},
+	{
+		"uri": "anyloop:stop_after_count",
+		"params": {
+			"count": 1
+		}
+	}
+	]
+}
+EOF
+rm -f "$TMP_DIR/pool_dark.aylp"
+"$BUILD_DIR"/anyloop "$TMP_DIR/pool_dark.json" >/dev/null 2>&1
+
+# $1 is the top-level thread count, $2 is tasks_per_thread
+write_conf() {
+pipeline_conf 4 "\"threads\": $1" <<EOF
+	{
+		"uri": "anyloop:test_source",
+			"params": {
+				"type": "matrix_uchar",
+				"kind": "constant",
+				"offset": 255,
+				"size1": 256,
+				"size2": 256
+			}
+	},
+	{
+		"uri": "anyloop:center_of_mass",
+		"params": {
+			"region_height": 32,
+			"region_width": 32,
+			"mode": "tcog",
+			"dark": "$TMP_DIR/pool_dark.aylp",
+			"tasks_per_thread": $2
+		}
+	}
+EOF
+}
+
+write_conf 0 1 > "$TMP_DIR/pool_serial.json"
+serial=$(logged "$TMP_DIR/pool_serial.json")
+if [ "$(echo "$serial" | wc -l)" != "4" ] \
+|| [ -z "$(echo "$serial" | grep -v "^\[[0, ]*\]$")" ]; then
+	echo "pool FAIL"
+	exit 1
+fi
+
+# There are 8 rows of regions. With 6 threads (counting the loop thread) and 2
+# bands per thread, every row becomes its own band; with 12 threads, there are
+# more threads than bands.
+for conf in "5 2" "11 1"; do
+	write_conf $conf > "$TMP_DIR/pool.json"
+	if [ "$(logged "$TMP_DIR/pool.json")" != "$serial" ]; then
+		echo "pool FAIL"
+		exit 1
+	fi
+done
+
+echo "pool PASS"
@@ -0,0 +1,99 @@
+#!/bin/sh
+set -e
+
+if [ -z "$TMP_DIR" ]; then
+	echo "TMP_DIR not set"
+	exit 1
+fi
+if [ -z "$BUILD_DIR" ]; then
+	echo "BUILD_DIR not set"
+	exit 1
+fi
+
+# for the helpers in test.sh
+AYLP_TEST_HELPERS=1 . "$(dirname "$0")/test.sh"
+
+# $1 is the source, and $2 the number of columns of the matrix after it
+write_conf() {
+pipeline_conf 1 <<EOF
+	$1,
+	{
+		"uri": "anyloop:matmul",
+		"params": {
+			"type": "vector",
+			"matrix": [[$(awk -v n="$2" 'BEGIN {
+				for (i = 0; i < n; i++) printf "%s1", i ? ", " : ""
+			}')]]
+		}
+	}
+EOF
+}
+
+# succeed if config $1 runs and logs a vector, and fail if it's rejected at
+# startup, before any frames go through; anything else fails the test
+runs() {
+	out=$("$BUILD_DIR"/anyloop -l INFO "$1" 2>&1) && status=0 || status=$?
+	if [ $status = 0 ] && echo "$out" | grep -qF "Seeing vector"; then
+		return 0
+	fi
+	if [ $status != 0 ] && ! echo "$out" | grep -qF "Seeing vector" \
+	&& echo "$out" | grep -qF "is incompatible with input of shape"; then
+		return 1
+	fi
+	echo "shape FAIL"
+	exit 1
+}
+
+vector="{
+		\"uri\": \"anyloop:test_source\",
+			\"params\": {
+				\"type\": \"vector\",
+				\"size1\": 8,
+				\"kind\": \"constant\",
+				\"offset\": 1
+			}
+	}"
+write_conf "$vector" 8 > "$TMP_DIR/shape.json"
+if ! runs "$TMP_DIR/shape.json"; then
+	echo "shape FAIL"
+	exit 1
+fi
+write_conf "$vector" 5 > "$TMP_DIR/shape.json"
+if runs "$TMP_DIR/shape.json"; then
+	echo "shape FAIL"
+	exit 1
+fi
+
+# the shape goes through devices that change it: 12 of the 16 regions are
+# valid, so center_of_mass outputs 24 coordinates
+centroids="{
+		\"uri\": \"anyloop:test_source\",
+			\"params\": {
+				\"type\": \"matrix_uchar\",
+				\"size1\": 256,
+				\"size2\": 256,
+				\"kind\": \"constant\",
+				\"offset\": 1
+			}
+	},
+	{
+		\"uri\": \"anyloop:center_of_mass\",
+		\"params\": {
+			\"region_height\": 64,
+			\"region_width\": 64,
+			\"valid_mask\": [[0, 1, 1, 0], [1, 1, 1, 1], [1, 1, 1, 1],
+				[0, 1, 1, 0]]
+		}
+	}"
+write_conf "$centroids" 24 > "$TMP_DIR/shape.json"
+if ! runs "$TMP_DIR/shape.json"; then
+	echo "shape FAIL"
+	exit 1
+fi
+write_conf "$centroids" 32 > "$TMP_DIR/shape.json"
+if runs "$TMP_DIR/shape.json"; then
+	echo "shape FAIL"
+	exit 1
+fi
+
+echo "shape PASS"
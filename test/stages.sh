@@ -0,0 +1,84 @@
+#!/bin/sh
+set -e
+
+if [ -z "$TMP_DIR" ]; then
+	echo "TMP_DIR not set"
+	exit 1
+fi
+if [ -z "$BUILD_DIR" ]; then
+	echo "BUILD_DIR not set"
+	exit 1
+fi
+
+cat > "$TMP_DIR/stages.json" <<EOF
+{
+	"loop": {
+		"stages": [1, 2]
+	},
+	"pipeline": [
+	{
+		"uri": "anyloop:test_source",
+			"params": {
+				"type": "vector",
+				"size1": 8,
+				"kind": "constant",
+				"offset": 4
+			}
+	},
+	{
+		"uri": "anyloop:matmul",
+		"params": {
+			"matrix": [[0.25, 0.25, 0.25, 0.25, 0.25, 0.25, 0.25, 0.25],
+				[0.5, 0.5, 0.5, 0.5, 0.5, 0.5, 0.5, 0.5]],
+			"type": "vector"
+		}
+	},
+	{
+		"uri": "anyloop:logger"
+	},
+	{
+		"uri": "anyloop:stop_after_count",
+		"params": {
+			"count": 16
+		}
+	}
+	]
+}
+EOF
+
+res=$( \
+	"$BUILD_DIR"/anyloop -p "$TMP_DIR/stages.json" 2>&1 \
+	| grep -F "[2, 4]" | wc -l \
+)
+
+if [ $res != "16" ]; then
+	echo "stages FAIL"
+	exit 1
+fi
+
+# nothing comes back around from the last stage, so feedback is rejected
+cat > "$TMP_DIR/stages_feedback.json" <<EOF
+{
+	"loop": {
+		"stages": [1]
+	},
+	"pipeline": [
+	{
+		"uri": "anyloop:logger"
+	},
+	{
+		"uri": "anyloop:stop_after_count",
+		"params": {
+			"count": 16
+		}
+	}
+	]
+}
+EOF
+
+if "$BUILD_DIR"/anyloop "$TMP_DIR/stages_feedback.json" >/dev/null 2>&1; then
+	echo "stages FAIL"
+	exit 1
+fi
+
+echo "stages PASS"
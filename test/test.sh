@@ -4,6 +4,51 @@ set -e
 # TODO: this is all pretty rudimentary and manual; the whole testing framework
 # should be made more resilient
 
+# The scripts below source this file with AYLP_TEST_HELPERS set, for these
+# helpers, which they need whether they're run from here or on their own.
+
+# Print a config that runs the devices given on stdin (a comma-separated list
+# of json objects), then a logger, for $1 iterations. Any further arguments
+# are top-level settings such as "\"threads\": 2".
+pipeline_conf() {
+	count=$1
+	shift
+	echo "{"
+	for setting in "$@"; do
+		printf '\t%s,\n' "$setting"
+	done
+	printf '\t"pipeline": [\n'
+	sed '$ s/$/,/'
+	cat <<EOF
+	{
+		"uri": "anyloop:logger"
+	},
+	{
+		"uri": "anyloop:stop_after_count",
+		"params": {
+			"count": $count
+		}
+	}
+	]
+}
+EOF
+}
+
+# print the vectors the logger saw in a run of config $1, one per line
+logged() {
+	"$BUILD_DIR"/anyloop -l INFO "$1" 2>&1 \
+	| grep -F "logger.c" | grep -F "[" | sed 's/.*: \[/[/'
+}
+
+# print the elements of those vectors, one per line
+logged_elements() {
+	logged "$1" | sed 's/^\[//; s/\]//' | tr ',' '\n' | tr -d ' '
+}
+
+if [ -n "$AYLP_TEST_HELPERS" ]; then
+	return 0
+fi
+
 export TEST_DIR=$(dirname "$0")
 export TMP_DIR="/tmp/aylp_test"
 export BUILD_DIR="$PWD/build"
@@ -12,4 +57,13 @@ mkdir -p "$TMP_DIR"
 
 sh "$TEST_DIR/com.sh"
 sh "$TEST_DIR/matmul.sh"
+sh "$TEST_DIR/matmul_pid.sh"
+sh "$TEST_DIR/batch.sh"
+sh "$TEST_DIR/pid.sh"
+sh "$TEST_DIR/iir.sh"
+sh "$TEST_DIR/inplace.sh"
+sh "$TEST_DIR/shape.sh"
+sh "$TEST_DIR/hugepages.sh"
+sh "$TEST_DIR/pool.sh"
 
+sh "$TEST_DIR/stages.sh"